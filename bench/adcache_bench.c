@@ -0,0 +1,134 @@
+// Cost of handling repeated advertising payloads with and without the AD cache.
+//
+// NDEV devices each repeat one 30-byte payload (flags plus iBeacon for a
+// quarter of them, flags plus name and manufacturer data otherwise). The
+// uncached path indexes the AD data and runs the beacon decoders on every
+// frame; the cached path fingerprints the payload and reuses both. Also
+// compares bglib_hash_ad() with bglib_hash64() on the same payloads.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <bglib/adcache.h>
+#include <bglib/beacon.h>
+#include <bglib/clock.h>
+#include <bglib/devtable.h>
+#include <bglib/hash.h>
+
+#define NDEV   256
+#define ROUNDS 20000
+
+static unsigned beacons;
+
+static void on_ibeacon(void* user, const struct ble_msg_gap_scan_response_evt_t* msg, const struct bglib_ibeacon* b)
+{
+  (void)user; (void)msg; (void)b;
+  beacons++;
+}
+
+static unsigned make_frame(uint8* p, unsigned i)
+{
+  unsigned n = 11, j;
+
+  memset(p, 0, 64);
+  p[0] = (uint8)(-50 - i % 40);
+  for (j = 0; j < 6; j++) p[2 + j] = (uint8)(i * 29 + j);
+  p[9] = 0xff;
+  p[n++] = 2; p[n++] = 0x01; p[n++] = 0x06;
+  if (i % 4 == 0)
+  {
+    p[n++] = 26; p[n++] = 0xff; p[n++] = 0x4c; p[n++] = 0x00; p[n++] = 0x02; p[n++] = 0x15;
+    for (j = 0; j < 16; j++) p[n++] = (uint8)(j * 17);
+    p[n++] = 0; p[n++] = (uint8)i; p[n++] = 0; p[n++] = 1; p[n++] = 0xc5;
+  }
+  else
+  {
+    p[n++] = 9; p[n++] = 0x09;
+    for (j = 0; j < 8; j++) p[n++] = 'a' + (i + j) % 26;
+    p[n++] = 16; p[n++] = 0xff; p[n++] = (uint8)i; p[n++] = 0x01;
+    for (j = 0; j < 13; j++) p[n++] = (uint8)(i ^ j);
+  }
+  p[10] = n - 11;
+  return n;
+}
+
+int main(void)
+{
+  static uint8 frames[NDEV][64];
+  const struct bglib_device* devs[NDEV];
+  unsigned lens[NDEV];
+  struct bglib_beacon_callbacks cb;
+  struct bglib_beacon_registry* reg;
+  struct bglib_devtable* tbl;
+  struct bglib_adcache* cache;
+  struct bglib_adcache_stats st;
+  struct gap_ad_index idx;
+  uint64_t t0, t1, sink = 0;
+  unsigned i, r, plain, cached;
+
+  memset(&cb, 0, sizeof(cb));
+  cb.ibeacon = on_ibeacon;
+  reg = bglib_beacon_create(&cb);
+  tbl = bglib_devtable_create(NULL);
+  cache = bglib_adcache_create(bglib_devtable_capacity(tbl));
+  for (i = 0; i < NDEV; i++)
+  {
+    lens[i] = make_frame(frames[i], i);
+    bglib_devtable_update(tbl, (const struct ble_msg_gap_scan_response_evt_t*)frames[i], lens[i], 0, &devs[i]);
+  }
+
+  t0 = bglib_monotonic_ns();
+  for (r = 0; r < ROUNDS; r++)
+    for (i = 0; i < NDEV; i++)
+      sink += bglib_hash64(frames[i] + 11, frames[i][10], 0);
+  t1 = bglib_monotonic_ns();
+  printf("bglib_hash64:  %.1f ns/payload\n", (double)(t1 - t0) / ((double)ROUNDS * NDEV));
+
+  t0 = bglib_monotonic_ns();
+  for (r = 0; r < ROUNDS; r++)
+    for (i = 0; i < NDEV; i++)
+      sink += bglib_hash_ad(frames[i] + 11, frames[i][10]);
+  t1 = bglib_monotonic_ns();
+  printf("bglib_hash_ad: %.1f ns/payload\n", (double)(t1 - t0) / ((double)ROUNDS * NDEV));
+
+  beacons = 0;
+  t0 = bglib_monotonic_ns();
+  for (r = 0; r < ROUNDS; r++)
+    for (i = 0; i < NDEV; i++)
+    {
+      const struct ble_msg_gap_scan_response_evt_t* msg = (const struct ble_msg_gap_scan_response_evt_t*)frames[i];
+      const uint8* data;
+      unsigned len = gap_ad_scan_data(msg, lens[i], &data);
+
+      gap_ad_index_build(&idx, data, len);
+      bglib_beacon_process_index(reg, msg, data, &idx);
+    }
+  t1 = bglib_monotonic_ns();
+  plain = beacons;
+  printf("uncached: %.1f ns/frame\n", (double)(t1 - t0) / ((double)ROUNDS * NDEV));
+
+  beacons = 0;
+  t0 = bglib_monotonic_ns();
+  for (r = 0; r < ROUNDS; r++)
+    for (i = 0; i < NDEV; i++)
+    {
+      const struct ble_msg_gap_scan_response_evt_t* msg = (const struct ble_msg_gap_scan_response_evt_t*)frames[i];
+      struct bglib_ad_view view;
+
+      bglib_adcache_get(cache, devs[i], msg, lens[i], &view);
+      bglib_adcache_beacons(cache, reg, msg, &view);
+    }
+  t1 = bglib_monotonic_ns();
+  cached = beacons;
+  bglib_adcache_get_stats(cache, &st);
+  printf("cached:   %.1f ns/frame, %.1f%% repeats, %llu beacon runs skipped, %llu replayed\n",
+         (double)(t1 - t0) / ((double)ROUNDS * NDEV), 100.0 * st.repeats / st.lookups,
+         (unsigned long long)st.beacon_skips, (unsigned long long)st.beacon_replays);
+  printf("beacons decoded: %u uncached, %u cached (sink %llx)\n", plain, cached, (unsigned long long)(sink & 0xf));
+
+  bglib_adcache_destroy(cache);
+  bglib_devtable_destroy(tbl);
+  bglib_beacon_destroy(reg);
+  return 0;
+}
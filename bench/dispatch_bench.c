@@ -0,0 +1,129 @@
+// Per-frame decode + dispatch cost.
+//
+// Built twice: bench_dispatch_shared links libbglib.so, bench_dispatch_static
+// links libbglib.a with LTO. Build with -DCMAKE_BUILD_TYPE=Release and
+// compare the two outputs.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bglib/clock.h>
+#include <bglib/cmd_def.h>
+#include <bglib/dispatch.h>
+#include <bglib/frame.h>
+
+#define NFRAMES 64
+#define ROUNDS  200000
+
+static volatile uint64_t sink;
+
+void ble_evt_gap_scan_response(const struct ble_msg_gap_scan_response_evt_t* msg)
+{
+  sink += msg->rssi + msg->packet_type + msg->sender.addr[0] + msg->data.len;
+}
+
+void ble_evt_attclient_attribute_value(const struct ble_msg_attclient_attribute_value_evt_t* msg)
+{
+  sink += msg->connection + msg->atthandle + msg->value.len;
+}
+
+void ble_evt_connection_status(const struct ble_msg_connection_status_evt_t* msg)
+{
+  sink += msg->connection + msg->conn_interval;
+}
+
+static void put_frame(uint8* out, uint8 idx, const uint8* payload, uint8 len)
+{
+  struct ble_header hdr = ble_get_msg(idx)->hdr;
+  hdr.lolen = len;
+  memcpy(out, &hdr, sizeof(hdr));
+  memcpy(out + sizeof(hdr), payload, len);
+}
+
+static void make_frames(uint8 frames[NFRAMES][BGLIB_FRAME_MAX])
+{
+  uint8 p[64];
+  int i, j;
+
+  for (i = 0; i < NFRAMES; i++)
+  {
+    memset(p, 0, sizeof(p));
+    switch (i % 4)
+    {
+      case 0:
+      case 1: // scan response with 31 bytes of AD data
+        p[0] = (uint8)(-40 - i);
+        p[1] = 0;
+        for (j = 0; j < 6; j++) p[2 + j] = i * 7 + j;
+        p[10] = 31;
+        for (j = 0; j < 31; j++) p[11 + j] = j;
+        put_frame(frames[i], ble_evt_gap_scan_response_idx, p, 42);
+        break;
+      case 2: // notification
+        p[0] = i & 7;
+        p[1] = 0x10;
+        p[3] = attclient_attribute_value_type_notify;
+        p[4] = 20;
+        put_frame(frames[i], ble_evt_attclient_attribute_value_idx, p, 25);
+        break;
+      default:
+        p[0] = i & 7;
+        p[1] = connection_connected;
+        p[9] = 6;
+        put_frame(frames[i], ble_evt_connection_status_idx, p, 16);
+    }
+  }
+}
+
+typedef void (*dispatch_fn)(const struct ble_header* hdr, const uint8* payload);
+
+static void via_get_msg_hdr(const struct ble_header* hdr, const uint8* payload)
+{
+  ble_get_msg_hdr(*hdr)->handler(payload);
+}
+
+static void via_lookup_inline(const struct ble_header* hdr, const uint8* payload)
+{
+  bglib_lookup_msg(hdr)->handler(payload);
+}
+
+static void via_dispatch(const struct ble_header* hdr, const uint8* payload)
+{
+  bglib_dispatch(hdr, payload);
+}
+
+static void run(const char* name, dispatch_fn fn, uint8 frames[NFRAMES][BGLIB_FRAME_MAX])
+{
+  uint64_t start, end;
+  struct ble_header hdr;
+  int r, i;
+
+  start = bglib_monotonic_ns();
+  for (r = 0; r < ROUNDS; r++)
+  {
+    for (i = 0; i < NFRAMES; i++)
+    {
+      memcpy(&hdr, frames[i], sizeof(hdr));
+      fn(&hdr, frames[i] + sizeof(hdr));
+    }
+  }
+  end = bglib_monotonic_ns();
+
+  printf("%-22s %6.2f ns/frame\n", name, (double)(end - start) / ((double)ROUNDS * NFRAMES));
+}
+
+int main(int argc, char** argv)
+{
+  static uint8 frames[NFRAMES][BGLIB_FRAME_MAX];
+
+  make_frames(frames);
+
+  printf("%s\n", argv[0]);
+  run("ble_get_msg_hdr", via_get_msg_hdr, frames);
+  run("bglib_lookup_msg", via_lookup_inline, frames);
+  run("bglib_dispatch", via_dispatch, frames);
+
+  return sink == 0;
+}
@@ -0,0 +1,115 @@
+// RPA resolution cost: host AES (AES-NI and portable) against the
+// system_aes_* offload path of the dongle.
+//
+// Addresses are fresh RPAs, so every lookup misses the cache and, for the
+// unresolvable ones, runs one AES block per IRK. The offload path is not
+// timed on hardware; its floor is the UART time of the setkey/encrypt
+// command and response frames per IRK, computed from the real encoded
+// frame sizes.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bglib/clock.h>
+#include <bglib/cmd_def.h>
+#include <bglib/frame.h>
+#include <bglib/rpa.h>
+
+#define LOOKUPS 2000
+
+static uint64_t rng = 0x9e3779b97f4a7c15ull;
+
+static uint32_t rnd(void)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return (uint32_t)rng;
+}
+
+static void make_rpa(bd_addr* a, const uint8* irk)
+{
+  uint32_t prand = (rnd() & 0x3fffff) | 0x400000;
+  uint32_t hash = irk ? bglib_rpa_ah(irk, prand) : rnd() & 0xffffff;
+  int i;
+
+  for (i = 0; i < 3; i++)
+  {
+    a->addr[i] = hash >> (8 * i);
+    a->addr[3 + i] = prand >> (8 * i);
+  }
+}
+
+static double run(struct bglib_rpa_resolver* r, uint8 (*irks)[16], unsigned nirks, int resolvable)
+{
+  bd_addr* addrs = malloc(LOOKUPS * sizeof(*addrs));
+  uint64_t t0, t1;
+  unsigned i, found = 0;
+  uint32_t id;
+
+  for (i = 0; i < LOOKUPS; i++)
+    make_rpa(&addrs[i], resolvable ? irks[rnd() % nirks] : NULL);
+  t0 = bglib_monotonic_ns();
+  for (i = 0; i < LOOKUPS; i++)
+    found += bglib_rpa_resolve(r, &addrs[i], &id);
+  t1 = bglib_monotonic_ns();
+  free(addrs);
+  if (resolvable && found != LOOKUPS)
+    printf("  warning: %u of %u RPAs resolved\n", found, LOOKUPS);
+  return (double)(t1 - t0) / LOOKUPS;
+}
+
+static unsigned frame_bytes(uint8 idx, uint8 len, const uint8* data)
+{
+  struct bglib_frame frame;
+
+  return bglib_frame_encode(&frame, idx, len, data);
+}
+
+int main(void)
+{
+  static const uint8 spec_irk[16] = { 0xec, 0x02, 0x34, 0xa3, 0x57, 0xc8, 0xad, 0x05,
+                                      0x34, 0x10, 0x10, 0xa6, 0x0a, 0x39, 0x7d, 0x9b };
+  static const unsigned sizes[] = { 100, 1000, 5000 };
+  uint8 zero[16] = { 0 };
+  unsigned s, i, uart;
+
+  printf("ah(spec irk, 0x708194) = 0x%06x (expected 0x0dfbaa)\n", bglib_rpa_ah(spec_irk, 0x708194));
+
+  // per IRK: setkey command + response, encrypt command + response
+  uart = frame_bytes(ble_cmd_system_aes_setkey_idx, 16, zero) + 4 +
+         frame_bytes(ble_cmd_system_aes_encrypt_idx, 16, zero) + 4 + 1 + 16;
+
+  for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+  {
+    unsigned n = sizes[s];
+    uint8 (*irks)[16] = malloc(n * 16);
+    struct bglib_rpa_resolver* r = bglib_rpa_create(0);
+    int portable;
+
+    for (i = 0; i < n * 16; i++)
+      irks[i / 16][i % 16] = rnd();
+    for (i = 0; i < n; i++)
+      bglib_rpa_add_irk(r, irks[i], i);
+
+    printf("%u IRKs\n", n);
+    for (portable = 0; portable < 2; portable++)
+    {
+      double miss, hit;
+
+      bglib_rpa_set_portable(r, portable);
+      miss = run(r, irks, n, 0);
+      hit = run(r, irks, n, 1);
+      printf("  %-8s unresolvable %9.0f ns (%5.1f ns/IRK), resolvable %9.0f ns\n",
+             bglib_rpa_backend(r), miss, miss / n, hit);
+    }
+    printf("  uart     %u bytes/IRK: %9.1f ms at 115200 baud, %7.1f ms at 1 Mbaud (unresolvable)\n",
+           uart, uart * 10.0 * n / 115200 * 1e3, uart * 10.0 * n / 1e6 * 1e3);
+
+    bglib_rpa_destroy(r);
+    free(irks);
+  }
+  return 0;
+}
@@ -0,0 +1,109 @@
+// Scan filter evaluation cost with a few thousand rules.
+//
+// Rules are a mix of OUI prefixes, company IDs, 16/128-bit service UUIDs
+// and name prefixes; frames are synthetic scan responses, some of which
+// match a rule. Prints ns per evaluated frame.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bglib/clock.h>
+#include <bglib/cmd_def.h>
+#include <bglib/scan_filter.h>
+
+#define NRULES  4000
+#define NFRAMES 256
+#define ROUNDS  20000
+
+static unsigned make_frame(uint8* p, unsigned i)
+{
+  unsigned n = 11, j;
+
+  memset(p, 0, 64);
+  p[0] = (uint8)(-40 - i % 50);
+  p[1] = (i % 3) * 2;
+  for (j = 0; j < 6; j++) p[2 + j] = (uint8)(i * 13 + j * 7);
+  p[8] = i & 1;
+  p[9] = 0xff;
+
+  // flags, manufacturer data, uuid16 list, short name
+  p[n++] = 2; p[n++] = 0x01; p[n++] = 0x06;
+  p[n++] = 5; p[n++] = 0xff; p[n++] = (uint8)i; p[n++] = (uint8)(i >> 8); p[n++] = 1; p[n++] = 2;
+  p[n++] = 5; p[n++] = 0x03; p[n++] = (uint8)(i * 3); p[n++] = 0x18; p[n++] = 0x0f; p[n++] = 0x18;
+  p[n++] = 5; p[n++] = 0x08; p[n++] = 'd'; p[n++] = 'e'; p[n++] = 'v'; p[n++] = '0' + i % 10;
+  p[10] = n - 11;
+  return n;
+}
+
+int main(void)
+{
+  struct bglib_scan_rule* rules = calloc(NRULES, sizeof(*rules));
+  static uint8 frames[NFRAMES][64];
+  unsigned lens[NFRAMES];
+  struct bglib_scan_filter_stats stats;
+  struct bglib_scan_filter* f;
+  uint64_t t0, t1;
+  unsigned i, r, pass = 0;
+
+  for (i = 0; i < NRULES; i++)
+  {
+    struct bglib_scan_rule* rule = &rules[i];
+
+    switch (i % 5)
+    {
+      case 0:
+        rule->match = BGLIB_SCAN_MATCH_ADDR;
+        rule->addr.addr[5] = (uint8)i; rule->addr.addr[4] = (uint8)(i >> 8); rule->addr.addr[3] = 0x5a;
+        rule->addr_bits = 24;
+        break;
+      case 1:
+        rule->match = BGLIB_SCAN_MATCH_COMPANY | BGLIB_SCAN_MATCH_RSSI;
+        rule->company = 1000 + i;
+        rule->rssi_min = -70;
+        break;
+      case 2:
+        rule->match = BGLIB_SCAN_MATCH_UUID16 | BGLIB_SCAN_MATCH_TYPE;
+        rule->uuid16 = 0x2000 + i;
+        break;
+      case 3:
+        rule->match = BGLIB_SCAN_MATCH_UUID128;
+        memset(rule->uuid128, (uint8)i, 16);
+        rule->uuid128[0] = (uint8)(i >> 8);
+        break;
+      case 4:
+        rule->match = BGLIB_SCAN_MATCH_NAME;
+        rule->name_len = snprintf(rule->name, sizeof(rule->name), "n%05u", i);
+        break;
+    }
+  }
+  // a few rules every frame can hit
+  rules[1].company = 7;
+  rules[2].uuid16 = 0x180f;
+  rules[2].address_type = 1;
+  rules[4].name_len = 4;
+  memcpy(rules[4].name, "dev7", 4);
+
+  f = bglib_scan_filter_compile(rules, NRULES, bglib_scan_drop);
+  for (i = 0; i < NFRAMES; i++)
+    lens[i] = make_frame(frames[i], i);
+
+  t0 = bglib_monotonic_ns();
+  for (r = 0; r < ROUNDS; r++)
+    for (i = 0; i < NFRAMES; i++)
+      pass += bglib_scan_filter_eval(f, (const struct ble_msg_gap_scan_response_evt_t*)frames[i], lens[i]);
+  t1 = bglib_monotonic_ns();
+
+  bglib_scan_filter_get_stats(f, &stats);
+  printf("%u rules: %.1f ns/frame, %.2f rules verified/frame, %.1f%% passed\n", NRULES,
+         (double)(t1 - t0) / ((double)ROUNDS * NFRAMES),
+         (double)stats.verified / stats.evaluated, 100.0 * pass / ((double)ROUNDS * NFRAMES));
+  printf("hits: company 7 %llu, uuid16 0x180f %llu, name \"dev7\" %llu\n",
+         (unsigned long long)bglib_scan_filter_hits(f, 1), (unsigned long long)bglib_scan_filter_hits(f, 2),
+         (unsigned long long)bglib_scan_filter_hits(f, 4));
+
+  bglib_scan_filter_destroy(f);
+  free(rules);
+  return 0;
+}
@@ -7,18 +7,14 @@
 #include <unistd.h>
 
 #include <bglib/cmd_def.h>
+#include <bglib/dispatch.h>
+#include <bglib/gap_ad.h>
 #include <bglib/uart.h>
 
 #define UART_TIMEOUT 1000
 
 volatile int tty_fd = -1;
 
-struct gap_ad_t {
-  uint8 len;
-  uint8 ad_type; // See enum gap_ad_types
-  uint8 data[];  // length: len - 1
-};
-
 void print_raw_packet(struct ble_header *hdr, unsigned char *data)
 {
   printf("Incoming packet: ");
@@ -36,44 +32,39 @@ void print_raw_packet(struct ble_header *hdr, unsigned char *data)
   printf("\n");
 }
 
-void parse_gap_ad(const uint8array* data)
+void parse_gap_ad(const uint8* data, unsigned len)
 {
-  const uint8* p = data->data;
-  const uint8* end_p = data->data + data->len;
-
-  struct gap_ad_t* ad = (struct gap_ad_t*)p;
-
-  char str[256] = {};
-
-  int i;
-  while (p < end_p)
+  struct gap_ad_iter it;
+  struct gap_ad ad;
+  const char* name;
+  const uint8* payload;
+  uint8 name_len, payload_len;
+  uint16 company;
+  int8 tx_power;
+  int i, r;
+
+  gap_ad_iter_init(&it, data, len);
+  while ((r = gap_ad_iter_next(&it, &ad)) > 0)
   {
-    switch (ad->ad_type)
+    if (gap_ad_name(&ad, &name, &name_len))
+      printf("name: \"%.*s\" ", name_len, name);
+    else if (ad.type == gap_ad_type_flags && ad.len)
+      printf("flags: %d ", ad.data[0]);
+    else if (gap_ad_tx_power(&ad, &tx_power))
+      printf("tx power: %d dBm ", tx_power);
+    else if (gap_ad_manufacturer(&ad, &company, &payload, &payload_len))
+      printf("manufacturer: 0x%04x (%d bytes) ", company, payload_len);
+    else if (gap_ad_uuid_count(&ad, NULL))
     {
-      case gap_ad_type_localname_short:
-      case gap_ad_type_localname_complete:
-        strncpy(str, ad->data, ad->len - 1);
-        printf("name: \"%s\" ", str);
-        break;
-      case gap_ad_type_flags:
-        printf("flags: %d ", ad->data[0]);
-        break;
-      case gap_ad_type_services_16bit_all:
-      case gap_ad_type_services_16bit_more:
-      case gap_ad_type_services_32bit_all:
-      case gap_ad_type_services_32bit_more:
-      case gap_ad_type_services_128bit_all:
-      case gap_ad_type_services_128bit_more:
-        printf("UUIDs: ");
-        for (i = ad->len - 2; i >= 0 ; i--)
-          printf("%02x ", ad->data[i]);
-        break;
-      default:
-        printf("unsupported: (type = 0x%02x, len = %d) ", ad->ad_type, ad->len);
+      printf("UUIDs: ");
+      for (i = ad.len - 1; i >= 0; i--)
+        printf("%02x ", ad.data[i]);
     }
-    p += ad->len + 1;
-    ad = (struct gap_ad_t*)p;
+    else
+      printf("%s: (type = 0x%02x, len = %d) ", gap_ad_type_name(ad.type), ad.type, ad.len);
   }
+  if (r < 0)
+    printf("malformed AD data");
 }
 
 void ble_evt_gap_scan_response(const struct ble_msg_gap_scan_response_evt_t* msg)
@@ -87,7 +78,14 @@ void ble_evt_gap_scan_response(const struct ble_msg_gap_scan_response_evt_t* msg
     if (i > 0) printf(":");
     else printf(" ");
   }
-  parse_gap_ad(&msg->data);
+  const struct ble_header* hdr;
+  const uint8* payload;
+  const uint8* data = msg->data.data;
+  unsigned len = 0;
+  // never trust data.len beyond what the frame actually carried
+  if (bglib_dispatch_current(&hdr, &payload))
+    len = gap_ad_scan_data(msg, bglib_payload_len(hdr), &data);
+  parse_gap_ad(data, len);
   printf("\n");
 }
 
@@ -140,7 +138,7 @@ int read_message(int timeout_ms)
     exit(1);
   }
 
-  msg->handler(data);
+  bglib_dispatch(&hdr, data);
 
   return 0;
 }
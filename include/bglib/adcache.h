@@ -0,0 +1,75 @@
+#ifndef BGLIB_ADCACHE_H
+#define BGLIB_ADCACHE_H
+
+#include <stdint.h>
+
+#include "beacon.h"
+#include "cmd_def.h"
+#include "devtable.h"
+#include "gap_ad.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per-device cache of parsed advertising payloads, indexed by
+ * bglib_device.id beside a bglib_devtable.
+ *
+ * Advertisements and scan responses are cached separately. A payload
+ * equal to the previous one of the same device (bglib_hash_ad()
+ * fingerprint first, then the stored bytes) keeps its gap_ad_index
+ * (offsets are valid for any buffer with the same contents), so lookups go
+ * through gap_ad_index_find() and the typed accessors unchanged. For
+ * repeats, bglib_adcache_beacons() skips payloads on which no beacon
+ * decoder fired and replays only the decoders that did, so callbacks get
+ * the new message (RSSI) without the lookup chain. Call
+ * bglib_adcache_clear() after registering further decoders. Not
+ * thread-safe.
+ */
+
+struct bglib_ad_view
+{
+    const uint8 *data;          /* AD data of the message */
+    unsigned len;
+    const struct gap_ad_index *index;
+    int repeat;                 /* 1 if the payload equals the previous one of the device */
+    void *entry;                /* internal */
+};
+
+struct bglib_adcache_stats
+{
+    uint64_t lookups;
+    uint64_t repeats;
+    uint64_t beacon_skips;      /* bglib_adcache_beacons() calls on repeats that decoded nothing */
+    uint64_t beacon_replays;    /* repeats that ran only the recorded decoders */
+};
+
+struct bglib_adcache;
+
+/**capacity must be bglib_devtable_capacity() of the table (NULL if 0)**/
+struct bglib_adcache *bglib_adcache_create(unsigned capacity);
+void bglib_adcache_destroy(struct bglib_adcache *c);
+
+/**Fill view for msg of dev (from bglib_devtable_update), returns view->repeat**/
+int bglib_adcache_get(struct bglib_adcache *c, const struct bglib_device *dev,
+                      const struct ble_msg_gap_scan_response_evt_t *msg, unsigned payload_len,
+                      struct bglib_ad_view *view);
+
+/**bglib_beacon_process_index() on view; repeats are skipped or replayed**/
+unsigned bglib_adcache_beacons(struct bglib_adcache *c, struct bglib_beacon_registry *reg,
+                               const struct ble_msg_gap_scan_response_evt_t *msg, const struct bglib_ad_view *view);
+
+/**Drop the entry of dev, call it from the devtable evict callback**/
+void bglib_adcache_forget(struct bglib_adcache *c, const struct bglib_device *dev);
+
+/**Forget every cached payload**/
+void bglib_adcache_clear(struct bglib_adcache *c);
+
+void bglib_adcache_get_stats(const struct bglib_adcache *c, struct bglib_adcache_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_ADCACHE_H
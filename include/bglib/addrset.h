@@ -0,0 +1,93 @@
+#ifndef BGLIB_ADDRSET_H
+#define BGLIB_ADDRSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cmd_def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Host-side address lists far larger than the dongle whitelist.
+ *
+ * A set is a blocked Bloom filter (one 64-byte block per lookup) in front of
+ * a sorted array of addresses that confirms the Bloom filter's "maybe".
+ * Sets are immutable; the in-memory layout is also the file format, so a
+ * saved set is opened with a single mmap. Files use host byte order.
+ * Address types are not part of the key.
+ */
+
+struct bglib_addrset;
+
+struct bglib_addrset_info
+{
+    uint64_t count;
+    uint32_t blocks;        /* 512-bit Bloom blocks */
+    uint32_t hashes;        /* bits set per address */
+    size_t bytes;
+    int mapped;
+};
+
+/**Duplicates are removed; bits_per_addr 0 selects 10 (about 1% false positives)**/
+struct bglib_addrset *bglib_addrset_build(const bd_addr *addrs, size_t n, unsigned bits_per_addr);
+int bglib_addrset_save(const struct bglib_addrset *set, const char *path);
+
+/**Map a file written by bglib_addrset_save, returns NULL if it is missing or malformed**/
+struct bglib_addrset *bglib_addrset_open(const char *path);
+void bglib_addrset_close(struct bglib_addrset *set);
+
+/**Bloom filter only: 0 means definitely absent**/
+int bglib_addrset_maybe(const struct bglib_addrset *set, const bd_addr *addr);
+int bglib_addrset_contains(const struct bglib_addrset *set, const bd_addr *addr);
+
+void bglib_addrset_get_info(const struct bglib_addrset *set, struct bglib_addrset_info *out);
+
+/*
+ * Allow or deny list over a replaceable set. Lookups take no locks;
+ * bglib_addrfilter_swap() publishes a new set and waits only for lookups
+ * still using the old one, so scanning never pauses.
+ */
+enum bglib_addrfilter_mode
+{
+    bglib_addrfilter_allow,     /* pass listed addresses only */
+    bglib_addrfilter_deny       /* drop listed addresses */
+};
+
+struct bglib_addrfilter_stats
+{
+    uint64_t checked;
+    uint64_t bloom_rejects;     /* decided by the Bloom filter alone */
+    uint64_t false_positives;   /* Bloom hit not confirmed by the set */
+    uint64_t listed;
+    uint64_t dropped;
+};
+
+struct bglib_addrfilter;
+
+struct bglib_addrfilter *bglib_addrfilter_create(enum bglib_addrfilter_mode mode);
+/**Also closes the installed set**/
+void bglib_addrfilter_destroy(struct bglib_addrfilter *af);
+
+/**Install set (may be NULL: every address passes), returns the previous set, which is no longer in use**/
+struct bglib_addrset *bglib_addrfilter_swap(struct bglib_addrfilter *af, struct bglib_addrset *set);
+
+/**Returns 1 if the address passes**/
+int bglib_addrfilter_check(struct bglib_addrfilter *af, const bd_addr *addr);
+
+void bglib_addrfilter_get_stats(const struct bglib_addrfilter *af, struct bglib_addrfilter_stats *out);
+
+/*
+ * bglib_dispatch filter: bglib_dispatch_add_filter(bglib_addrfilter_dispatch, af)
+ * checks the sender of scan responses before the frame is decoded.
+ */
+int bglib_addrfilter_dispatch(void *af, const struct ble_msg *msg, const struct ble_header *hdr,
+                              const uint8 *payload);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_ADDRSET_H
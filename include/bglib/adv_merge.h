@@ -0,0 +1,83 @@
+#ifndef BGLIB_ADV_MERGE_H
+#define BGLIB_ADV_MERGE_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Joins the advertisement and the scan response of one sender.
+ *
+ * With active scanning every scannable advertisement (packet_type 0 or 6)
+ * is followed by a scan response (packet_type 4) from the same sender. The
+ * advertisement is held for up to window_ns; when the scan response arrives
+ * both are emitted as one record, otherwise the advertisement is emitted
+ * alone once the window runs out. Non-scannable advertisements
+ * (packet_type 2) pass straight through. Not thread-safe.
+ */
+
+#define BGLIB_ADV_DATA_MAX 31
+
+#define BGLIB_ADV_HAS_ADV           0x01
+#define BGLIB_ADV_HAS_SCAN_RSP      0x02
+#define BGLIB_ADV_EXPIRED           0x04    /* window ran out before the scan response */
+#define BGLIB_ADV_FORCED            0x08    /* flushed early, the pending table was full */
+
+struct bglib_adv_record
+{
+    bd_addr sender;
+    uint8 address_type;
+    uint8 packet_type;      /* of the advertisement, 4 for an unmatched scan response */
+    uint8 flags;            /* BGLIB_ADV_* */
+    uint8 bond;
+    int8 rssi;              /* advertisement */
+    int8 scan_rssi;         /* scan response */
+    uint8 adv_len;
+    uint8 rsp_len;
+    uint8 adv[BGLIB_ADV_DATA_MAX];
+    uint8 rsp[BGLIB_ADV_DATA_MAX];
+    uint64_t adv_ns;
+    uint64_t rsp_ns;
+};
+
+struct bglib_adv_merge_stats
+{
+    uint64_t advertisements;
+    uint64_t scan_responses;
+    uint64_t merged;            /* records with both payloads */
+    uint64_t expired;           /* advertisements emitted without a scan response */
+    uint64_t orphans;           /* scan responses without a pending advertisement */
+    uint64_t forced;
+    unsigned pending;
+};
+
+typedef void (*bglib_adv_merge_cb)(void *user, const struct bglib_adv_record *rec);
+
+struct bglib_adv_merge;
+
+/**capacity: pending advertisements, 0 selects 256. window_ns 0 selects 50 ms**/
+struct bglib_adv_merge *bglib_adv_merge_create(unsigned capacity, uint64_t window_ns,
+                                               bglib_adv_merge_cb cb, void *user);
+void bglib_adv_merge_destroy(struct bglib_adv_merge *m);
+
+/**Feed one scan response event; payload_len from the frame header, see gap_ad_scan_data()**/
+void bglib_adv_merge_update(struct bglib_adv_merge *m, const struct ble_msg_gap_scan_response_evt_t *msg,
+                            unsigned payload_len, uint64_t now_ns);
+
+/**Emit advertisements whose window ended before now_ns, returns the number emitted**/
+unsigned bglib_adv_merge_poll(struct bglib_adv_merge *m, uint64_t now_ns);
+
+/**Emit everything pending, e.g. when scanning stops**/
+unsigned bglib_adv_merge_flush(struct bglib_adv_merge *m);
+
+void bglib_adv_merge_get_stats(const struct bglib_adv_merge *m, struct bglib_adv_merge_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_ADV_MERGE_H
@@ -0,0 +1,79 @@
+#ifndef BGLIB_ADVSTATS_H
+#define BGLIB_ADVSTATS_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "devtable.h"
+#include "histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Incremental advertising statistics next to a bglib_devtable.
+ *
+ * Per device, indexed by bglib_device.id: packets per second over a
+ * sliding window (BGLIB_ADVSTATS_SLOTS sub-windows), RSSI min/max/mean/
+ * variance by Welford's method, mean inter-arrival time and its jitter
+ * (smoothed difference of successive intervals, as in RFC 3550). Gateway
+ * wide: packet rate, packet type mix, a 1 dB RSSI histogram and a log2
+ * histogram of per-device inter-arrival times.
+ *
+ * One thread updates (the scan path); any thread may take snapshots at
+ * any time. Device entries are published through seqlocks and the gateway
+ * counters are atomics, so readers never block the writer.
+ */
+
+#define BGLIB_ADVSTATS_SLOTS        16
+#define BGLIB_ADVSTATS_RSSI_BINS    128     /* bin i counts RSSI -i dBm */
+
+struct bglib_adv_device_stats
+{
+    uint64_t key;                   /* bglib_device.key of the device */
+    uint64_t packets;
+    uint32_t types[bglib_dev_packet_last];
+    double pps;                     /* over the sliding window */
+    int8 rssi_min;
+    int8 rssi_max;
+    double rssi_mean;
+    double rssi_var;                /* sample variance, dBm^2 */
+    uint64_t interval_ns;           /* mean inter-arrival time */
+    uint64_t jitter_ns;
+    uint64_t last_ns;
+};
+
+struct bglib_adv_gateway_stats
+{
+    uint64_t packets;
+    uint64_t types[bglib_dev_packet_last];
+    double pps;
+    uint64_t rssi[BGLIB_ADVSTATS_RSSI_BINS];
+    struct bglib_histogram interval_us;
+};
+
+struct bglib_advstats;
+
+/**capacity must be bglib_devtable_capacity() of the table (NULL if 0); window_ns 0 selects 10 s**/
+struct bglib_advstats *bglib_advstats_create(unsigned capacity, uint64_t window_ns);
+void bglib_advstats_destroy(struct bglib_advstats *st);
+
+/**Account msg for dev, the entry returned by bglib_devtable_update()**/
+void bglib_advstats_update(struct bglib_advstats *st, const struct bglib_device *dev,
+                           const struct ble_msg_gap_scan_response_evt_t *msg, uint64_t now_ns);
+
+/**Clear the entry of dev, call it from the devtable evict callback**/
+void bglib_advstats_forget(struct bglib_advstats *st, const struct bglib_device *dev);
+
+/**Consistent copy of the entry with id, returns 0 if it is unused**/
+int bglib_advstats_device(const struct bglib_advstats *st, uint32_t id, uint64_t now_ns,
+                          struct bglib_adv_device_stats *out);
+
+void bglib_advstats_gateway(const struct bglib_advstats *st, uint64_t now_ns, struct bglib_adv_gateway_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_ADVSTATS_H
@@ -0,0 +1,92 @@
+#ifndef BGLIB_ARENA_H
+#define BGLIB_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bump allocator for events that must outlive their handler.
+ *
+ * Allocations are never freed one by one; the arena is rewound to a mark
+ * (or reset) at an epoch boundary chosen by the application, which returns
+ * its chunks to a per-arena cache. In steady state no malloc/free happens
+ * at all. An arena belongs to one thread.
+ */
+
+struct bglib_arena;
+
+struct bglib_arena_mark
+{
+    void *chunk;
+    size_t used;
+};
+
+struct bglib_arena_stats
+{
+    size_t in_use;        /* bytes handed out since the last reset */
+    size_t chunks;        /* chunks in use */
+    size_t cached;        /* chunks waiting in the cache */
+    uint64_t mallocs;     /* chunk allocations from the heap */
+};
+
+/**chunk_size 0 selects 64 KiB**/
+struct bglib_arena *bglib_arena_create(size_t chunk_size);
+void bglib_arena_destroy(struct bglib_arena *arena);
+
+/**8-byte aligned allocation, valid until the arena is rewound past it**/
+void *bglib_arena_alloc(struct bglib_arena *arena, size_t size);
+
+struct bglib_arena_mark bglib_arena_mark(const struct bglib_arena *arena);
+void bglib_arena_rewind(struct bglib_arena *arena, struct bglib_arena_mark mark);
+
+/**Epoch boundary: release everything**/
+void bglib_arena_reset(struct bglib_arena *arena);
+
+void bglib_arena_get_stats(const struct bglib_arena *arena, struct bglib_arena_stats *out);
+
+/**Copy a message into the arena, returns the copied payload (same layout as the original)**/
+const void *bglib_arena_retain(struct bglib_arena *arena, const struct ble_header *hdr, const void *payload);
+
+/**Header of a payload returned by bglib_arena_retain/bglib_retain**/
+static inline const struct ble_header *bglib_retained_header(const void *retained)
+{
+    return (const struct ble_header *)retained - 1;
+}
+
+/**Arena used by bglib_retain on the calling thread**/
+void bglib_arena_set_current(struct bglib_arena *arena);
+struct bglib_arena *bglib_arena_current(void);
+
+/*
+ * Keep the event currently being handled: evt must be the pointer the
+ * handler received from bglib_dispatch (or the executor). The frame is
+ * copied into the current arena. Returns NULL outside a handler or without
+ * a current arena.
+ */
+const void *bglib_retain(const void *evt);
+
+/*
+ * Fixed-size pool of frame buffers for events released individually
+ * rather than by epoch. Single-threaded, like the arena.
+ */
+struct bglib_frame_slab;
+
+struct bglib_frame_slab *bglib_frame_slab_create(unsigned frames);
+void bglib_frame_slab_destroy(struct bglib_frame_slab *slab);
+
+/**Returns NULL when all frames are in use**/
+struct bglib_frame *bglib_frame_slab_get(struct bglib_frame_slab *slab);
+void bglib_frame_slab_put(struct bglib_frame_slab *slab, struct bglib_frame *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_ARENA_H
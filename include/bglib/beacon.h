@@ -0,0 +1,154 @@
+#ifndef BGLIB_BEACON_H
+#define BGLIB_BEACON_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "gap_ad.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Beacon decoders dispatched by AD type and the 16-bit identifier that
+ * opens the structure (company ID for manufacturer data, UUID for 16-bit
+ * service data). Decoders are looked up in a hash table built at
+ * registration, so a frame costs one probe per AD structure. Decoders
+ * registered with BGLIB_BEACON_ANY_ID see every structure of their AD type.
+ *
+ * The built-in decoders fill the structs below with pointers into the
+ * scan response; they are valid for the duration of the callback only.
+ * Not thread-safe.
+ */
+
+#define BGLIB_BEACON_ANY_ID         -1
+#define BGLIB_BEACON_DECODERS_MAX   32
+#define BGLIB_BEACON_HITS_MAX       8
+
+#define BGLIB_COMPANY_APPLE         0x004C
+#define BGLIB_UUID_EDDYSTONE        0xFEAA
+
+struct bglib_ibeacon
+{
+    const uint8 *uuid;          /* 16 bytes, in the printed order */
+    uint16 major;
+    uint16 minor;
+    int8 tx_power;              /* measured power at 1 m */
+};
+
+struct bglib_altbeacon
+{
+    uint16 company;
+    const uint8 *id;            /* 20 bytes */
+    int8 ref_rssi;
+    uint8 reserved;
+};
+
+struct bglib_eddystone_uid
+{
+    int8 tx_power;              /* at 0 m */
+    const uint8 *namespace_id;  /* 10 bytes */
+    const uint8 *instance;      /* 6 bytes */
+};
+
+struct bglib_eddystone_url
+{
+    int8 tx_power;
+    uint8 scheme;
+    const uint8 *url;           /* encoded, see bglib_eddystone_url_expand() */
+    uint8 url_len;
+};
+
+struct bglib_eddystone_tlm
+{
+    uint8 version;              /* 0 plain, 1 encrypted */
+    uint16 battery_mv;
+    int16 temperature;          /* 8.8 fixed point degrees C, -32768 if not supported */
+    uint32_t adv_count;
+    uint32_t uptime;            /* 0.1 s */
+    const uint8 *etlm;          /* version 1: encrypted payload */
+    uint8 etlm_len;
+};
+
+struct bglib_eddystone_eid
+{
+    int8 tx_power;
+    const uint8 *eid;           /* 8 bytes */
+};
+
+/**Callbacks of the built-in decoders; NULL entries are not registered**/
+struct bglib_beacon_callbacks
+{
+    void (*ibeacon)(void *user, const struct ble_msg_gap_scan_response_evt_t *msg,
+                    const struct bglib_ibeacon *b);
+    void (*altbeacon)(void *user, const struct ble_msg_gap_scan_response_evt_t *msg,
+                      const struct bglib_altbeacon *b);
+    void (*eddystone_uid)(void *user, const struct ble_msg_gap_scan_response_evt_t *msg,
+                          const struct bglib_eddystone_uid *b);
+    void (*eddystone_url)(void *user, const struct ble_msg_gap_scan_response_evt_t *msg,
+                          const struct bglib_eddystone_url *b);
+    void (*eddystone_tlm)(void *user, const struct ble_msg_gap_scan_response_evt_t *msg,
+                          const struct bglib_eddystone_tlm *b);
+    void (*eddystone_eid)(void *user, const struct ble_msg_gap_scan_response_evt_t *msg,
+                          const struct bglib_eddystone_eid *b);
+    void *user;
+};
+
+/*
+ * Custom decoder: data/len follow the 16-bit identifier (or are the whole
+ * structure for BGLIB_BEACON_ANY_ID). id is the identifier that matched.
+ * Returns 1 if the data was recognised.
+ */
+typedef int (*bglib_beacon_decoder)(void *user, const struct ble_msg_gap_scan_response_evt_t *msg, uint16 id,
+                                    const uint8 *data, uint8 len);
+
+struct bglib_beacon_registry;
+
+/**cb may be NULL for a registry with custom decoders only**/
+struct bglib_beacon_registry *bglib_beacon_create(const struct bglib_beacon_callbacks *cb);
+void bglib_beacon_destroy(struct bglib_beacon_registry *reg);
+
+/**id is a company ID or UUID16, or BGLIB_BEACON_ANY_ID; returns -1 if the registry is full**/
+int bglib_beacon_register(struct bglib_beacon_registry *reg, uint8 ad_type, int id,
+                          bglib_beacon_decoder fn, void *user);
+
+/**Run the decoders on every AD structure, returns the number of recognised beacons**/
+unsigned bglib_beacon_process(struct bglib_beacon_registry *reg,
+                              const struct ble_msg_gap_scan_response_evt_t *msg, unsigned payload_len);
+
+/**Same as bglib_beacon_process() over an index of data built by gap_ad_index_build()**/
+unsigned bglib_beacon_process_index(struct bglib_beacon_registry *reg,
+                                    const struct ble_msg_gap_scan_response_evt_t *msg, const uint8 *data,
+                                    const struct gap_ad_index *idx);
+
+/**Decoders that recognised the structures of one payload**/
+struct bglib_beacon_hits
+{
+    uint8 count;                /* more than BGLIB_BEACON_HITS_MAX if some were not recorded */
+    uint8 ad[BGLIB_BEACON_HITS_MAX];        /* index into the gap_ad_index */
+    uint8 decoder[BGLIB_BEACON_HITS_MAX];   /* internal */
+};
+
+/**bglib_beacon_process_index() that also records which decoders fired; hits may be NULL**/
+unsigned bglib_beacon_process_hits(struct bglib_beacon_registry *reg,
+                                   const struct ble_msg_gap_scan_response_evt_t *msg, const uint8 *data,
+                                   const struct gap_ad_index *idx, struct bglib_beacon_hits *hits);
+
+/*
+ * Run only the recorded decoders on the same structures of an identical
+ * payload, skipping the lookups; callbacks see msg, so RSSI and sender
+ * are those of the new message. hits must come from the same registry
+ * with no decoders registered since.
+ */
+unsigned bglib_beacon_replay(struct bglib_beacon_registry *reg, const struct ble_msg_gap_scan_response_evt_t *msg,
+                             const uint8 *data, const struct gap_ad_index *idx, const struct bglib_beacon_hits *hits);
+
+/**Expand an Eddystone-URL into buf (NUL-terminated), returns the full length**/
+unsigned bglib_eddystone_url_expand(const struct bglib_eddystone_url *url, char *buf, unsigned size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_BEACON_H
@@ -0,0 +1,31 @@
+#ifndef BGLIB_CLOCK_H
+#define BGLIB_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**Nanoseconds from CLOCK_MONOTONIC**/
+static inline uint64_t bglib_monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**Nanoseconds from CLOCK_REALTIME (Unix epoch)**/
+static inline uint64_t bglib_realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_CLOCK_H
@@ -0,0 +1,85 @@
+#ifndef BGLIB_CMD_SCHED_H
+#define BGLIB_CMD_SCHED_H
+
+#include <stdint.h>
+
+#include "frame.h"
+#include "histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Prioritised command scheduler for one adapter.
+ *
+ * BGAPI processes one command at a time, so the scheduler keeps a single
+ * command in flight and picks the next one when its response arrives:
+ * classes are served in strict priority order, connections within a class
+ * are served round-robin and a queued command whose deadline is close is
+ * sent ahead of its class peers. Not thread-safe; drive it from the thread
+ * that owns the adapter.
+ */
+
+enum bglib_sched_class
+{
+    bglib_sched_control    = 0, /* gap procedures, disconnects, resets */
+    bglib_sched_connection = 1, /* connection-critical GATT traffic */
+    bglib_sched_bulk       = 2, /* polling, bulk writes */
+    bglib_sched_class_last = 3,
+    bglib_sched_auto       = -1 /* derive from the command id */
+};
+
+#define BGLIB_SCHED_NO_CONNECTION (-1)
+#define BGLIB_SCHED_NO_DEADLINE   0
+
+struct bglib_sched_stats
+{
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t timeouts;
+    uint64_t rejected;   /* queue full */
+    uint64_t queued;     /* currently waiting */
+    struct bglib_histogram latency_us; /* submit to response */
+    struct bglib_histogram service_us; /* send to response */
+};
+
+struct bglib_sched;
+
+/**Create a scheduler holding up to capacity queued commands; send==NULL writes through bglib_output**/
+struct bglib_sched *bglib_sched_create(unsigned capacity, bglib_send_fn send, void *user);
+void bglib_sched_destroy(struct bglib_sched *sched);
+
+/**Give up on a command whose response has not arrived after timeout_ns (default 1 s)**/
+void bglib_sched_set_timeout(struct bglib_sched *sched, uint64_t timeout_ns);
+
+/**Commands whose deadline is less than slack_ns away jump the round-robin (default 5 ms)**/
+void bglib_sched_set_slack(struct bglib_sched *sched, uint64_t slack_ns);
+
+/**Default class of a command index (ble_cmd_*_idx)**/
+enum bglib_sched_class bglib_sched_classify(uint8 msgid);
+
+/*
+ * Queue command msgid with ble_send_message arguments. connection selects the
+ * fairness queue, deadline is an absolute CLOCK_MONOTONIC time in ns or
+ * BGLIB_SCHED_NO_DEADLINE. Returns 0, or -1 when the queue is full.
+ */
+int bglib_sched_submit(struct bglib_sched *sched, int cls, int connection,
+                       uint64_t deadline_ns, uint8 msgid, ...);
+
+/**Send the next command if none is in flight and expire a stuck one, returns 1 if a command was sent**/
+int bglib_sched_poll(struct bglib_sched *sched);
+
+/**Feed every received header; returns 1 if it completed the in-flight command (and sends the next one)**/
+int bglib_sched_on_message(struct bglib_sched *sched, const struct ble_header *hdr);
+
+int bglib_sched_busy(const struct bglib_sched *sched);
+
+void bglib_sched_get_stats(const struct bglib_sched *sched, enum bglib_sched_class cls,
+                           struct bglib_sched_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_CMD_SCHED_H
@@ -0,0 +1,195 @@
+#ifndef BGLIB_CONN_MGR_H
+#define BGLIB_CONN_MGR_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "frame.h"
+#include "histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Connections to many peripherals over several adapters.
+ *
+ * Connect requests are queued and placed on the least-loaded adapter
+ * (connections plus the pending attempt, relative to its limit) that has
+ * no connect procedure running, since an adapter runs one gap_connect_* at
+ * a time. An attempt not established within connect_timeout_ns is
+ * cancelled with gap_end_procedure. Every connection has an entry in a
+ * fixed table, addressed by a small id that stays valid until the
+ * connection is closed. Closing callbacks (failed, disconnected) receive
+ * a copy of the entry, which is already free, so they may queue the
+ * device again. A system_boot of an adapter closes its connections.
+ *
+ * With reconnect enabled, an established connection that drops is kept
+ * as lost instead and retried after an exponential backoff with jitter
+ * (uniform in the upper half of min(max, min * 2^failures)). Whenever at
+ * least selective_min lost peers are due, an adapter loads up to
+ * whitelist_max of them into its whitelist and runs gap_connect_selective,
+ * so whichever advertises first is connected first and the rest follow
+ * in the next procedure; recovery after a mass dropout is bounded by the
+ * peers' advertising, not by one connect_direct timeout per peer.
+ *
+ * Not thread-safe; feed every adapter's messages from one thread or
+ * serialise the calls.
+ */
+
+#define BGLIB_CONN_ADAPTERS_MAX     8
+#define BGLIB_CONN_HANDLES_MAX      8       /* per adapter, BLED112 firmware limit */
+#define BGLIB_CONN_REASON_RETRIES   0xfffc  /* reconnect gave up after max_attempts */
+#define BGLIB_CONN_REASON_CANCELLED 0xfffd  /* bglib_conn_mgr_disconnect before establishment */
+#define BGLIB_CONN_REASON_TIMEOUT   0xfffe  /* attempt cancelled after connect_timeout_ns */
+#define BGLIB_CONN_REASON_RESET     0xffff  /* adapter rebooted */
+
+enum bglib_conn_state
+{
+    bglib_conn_free,
+    bglib_conn_queued,
+    bglib_conn_lost,                /* waiting to reconnect */
+    bglib_conn_connecting,
+    bglib_conn_connected,
+    bglib_conn_disconnecting
+};
+
+enum bglib_conn_event
+{
+    bglib_conn_ev_connected,
+    bglib_conn_ev_updated,          /* connection_status with new parameters */
+    bglib_conn_ev_disconnected,
+    bglib_conn_ev_failed,           /* never established; reason is a BGAPI error or BGLIB_CONN_REASON_* */
+    bglib_conn_ev_lost              /* dropped, will be reconnected; the entry stays */
+};
+
+struct bglib_conn_params
+{
+    uint16 interval_min;            /* 1.25 ms units */
+    uint16 interval_max;
+    uint16 timeout;                 /* supervision timeout, 10 ms units */
+    uint16 latency;
+};
+
+struct bglib_conn_adapter
+{
+    bglib_send_fn send;             /* NULL writes through bglib_output */
+    void *user;
+    uint8 max_connections;          /* 0 asks the adapter (system_get_connections) */
+};
+
+struct bglib_conn
+{
+    unsigned id;
+    enum bglib_conn_state state;
+    bd_addr address;
+    uint8 address_type;
+    uint8 adapter;
+    uint8 handle;
+    uint8 bonding;
+    struct bglib_conn_params params; /* requested */
+    uint16 interval;                /* in use, from connection_status */
+    uint16 timeout;
+    uint16 latency;
+    uint64_t requested_ns;
+    uint64_t attempt_ns;            /* current or last gap_connect_direct */
+    uint64_t connected_ns;
+    uint64_t lost_ns;               /* 0 unless reconnecting */
+    uint64_t retry_ns;              /* next reconnect attempt */
+    unsigned attempts;              /* failed reconnect attempts since the loss */
+    void *user;
+};
+
+struct bglib_conn_reconnect
+{
+    int enabled;
+    uint64_t backoff_min_ns;        /* 0 selects 250 ms */
+    uint64_t backoff_max_ns;        /* 0 selects 30 s */
+    unsigned max_attempts;          /* 0 retries forever */
+    uint8 whitelist_max;            /* peers per gap_connect_selective, 0 selects 8 */
+    uint8 selective_min;            /* due peers worth a selective attempt, 0 selects 2 */
+};
+
+struct bglib_conn_mgr_config
+{
+    unsigned connections;           /* table size, 0 selects 64 */
+    uint64_t connect_timeout_ns;    /* 0 selects 5 s */
+    struct bglib_conn_params params; /* zero fields select 30-50 ms interval, 1 s timeout, latency 0 */
+    struct bglib_conn_reconnect reconnect;
+};
+
+struct bglib_conn_mgr_stats
+{
+    unsigned queued;
+    unsigned lost;
+    unsigned connecting;
+    unsigned connected;
+    unsigned adapter_connections[BGLIB_CONN_ADAPTERS_MAX];
+    unsigned adapter_max[BGLIB_CONN_ADAPTERS_MAX];
+    uint64_t requests;
+    uint64_t attempts;
+    uint64_t established;
+    uint64_t failures;
+    uint64_t timeouts;
+    uint64_t disconnects;
+    uint64_t strays;                /* attempts established after they were cancelled, disconnected */
+    uint64_t losses;
+    uint64_t reconnects;
+    uint64_t selective_attempts;
+    struct bglib_histogram reconnect_us;    /* loss to re-established */
+    struct bglib_histogram backoff_us;      /* scheduled reconnect delays */
+};
+
+typedef void (*bglib_conn_cb)(void *user, const struct bglib_conn *conn, enum bglib_conn_event event,
+                              uint16 reason);
+
+struct bglib_conn_mgr;
+
+/**cfg may be NULL for defaults**/
+struct bglib_conn_mgr *bglib_conn_mgr_create(const struct bglib_conn_adapter *adapters, unsigned n,
+                                             const struct bglib_conn_mgr_config *cfg, bglib_conn_cb cb,
+                                             void *user);
+void bglib_conn_mgr_destroy(struct bglib_conn_mgr *mgr);
+
+/**Query adapters without a configured limit; connects are held until they answer**/
+void bglib_conn_mgr_start(struct bglib_conn_mgr *mgr, uint64_t now_ns);
+
+/*
+ * Queue a connection. params may be NULL for the defaults, user is kept
+ * in the entry. Returns the id, the id of the existing entry if the
+ * device is already queued or connected, or -1 if the table is full.
+ */
+int bglib_conn_mgr_connect(struct bglib_conn_mgr *mgr, const bd_addr *address, uint8 address_type,
+                           const struct bglib_conn_params *params, void *user, uint64_t now_ns);
+
+/**Dequeue, cancel (also a pending reconnect) or disconnect; returns -1 for an unknown id**/
+int bglib_conn_mgr_disconnect(struct bglib_conn_mgr *mgr, unsigned id, uint64_t now_ns);
+
+/**Start queued attempts on free adapters and cancel attempts past their timeout**/
+void bglib_conn_mgr_poll(struct bglib_conn_mgr *mgr, uint64_t now_ns);
+
+/*
+ * Feed every message received from adapter. Returns 1 if the manager
+ * consumed it (its own command responses), 0 otherwise; connection events
+ * are tracked and still returned as 0.
+ */
+int bglib_conn_mgr_on_message(struct bglib_conn_mgr *mgr, unsigned adapter, const struct ble_header *hdr,
+                              const uint8 *payload, uint64_t now_ns);
+
+/**NULL if the id is not in use**/
+const struct bglib_conn *bglib_conn_mgr_get(const struct bglib_conn_mgr *mgr, unsigned id);
+const struct bglib_conn *bglib_conn_mgr_find(const struct bglib_conn_mgr *mgr, const bd_addr *address,
+                                             uint8 address_type);
+const struct bglib_conn *bglib_conn_mgr_by_handle(const struct bglib_conn_mgr *mgr, unsigned adapter,
+                                                  uint8 handle);
+
+void bglib_conn_mgr_foreach(const struct bglib_conn_mgr *mgr,
+                            void (*fn)(void *user, const struct bglib_conn *conn), void *user);
+
+void bglib_conn_mgr_get_stats(const struct bglib_conn_mgr *mgr, struct bglib_conn_mgr_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_CONN_MGR_H
@@ -0,0 +1,144 @@
+#ifndef BGLIB_CONN_TUNE_H
+#define BGLIB_CONN_TUNE_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "conn_mgr.h"
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Connection parameter profiles and an interval auto-tuner.
+ *
+ * Profiles are ordered from the longest interval to the shortest, so the
+ * tuner moves along them as a ladder. For every connection it counts, per
+ * period, the GATT traffic seen on the RX path (attribute values,
+ * acknowledged procedures, write commands) and the time from an attclient
+ * command response to its attclient_procedure_completed. The caller adds
+ * the number of writes it still has queued. A connection steps to the next
+ * shorter interval when writes back up, procedures take several intervals
+ * or more than a few packets fall into each interval. It steps back after
+ * idle_periods in which the longer interval would still carry less than
+ * one packet per interval. A change is sent with connection_update and
+ * counts only once a connection_status reports an interval inside the
+ * requested range. Connections are addressed by adapter and handle,
+ * like the events. Not thread-safe.
+ */
+
+enum bglib_conn_profile
+{
+    bglib_conn_profile_low_power,       /* 400-500 ms, latency 4 */
+    bglib_conn_profile_balanced,        /* 30-50 ms, the conn_mgr default */
+    bglib_conn_profile_low_latency,     /* 10-20 ms */
+    bglib_conn_profile_throughput,      /* 7.5-10 ms */
+    bglib_conn_profile_last
+};
+
+void bglib_conn_profile_params(enum bglib_conn_profile profile, struct bglib_conn_params *out);
+const char *bglib_conn_profile_name(enum bglib_conn_profile profile);
+
+enum bglib_conn_tune_reason
+{
+    bglib_conn_tune_manual,
+    bglib_conn_tune_busy,
+    bglib_conn_tune_idle
+};
+
+enum bglib_conn_tune_result
+{
+    bglib_conn_tune_requested,
+    bglib_conn_tune_confirmed,
+    bglib_conn_tune_rejected,           /* connection_update failed */
+    bglib_conn_tune_unconfirmed         /* no matching connection_status within confirm_ns */
+};
+
+struct bglib_conn_tune_event
+{
+    uint8 adapter;
+    uint8 connection;
+    enum bglib_conn_profile from;
+    enum bglib_conn_profile to;
+    enum bglib_conn_tune_reason reason;
+    enum bglib_conn_tune_result result;
+    uint16 interval;                    /* in use, 1.25 ms units */
+    uint16 error;                       /* BGAPI result when rejected */
+};
+
+struct bglib_conn_tune_config
+{
+    int automatic;                      /* tune connections that are not pinned */
+    enum bglib_conn_profile min_profile; /* longest interval the tuner uses */
+    enum bglib_conn_profile max_profile; /* shortest, 0 selects throughput */
+    uint64_t period_ns;                 /* 0 selects 2 s */
+    uint64_t confirm_ns;                /* 0 selects 5 s */
+    uint64_t hold_ns;                   /* after an unconfirmed or rejected update, 0 selects 30 s */
+    unsigned idle_periods;              /* 0 selects 5 */
+    unsigned busy_backlog;              /* queued writes, 0 selects 4 */
+};
+
+struct bglib_conn_tune_state
+{
+    enum bglib_conn_profile profile;    /* confirmed */
+    enum bglib_conn_profile target;     /* requested, equal to profile when settled */
+    int pinned;
+    uint16 interval;
+    float packets_per_s;                /* last period */
+    float procedure_us;                 /* mean, last period */
+    unsigned backlog;
+};
+
+struct bglib_conn_tune_stats
+{
+    uint64_t requested;
+    uint64_t confirmed;
+    uint64_t rejected;
+    uint64_t unconfirmed;
+    uint64_t steps_up;                  /* towards throughput */
+    uint64_t steps_down;
+};
+
+typedef void (*bglib_conn_tune_cb)(void *user, const struct bglib_conn_tune_event *event);
+
+struct bglib_conn_tune;
+
+/**adapters[i].max_connections is ignored; cfg may be NULL for manual profiles only**/
+struct bglib_conn_tune *bglib_conn_tune_create(const struct bglib_conn_adapter *adapters, unsigned n,
+                                               const struct bglib_conn_tune_config *cfg,
+                                               bglib_conn_tune_cb cb, void *user);
+void bglib_conn_tune_destroy(struct bglib_conn_tune *t);
+
+/**Pin a connection to profile and request it; returns -1 if the connection is not known**/
+int bglib_conn_tune_apply(struct bglib_conn_tune *t, unsigned adapter, uint8 connection,
+                          enum bglib_conn_profile profile, uint64_t now_ns);
+
+/**Hand a pinned connection back to the tuner**/
+void bglib_conn_tune_unpin(struct bglib_conn_tune *t, unsigned adapter, uint8 connection);
+
+/**Writes the application still has queued for the connection**/
+void bglib_conn_tune_set_backlog(struct bglib_conn_tune *t, unsigned adapter, uint8 connection, unsigned queued);
+
+/*
+ * Feed every message received from adapter. Returns 1 for the responses
+ * to the tuner's own connection_update, 0 otherwise.
+ */
+int bglib_conn_tune_on_message(struct bglib_conn_tune *t, unsigned adapter, const struct ble_header *hdr,
+                               const uint8 *payload, uint64_t now_ns);
+
+/**Evaluate finished periods and expire unconfirmed updates**/
+void bglib_conn_tune_poll(struct bglib_conn_tune *t, uint64_t now_ns);
+
+/**Returns -1 if the connection is not known**/
+int bglib_conn_tune_get(const struct bglib_conn_tune *t, unsigned adapter, uint8 connection,
+                        struct bglib_conn_tune_state *out);
+
+void bglib_conn_tune_get_stats(const struct bglib_conn_tune *t, struct bglib_conn_tune_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_CONN_TUNE_H
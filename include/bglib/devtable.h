@@ -0,0 +1,157 @@
+#ifndef BGLIB_DEVTABLE_H
+#define BGLIB_DEVTABLE_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Table of advertisers seen by a scanner, keyed by bd_addr + address_type.
+ *
+ * Open addressing with linear probing over cache-line-sized entries. Every
+ * scan response updates the entry of its sender; the callback only fires
+ * for the transitions selected in the configuration, so a device
+ * advertising at 100 Hz with a stable payload reports once. Entries that
+ * were not heard for ttl_ns are evicted by bglib_devtable_expire().
+ * Not thread-safe.
+ *
+ * With shm_name set, the slots live in a POSIX shared memory segment
+ * (/dev/shm on Linux) that other processes open read-only with
+ * bglib_devtable_attach(). Every entry is written under its own seqlock
+ * and moves between slots (deletions) under a table-wide one, so readers
+ * copy consistent entries without ever blocking the owning process.
+ * Creation fails if the name is taken; a segment left by a writer that
+ * crashed has to be removed with shm_unlink() first.
+ */
+
+#define BGLIB_DEV_NEW               0x01
+#define BGLIB_DEV_PAYLOAD_CHANGED   0x02
+#define BGLIB_DEV_RSSI_MOVED        0x04
+#define BGLIB_DEV_ALL               0x07
+
+/**Packet counters are indexed by packet_type / 2**/
+enum bglib_dev_packet
+{
+    bglib_dev_adv_connectable,      /* packet_type 0 */
+    bglib_dev_adv_nonconnectable,   /* packet_type 2 */
+    bglib_dev_scan_response,        /* packet_type 4 */
+    bglib_dev_adv_scannable,        /* packet_type 6 */
+    bglib_dev_packet_last
+};
+
+struct bglib_device
+{
+    uint64_t key;                                   /* bglib_addr_key(), bit 63 marks a used slot */
+    uint64_t first_seen;                            /* ns, caller's clock */
+    uint64_t last_seen;
+    uint32_t packets[bglib_dev_packet_last];
+    uint32_t payload_hash[2];                       /* advertisement, scan response */
+    uint32_t id;                                    /* dense and stable while the device is in the table */
+    int16 rssi_avg;                                 /* EWMA, dBm * 16 */
+    int8 rssi;                                      /* last sample */
+    int8 rssi_reported;                             /* smoothed RSSI at the last report */
+    uint32_t seq;                                   /* seqlock, see seqlock.h; keep last */
+} __attribute__((aligned(64)));
+
+static inline void bglib_device_address(const struct bglib_device *dev, bd_addr *addr, uint8 *address_type)
+{
+    unsigned i;
+
+    for (i = 0; i < 6; i++)
+        addr->addr[i] = dev->key >> (8 * i);
+    *address_type = dev->key >> 48;
+}
+
+static inline int bglib_device_rssi(const struct bglib_device *dev)
+{
+    return dev->rssi_avg / 16;
+}
+
+struct bglib_devtable_config
+{
+    unsigned capacity;      /* devices, 0 selects 1024 */
+    uint64_t ttl_ns;        /* 0 never expires */
+    unsigned rssi_delta;    /* dBm change of the smoothed RSSI that is reported, 0 disables */
+    unsigned ewma_shift;    /* smoothing factor 1 / 2^ewma_shift, 0 selects 3 */
+    unsigned events;        /* BGLIB_DEV_* mask passed to the callback, 0 selects BGLIB_DEV_ALL */
+    const char *shm_name;   /* "/name" for shm_open, must not exist; NULL keeps the table in private memory */
+};
+
+struct bglib_devtable_stats
+{
+    uint64_t updates;
+    uint64_t reported;      /* callback invocations */
+    uint64_t inserted;
+    uint64_t expired;
+    uint64_t dropped;       /* new devices rejected because the table was full */
+    unsigned devices;
+};
+
+typedef void (*bglib_devtable_cb)(void *user, const struct bglib_device *dev, unsigned events,
+                                  const struct ble_msg_gap_scan_response_evt_t *msg);
+typedef void (*bglib_devtable_evict_cb)(void *user, const struct bglib_device *dev);
+
+struct bglib_devtable;
+
+/**cfg may be NULL for defaults**/
+struct bglib_devtable *bglib_devtable_create(const struct bglib_devtable_config *cfg);
+void bglib_devtable_destroy(struct bglib_devtable *tbl);
+
+void bglib_devtable_set_callback(struct bglib_devtable *tbl, bglib_devtable_cb cb, void *user);
+void bglib_devtable_set_evict_callback(struct bglib_devtable *tbl, bglib_devtable_evict_cb cb, void *user);
+
+/*
+ * Account one scan response received at now_ns. payload_len is the length
+ * from the frame header (bglib_payload_len), the AD data is clamped to it.
+ * Returns the BGLIB_DEV_* transitions, dev (optional) receives the entry or
+ * NULL if the table is full.
+ */
+unsigned bglib_devtable_update(struct bglib_devtable *tbl, const struct ble_msg_gap_scan_response_evt_t *msg,
+                               unsigned payload_len, uint64_t now_ns, const struct bglib_device **dev);
+
+const struct bglib_device *bglib_devtable_find(const struct bglib_devtable *tbl, const bd_addr *addr,
+                                               uint8 address_type);
+
+/**Evict devices not heard since now_ns - ttl_ns, returns the number evicted**/
+unsigned bglib_devtable_expire(struct bglib_devtable *tbl, uint64_t now_ns);
+
+/**Drop a device explicitly, returns 1 if it was present**/
+int bglib_devtable_remove(struct bglib_devtable *tbl, const bd_addr *addr, uint8 address_type);
+
+void bglib_devtable_foreach(const struct bglib_devtable *tbl,
+                            void (*fn)(void *user, const struct bglib_device *dev), void *user);
+
+/**Upper bound of bglib_device.id, for side tables indexed by it**/
+unsigned bglib_devtable_capacity(const struct bglib_devtable *tbl);
+
+void bglib_devtable_get_stats(const struct bglib_devtable *tbl, struct bglib_devtable_stats *out);
+
+/*
+ * Read-only access from other processes to a table created with shm_name.
+ * Entries are returned as copies; foreach sees each entry consistent, but
+ * not the table as a whole at one instant.
+ */
+struct bglib_devtable_view;
+
+struct bglib_devtable_view *bglib_devtable_attach(const char *shm_name);
+void bglib_devtable_detach(struct bglib_devtable_view *view);
+
+/**Returns 1 and a copy of the entry if the device is present**/
+int bglib_devtable_view_find(const struct bglib_devtable_view *view, const bd_addr *addr, uint8 address_type,
+                             struct bglib_device *out);
+
+/**Returns the number of entries passed to fn**/
+unsigned bglib_devtable_view_foreach(const struct bglib_devtable_view *view,
+                                     void (*fn)(void *user, const struct bglib_device *dev), void *user);
+
+unsigned bglib_devtable_view_count(const struct bglib_devtable_view *view);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_DEVTABLE_H
@@ -0,0 +1,63 @@
+#ifndef BGLIB_DEVVIEW_H
+#define BGLIB_DEVVIEW_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "devtable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Ordered views of a bglib_devtable: strongest devices by smoothed RSSI
+ * and most recently heard devices.
+ *
+ * The scan path keeps two intrusive indexes up to date in O(1) per scan
+ * response: one list per dBm value (with a bitmap of non-empty values) and
+ * a most-recently-heard list. bglib_devview_publish() copies the first
+ * top_max and recent_max entries into the back one of two snapshots and
+ * flips them; readers on other threads copy from the front snapshot under
+ * its seqlock, so a query is O(k) and never blocks the scan path.
+ */
+
+struct bglib_devview_entry
+{
+    bd_addr addr;
+    uint8 address_type;
+    int8 rssi;                  /* smoothed, dBm */
+    uint32_t id;                /* bglib_device.id */
+    uint64_t last_seen;
+};
+
+struct bglib_devview;
+
+/**capacity must be bglib_devtable_capacity() of the table (NULL if 0); 0 selects 64 for the maxima**/
+struct bglib_devview *bglib_devview_create(unsigned capacity, unsigned top_max, unsigned recent_max);
+void bglib_devview_destroy(struct bglib_devview *v);
+
+/**Reposition dev after bglib_devtable_update()**/
+void bglib_devview_update(struct bglib_devview *v, const struct bglib_device *dev);
+
+/**Remove dev, call it from the devtable evict callback**/
+void bglib_devview_forget(struct bglib_devview *v, const struct bglib_device *dev);
+
+/**Make the current order visible to readers, run it from the scan thread**/
+void bglib_devview_publish(struct bglib_devview *v, uint64_t now_ns);
+
+/*
+ * Queries on the last published snapshot, callable from any thread.
+ * Return the number of entries written to out; published_ns (optional)
+ * receives the time passed to bglib_devview_publish().
+ */
+unsigned bglib_devview_strongest(const struct bglib_devview *v, struct bglib_devview_entry *out, unsigned k,
+                                 uint64_t *published_ns);
+unsigned bglib_devview_recent(const struct bglib_devview *v, uint64_t since_ns, struct bglib_devview_entry *out,
+                              unsigned max, uint64_t *published_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_DEVVIEW_H
@@ -0,0 +1,74 @@
+#ifndef BGLIB_DISPATCH_H
+#define BGLIB_DISPATCH_H
+
+#include <stddef.h>
+
+#include "cmd_def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct bglib_executor;
+
+/*
+ * Find the handler of a received message and run it. Handlers routed to an
+ * executor (see executor.h) are queued instead of being called on the
+ * current thread. Returns 0, 1 if a filter dropped the message, or -1 if
+ * the header is unknown.
+ */
+int bglib_dispatch(const struct ble_header *hdr, const uint8 *payload);
+
+/**Run the handler of msg on the calling thread, recording the message as current**/
+void bglib_dispatch_run(const struct ble_msg *msg, const struct ble_header *hdr, const uint8 *payload);
+
+/**Message being handled on the calling thread, returns 0 outside a handler**/
+int bglib_dispatch_current(const struct ble_header **hdr, const uint8 **payload);
+
+/**Install an executor behind bglib_dispatch (NULL runs every handler inline)**/
+void bglib_dispatch_set_executor(struct bglib_executor *exec);
+
+/*
+ * Filters run in bglib_dispatch before the handler (or executor) sees the
+ * message, in the order they were added; returning 0 drops the message.
+ * Add and remove them while nothing is being dispatched.
+ */
+#define BGLIB_DISPATCH_FILTERS_MAX 8
+
+typedef int (*bglib_dispatch_filter)(void *user, const struct ble_msg *msg,
+                                     const struct ble_header *hdr, const uint8 *payload);
+
+/**Returns -1 if BGLIB_DISPATCH_FILTERS_MAX filters are installed**/
+int bglib_dispatch_add_filter(bglib_dispatch_filter fn, void *user);
+void bglib_dispatch_remove_filter(bglib_dispatch_filter fn, void *user);
+
+/*
+ * Same as ble_get_msg_hdr(), but visible to the compiler in the calling
+ * translation unit so it can be inlined (see the bglib_static target).
+ */
+static inline const struct ble_msg *bglib_lookup_msg(const struct ble_header *hdr)
+{
+    const struct ble_class_handler_t *table =
+        (hdr->type_hilen & 0x80) == ble_msg_type_evt ? ble_class_evt_handlers : ble_class_rsp_handlers;
+
+    if (hdr->cls >= ble_cls_last || hdr->command >= table[hdr->cls].maxhandlers)
+        return NULL;
+    return table[hdr->cls].msgs[hdr->command];
+}
+
+static inline uint16 bglib_payload_len(const struct ble_header *hdr)
+{
+    return hdr->lolen | ((uint16)(hdr->type_hilen & 0x07) << 8);
+}
+
+/**Position of msg in the message table, the same value as its ble_*_idx enumerator**/
+static inline unsigned bglib_msg_index(const struct ble_msg *msg)
+{
+    return (unsigned)(msg - ble_get_msg(0));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_DISPATCH_H
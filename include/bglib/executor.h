@@ -0,0 +1,77 @@
+#ifndef BGLIB_EXECUTOR_H
+#define BGLIB_EXECUTOR_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Work-stealing thread pool for expensive event handlers.
+ *
+ * Offloaded messages are copied into pooled frame buffers and run on the
+ * pool. Without a key function a handler runs on whichever worker is free;
+ * with one, messages sharing a key always run on the same worker, in the
+ * order they were received. Everything not offloaded keeps running inline
+ * on the dispatching thread.
+ */
+
+/**Serialisation key of a message payload**/
+typedef uint64_t (*bglib_exec_key_fn)(const struct ble_msg *msg, const uint8 *payload, uint16 len);
+
+/**Key on the connection handle (first parameter of connection/attclient/sm/attributes messages)**/
+uint64_t bglib_exec_key_connection(const struct ble_msg *msg, const uint8 *payload, uint16 len);
+
+/**Key on the peer address (gap_scan_response.sender, connection_status.address)**/
+uint64_t bglib_exec_key_address(const struct ble_msg *msg, const uint8 *payload, uint16 len);
+
+struct bglib_exec_handler_stats
+{
+    uint64_t executed;
+    struct bglib_histogram queue_us;  /* dispatch to start of handler */
+    struct bglib_histogram run_us;    /* handler run time */
+};
+
+struct bglib_exec_stats
+{
+    uint64_t submitted;
+    uint64_t stolen;
+    uint64_t pool_waits;  /* dispatches that waited for a free buffer */
+};
+
+struct bglib_executor;
+
+/**Start threads workers (at most 64) sharing pool_size frame buffers**/
+struct bglib_executor *bglib_exec_create(unsigned threads, unsigned pool_size);
+
+/**Run everything already queued, then stop and join the workers**/
+void bglib_exec_destroy(struct bglib_executor *exec);
+
+/**Run handler of msg (ble_get_msg(idx)) on the pool; key==NULL lets it run in parallel**/
+int bglib_exec_offload(struct bglib_executor *exec, const struct ble_msg *msg, bglib_exec_key_fn key);
+
+/**Run handler of msg inline again**/
+void bglib_exec_inline(struct bglib_executor *exec, const struct ble_msg *msg);
+
+/**Queue an offloaded message, returns 0 if msg is not offloaded and must run inline**/
+int bglib_exec_submit(struct bglib_executor *exec, const struct ble_msg *msg,
+                      const uint8 *payload, uint16 len);
+
+/**Wait until every queued handler has finished**/
+void bglib_exec_flush(struct bglib_executor *exec);
+
+void bglib_exec_get_stats(const struct bglib_executor *exec, struct bglib_exec_stats *out);
+
+/**Per-handler histograms, returns -1 if msg is not offloaded**/
+int bglib_exec_get_handler_stats(const struct bglib_executor *exec, const struct ble_msg *msg,
+                                 struct bglib_exec_handler_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_EXECUTOR_H
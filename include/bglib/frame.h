@@ -0,0 +1,62 @@
+#ifndef BGLIB_FRAME_H
+#define BGLIB_FRAME_H
+
+#include <stdarg.h>
+
+#include "cmd_def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Largest BGAPI message: 4-byte header, at most 15 bytes of fixed
+ * parameters and a single uint8array of up to 255 bytes.
+ */
+#define BGLIB_FRAME_MAX 320
+
+#ifdef _MSC_VER
+#define BGLIB_THREAD_LOCAL __declspec(thread)
+#else
+#define BGLIB_THREAD_LOCAL __thread
+#endif
+
+/**Encoded BGAPI message, header included**/
+struct bglib_frame
+{
+    uint16 len;    /* total length in bytes */
+    uint16 split;  /* header + fixed parameters, the variable part follows */
+    uint8  data[BGLIB_FRAME_MAX];
+};
+
+/**Sink for encoded frames, returns 0 on success**/
+typedef int (*bglib_send_fn)(void *user, const struct bglib_frame *frame);
+
+/**Encode command msgid with the same arguments as ble_send_message, returns frame length**/
+uint16 bglib_frame_encode(struct bglib_frame *frame, uint8 msgid, ...);
+uint16 bglib_frame_encode_va(struct bglib_frame *frame, uint8 msgid, va_list va);
+
+/**Hand an encoded frame to the installed tx queue, or to bglib_output if there is none**/
+void bglib_frame_output(const struct bglib_frame *frame);
+
+/**Write a frame through the application's bglib_output, bypassing the tx queue**/
+void bglib_frame_write(const struct bglib_frame *frame);
+
+/**Encode command msgid and hand it to send, or to bglib_frame_output() when send is NULL**/
+void bglib_frame_send(bglib_send_fn send, void *user, uint8 msgid, ...);
+
+static inline const struct ble_header *bglib_frame_header(const struct bglib_frame *frame)
+{
+    return (const struct ble_header *)frame->data;
+}
+
+static inline const uint8 *bglib_frame_payload(const struct bglib_frame *frame)
+{
+    return frame->data + sizeof(struct ble_header);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_FRAME_H
@@ -0,0 +1,74 @@
+#ifndef BGLIB_FRAMER_H
+#define BGLIB_FRAMER_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Splits the byte stream of one adapter into BGAPI frames.
+ *
+ * Every read is stamped with CLOCK_MONOTONIC (and CLOCK_REALTIME if
+ * requested) as soon as it returns; a frame carries the stamp of the read
+ * that delivered its first byte. Headers that do not describe a known
+ * message are skipped byte by byte until the stream is in sync again.
+ * One framer per fd, not thread-safe.
+ */
+
+#define BGLIB_FRAMER_REALTIME   0x01
+
+struct bglib_rx_frame
+{
+    uint64_t mono_ns;
+    uint64_t real_ns;           /* 0 without BGLIB_FRAMER_REALTIME */
+    uint64_t time_ns;           /* mono_ns, corrected for the adapter by bglib_rxmerge */
+    uint8 adapter;
+    struct bglib_frame frame;   /* header in data[0..3], split 4 */
+};
+
+static inline const struct ble_header *bglib_rx_header(const struct bglib_rx_frame *rx)
+{
+    return (const struct ble_header *)rx->frame.data;
+}
+
+static inline const uint8 *bglib_rx_payload(const struct bglib_rx_frame *rx)
+{
+    return rx->frame.data + sizeof(struct ble_header);
+}
+
+struct bglib_framer_stats
+{
+    uint64_t reads;
+    uint64_t bytes;
+    uint64_t frames;
+    uint64_t skipped;           /* bytes dropped while resynchronising */
+};
+
+struct bglib_framer;
+
+/**fd may be -1 when the data is fed with bglib_framer_feed**/
+struct bglib_framer *bglib_framer_create(int fd, uint8 adapter, unsigned flags);
+void bglib_framer_destroy(struct bglib_framer *fr);
+
+/**One read() from the fd, returns the byte count, 0 at EOF or EAGAIN, -1 on error**/
+int bglib_framer_read(struct bglib_framer *fr);
+
+/**Append bytes received at mono_ns/real_ns by other means, returns the count accepted**/
+unsigned bglib_framer_feed(struct bglib_framer *fr, const uint8 *data, unsigned len,
+                           uint64_t mono_ns, uint64_t real_ns);
+
+/**Returns 1 and the next complete frame, 0 if more bytes are needed**/
+int bglib_framer_next(struct bglib_framer *fr, struct bglib_rx_frame *out);
+
+void bglib_framer_get_stats(const struct bglib_framer *fr, struct bglib_framer_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_FRAMER_H
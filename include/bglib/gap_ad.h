@@ -0,0 +1,165 @@
+#ifndef BGLIB_GAP_AD_H
+#define BGLIB_GAP_AD_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Zero-copy advertising data (AD) parsing.
+ *
+ * Walks the length/type/value structures of ble_msg_gap_scan_response_evt_t.data
+ * in place. Every access is bounds-checked against the buffer length, nothing
+ * is allocated or copied. The enum below extends gap_ad_types with the rest of
+ * the assigned AD type space.
+ */
+
+enum gap_ad_types_ext
+{
+    gap_ad_type_class_of_device      = 0x0D,
+    gap_ad_type_sp_hash_c            = 0x0E,
+    gap_ad_type_sp_randomizer_r      = 0x0F,
+    gap_ad_type_sm_tk_value          = 0x10,
+    gap_ad_type_sm_oob_flags         = 0x11,
+    gap_ad_type_conn_interval_range  = 0x12,
+    gap_ad_type_solicit_16bit        = 0x14,
+    gap_ad_type_solicit_128bit       = 0x15,
+    gap_ad_type_service_data_16bit   = 0x16,
+    gap_ad_type_public_target        = 0x17,
+    gap_ad_type_random_target        = 0x18,
+    gap_ad_type_appearance           = 0x19,
+    gap_ad_type_adv_interval         = 0x1A,
+    gap_ad_type_le_bd_addr           = 0x1B,
+    gap_ad_type_le_role              = 0x1C,
+    gap_ad_type_sp_hash_c256         = 0x1D,
+    gap_ad_type_sp_randomizer_r256   = 0x1E,
+    gap_ad_type_solicit_32bit        = 0x1F,
+    gap_ad_type_service_data_32bit   = 0x20,
+    gap_ad_type_service_data_128bit  = 0x21,
+    gap_ad_type_le_sc_confirm        = 0x22,
+    gap_ad_type_le_sc_random         = 0x23,
+    gap_ad_type_uri                  = 0x24,
+    gap_ad_type_indoor_positioning   = 0x25,
+    gap_ad_type_transport_discovery  = 0x26,
+    gap_ad_type_le_features          = 0x27,
+    gap_ad_type_channel_map_update   = 0x28,
+    gap_ad_type_pb_adv               = 0x29,
+    gap_ad_type_mesh_message         = 0x2A,
+    gap_ad_type_mesh_beacon          = 0x2B,
+    gap_ad_type_biginfo              = 0x2C,
+    gap_ad_type_broadcast_code       = 0x2D,
+    gap_ad_type_resolvable_set_id    = 0x2E,
+    gap_ad_type_adv_interval_long    = 0x2F,
+    gap_ad_type_broadcast_name       = 0x30,
+    gap_ad_type_encrypted_data       = 0x31,
+    gap_ad_type_3d_info              = 0x3D,
+    gap_ad_type_manufacturer_data    = 0xFF
+};
+
+/**One AD structure; data points into the scanned buffer**/
+struct gap_ad
+{
+    uint8 type;
+    uint8 len;          /* length of data, the type byte excluded */
+    const uint8 *data;
+};
+
+struct gap_ad_iter
+{
+    const uint8 *p;
+    const uint8 *end;
+};
+
+static inline void gap_ad_iter_init(struct gap_ad_iter *it, const uint8 *data, unsigned len)
+{
+    it->p = data;
+    it->end = data + len;
+}
+
+/**Returns 1 and fills ad, 0 at the end of data, -1 if the next structure overruns the buffer**/
+static inline int gap_ad_iter_next(struct gap_ad_iter *it, struct gap_ad *ad)
+{
+    unsigned len;
+
+    /* a zero length byte terminates significant data (padding) */
+    if (it->p >= it->end || it->p[0] == 0)
+        return 0;
+    len = it->p[0];
+    if (len > (unsigned)(it->end - it->p) - 1)
+    {
+        it->p = it->end;
+        return -1;
+    }
+    ad->type = it->p[1];
+    ad->len = len - 1;
+    ad->data = it->p + 2;
+    it->p += len + 1;
+    return 1;
+}
+
+/**AD data of a scan response, clamped to the payload length the frame header announced**/
+unsigned gap_ad_scan_data(const struct ble_msg_gap_scan_response_evt_t *msg, unsigned payload_len,
+                          const uint8 **data);
+
+/**First structure of the given type, returns 1 if found**/
+int gap_ad_find(const uint8 *data, unsigned len, uint8 type, struct gap_ad *ad);
+
+/*
+ * Index of one AD buffer for repeated lookups: a 256-bit presence map and
+ * the offsets of (at most GAP_AD_INDEX_MAX) structures. The index stores
+ * offsets only, so it stays valid for any buffer with the same contents.
+ */
+#define GAP_AD_INDEX_MAX 32
+
+struct gap_ad_index
+{
+    uint32_t present[8];
+    uint8 count;
+    uint8 malformed;
+    uint8 offset[GAP_AD_INDEX_MAX];    /* of the length byte */
+};
+
+int gap_ad_index_build(struct gap_ad_index *idx, const uint8 *data, unsigned len);
+
+static inline int gap_ad_index_has(const struct gap_ad_index *idx, uint8 type)
+{
+    return (idx->present[type >> 5] >> (type & 31)) & 1;
+}
+
+int gap_ad_index_find(const struct gap_ad_index *idx, const uint8 *data, uint8 type, struct gap_ad *ad);
+
+/* Typed accessors, each returns 1 on success and 0 if ad has the wrong type or size */
+int gap_ad_flags(const struct gap_ad *ad, uint8 *flags);
+int gap_ad_tx_power(const struct gap_ad *ad, int8 *dbm);
+int gap_ad_appearance(const struct gap_ad *ad, uint16 *appearance);
+int gap_ad_adv_interval(const struct gap_ad *ad, uint32_t *units);
+int gap_ad_manufacturer(const struct gap_ad *ad, uint16 *company,
+                        const uint8 **payload, uint8 *len);
+
+/**Service data of any UUID size, uuid is little-endian as on air**/
+int gap_ad_service_data(const struct gap_ad *ad, const uint8 **uuid, uint8 *uuid_len,
+                        const uint8 **payload, uint8 *len);
+int gap_ad_service_data16(const struct gap_ad *ad, uint16 *uuid,
+                          const uint8 **payload, uint8 *len);
+
+/**Local name (short or complete), not NUL-terminated**/
+int gap_ad_name(const struct gap_ad *ad, const char **name, uint8 *len);
+
+/**Number of UUIDs in a service UUID list or solicitation structure, 0 (and *uuid_len 0) for other types**/
+unsigned gap_ad_uuid_count(const struct gap_ad *ad, uint8 *uuid_len);
+
+/**Search every 16/32/128-bit UUID list and solicitation structure, uuid128 little-endian**/
+int gap_ad_has_uuid16(const uint8 *data, unsigned len, uint16 uuid);
+int gap_ad_has_uuid128(const uint8 *data, unsigned len, const uint8 uuid[16]);
+
+const char *gap_ad_type_name(uint8 type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_GAP_AD_H
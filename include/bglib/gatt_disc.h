@@ -0,0 +1,156 @@
+#ifndef BGLIB_GATT_DISC_H
+#define BGLIB_GATT_DISC_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "conn_mgr.h"
+#include "frame.h"
+#include "histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * GATT discovery with a persistent attribute cache.
+ *
+ * Discovery of a connection runs two attclient procedures:
+ * read_by_group_type for the primary services (group_found events), then
+ * one find_information over the handles they span (find_information_found
+ * events), each ended by procedure_completed. The result is an attribute
+ * map sorted by handle: services, includes, characteristic declarations
+ * with their value handle and UUID, values and descriptors.
+ *
+ * The cache is a file mapped read-write with a fixed number of records,
+ * one map per peer, keyed by bd_addr and address type. A record carries a
+ * 64-bit validation hash chosen by the caller (e.g. a firmware revision or
+ * database hash, 0 if none) and a checksum, so a record torn by a crash
+ * reads as a miss. When the cache is full the oldest record is replaced.
+ * With a cache, bglib_gatt_disc_start() of a known peer whose validation
+ * hash matches reports the stored map at once and sends nothing.
+ *
+ * The engine must be the only attclient user of a connection while it
+ * discovers. Connections are addressed by adapter and handle, like the
+ * events. Not thread-safe.
+ */
+
+#define BGLIB_GATT_ATTRS_MAX        128     /* per peer */
+#define BGLIB_GATT_REASON_TRUNCATED 0xfffd  /* more than BGLIB_GATT_ATTRS_MAX attributes */
+#define BGLIB_GATT_REASON_TIMEOUT   0xfffe
+#define BGLIB_GATT_REASON_RESET     0xffff  /* adapter rebooted */
+
+enum bglib_gatt_kind
+{
+    bglib_gatt_service,             /* end is the last handle of the service */
+    bglib_gatt_secondary,           /* secondary service declaration, uuid 0x2801 */
+    bglib_gatt_include,
+    bglib_gatt_characteristic,      /* declaration; uuid and end are those of the value */
+    bglib_gatt_value,
+    bglib_gatt_descriptor
+};
+
+struct bglib_gatt_attr
+{
+    uint16 handle;
+    uint16 end;                     /* service end or characteristic value handle, else 0 */
+    uint16 service;                 /* handle of the enclosing service */
+    uint8 kind;                     /* enum bglib_gatt_kind */
+    uint8 uuid_len;                 /* 2 or 16 */
+    uint8 uuid[16];                 /* little-endian, as sent by the peer */
+};
+
+struct bglib_gatt_map
+{
+    bd_addr address;
+    uint8 address_type;
+    uint8 reserved;
+    uint16 count;
+    struct bglib_gatt_attr attrs[BGLIB_GATT_ATTRS_MAX];
+};
+
+/**Characteristic declaration with the given value UUID in service (0 for any); NULL if absent**/
+const struct bglib_gatt_attr *bglib_gatt_map_find(const struct bglib_gatt_map *map, uint16 service,
+                                                  const uint8 *uuid, uint8 uuid_len);
+
+/**Client characteristic configuration descriptor of a value handle; 0 if it has none**/
+uint16 bglib_gatt_map_cccd(const struct bglib_gatt_map *map, uint16 value_handle);
+
+struct bglib_gatt_cache;
+
+/*
+ * Open the cache file at path, creating it with room for records peers
+ * (0 selects 256) if it does not exist or is not a valid cache. An
+ * existing cache keeps its own size.
+ */
+struct bglib_gatt_cache *bglib_gatt_cache_open(const char *path, unsigned records);
+void bglib_gatt_cache_close(struct bglib_gatt_cache *c);
+
+/**Copy the map of a peer; returns -1 on a miss, else 0 and the stored validation hash in *hash (may be NULL)**/
+int bglib_gatt_cache_lookup(const struct bglib_gatt_cache *c, const bd_addr *address, uint8 address_type,
+                            struct bglib_gatt_map *out, uint64_t *hash);
+int bglib_gatt_cache_store(struct bglib_gatt_cache *c, const struct bglib_gatt_map *map, uint64_t hash);
+void bglib_gatt_cache_remove(struct bglib_gatt_cache *c, const bd_addr *address, uint8 address_type);
+
+/**Write the mapping back to the file**/
+int bglib_gatt_cache_sync(struct bglib_gatt_cache *c);
+
+enum bglib_gatt_source
+{
+    bglib_gatt_cached,
+    bglib_gatt_discovered,
+    bglib_gatt_failed               /* result is a BGAPI error, disconnect reason or BGLIB_GATT_REASON_* */
+};
+
+struct bglib_gatt_disc_stats
+{
+    uint64_t started;
+    uint64_t cache_hits;
+    uint64_t cache_stale;           /* record found, validation hash differed */
+    uint64_t discovered;
+    uint64_t failed;
+    struct bglib_histogram discovery_us;
+};
+
+/**map is NULL when discovery failed**/
+typedef void (*bglib_gatt_disc_cb)(void *user, unsigned adapter, uint8 connection,
+                                   const struct bglib_gatt_map *map, enum bglib_gatt_source source, uint16 result);
+
+struct bglib_gatt_disc;
+
+/**adapters[i].max_connections is ignored; cache may be NULL; timeout_ns 0 selects 30 s**/
+struct bglib_gatt_disc *bglib_gatt_disc_create(const struct bglib_conn_adapter *adapters, unsigned n,
+                                               struct bglib_gatt_cache *cache, uint64_t timeout_ns,
+                                               bglib_gatt_disc_cb cb, void *user);
+void bglib_gatt_disc_destroy(struct bglib_gatt_disc *d);
+
+/*
+ * Obtain the attribute map of a connection to address. A cache hit with
+ * a matching hash is reported from within the call and returns 1; else
+ * discovery starts and 0 is returned. Returns -1 if the connection is
+ * already being discovered or out of range.
+ */
+int bglib_gatt_disc_start(struct bglib_gatt_disc *d, unsigned adapter, uint8 connection, const bd_addr *address,
+                          uint8 address_type, uint64_t hash, uint64_t now_ns);
+
+/*
+ * Feed every message received from adapter. Returns 1 for the responses
+ * and attclient events of connections under discovery, 0 otherwise.
+ */
+int bglib_gatt_disc_on_message(struct bglib_gatt_disc *d, unsigned adapter, const struct ble_header *hdr,
+                               const uint8 *payload, uint64_t now_ns);
+
+/**Fail discoveries running longer than the timeout**/
+void bglib_gatt_disc_poll(struct bglib_gatt_disc *d, uint64_t now_ns);
+
+/**Last map reported for the connection; NULL while discovering or after a disconnect**/
+const struct bglib_gatt_map *bglib_gatt_disc_map(const struct bglib_gatt_disc *d, unsigned adapter,
+                                                 uint8 connection);
+
+void bglib_gatt_disc_get_stats(const struct bglib_gatt_disc *d, struct bglib_gatt_disc_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_GATT_DISC_H
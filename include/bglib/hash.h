@@ -0,0 +1,48 @@
+#ifndef BGLIB_HASH_H
+#define BGLIB_HASH_H
+
+#include <stdint.h>
+
+#include "apitypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**64-bit non-cryptographic hash of a byte string**/
+uint64_t bglib_hash64(const void *data, unsigned len, uint64_t seed);
+
+/*
+ * Fingerprint of an advertising payload. Up to 32 bytes are read as four
+ * overlapping 64-bit lanes and mixed as one block (two SSE2 vectors where
+ * available, the scalar path gives the same value); longer input falls
+ * back to bglib_hash64().
+ */
+uint64_t bglib_hash_ad(const void *data, unsigned len);
+
+/**Final avalanche step, usable on integer keys**/
+static inline uint64_t bglib_mix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+/**bd_addr and address type packed into one integer key: addr in bits 0..47, type in 48..55**/
+static inline uint64_t bglib_addr_key(const bd_addr *addr, uint8 address_type)
+{
+    const uint8 *a = addr->addr;
+
+    return (uint64_t)a[0] | (uint64_t)a[1] << 8 | (uint64_t)a[2] << 16 |
+           (uint64_t)a[3] << 24 | (uint64_t)a[4] << 32 | (uint64_t)a[5] << 40 |
+           (uint64_t)address_type << 48;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_HASH_H
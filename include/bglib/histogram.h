@@ -0,0 +1,43 @@
+#ifndef BGLIB_HISTOGRAM_H
+#define BGLIB_HISTOGRAM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BGLIB_HISTOGRAM_BUCKETS 64
+
+/*
+ * Log2 histogram: bucket n counts values in [2^(n-1), 2^n), bucket 0
+ * counts zeros. Recording is lock-free and may be done from any thread.
+ */
+struct bglib_histogram
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[BGLIB_HISTOGRAM_BUCKETS];
+};
+
+void bglib_histogram_reset(struct bglib_histogram *h);
+void bglib_histogram_record(struct bglib_histogram *h, uint64_t value);
+
+/**Consistent-enough copy for reporting while other threads keep recording**/
+void bglib_histogram_snapshot(const struct bglib_histogram *h, struct bglib_histogram *out);
+
+/**Upper bound of the bucket holding the given percentile (0..100)**/
+uint64_t bglib_histogram_percentile(const struct bglib_histogram *h, double percentile);
+
+static inline uint64_t bglib_histogram_mean(const struct bglib_histogram *h)
+{
+    return h->count ? h->sum / h->count : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_HISTOGRAM_H
@@ -0,0 +1,70 @@
+#ifndef BGLIB_RPA_H
+#define BGLIB_RPA_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Host-side resolution of resolvable private addresses (RPA).
+ *
+ * An RPA is prand (upper 24 bits, top bits 01) and hash = ah(irk, prand)
+ * (lower 24 bits). Resolving means computing ah for every known IRK, which
+ * is one AES-128 block each. With AES-NI the blocks of eight IRKs are
+ * encrypted interleaved so the AES pipeline stays full; without it a
+ * table-driven AES is used. Results, including "no IRK matches", are
+ * cached per address until the IRK set changes. Not thread-safe.
+ *
+ * IRKs are 16 bytes, most significant byte first (the order of the test
+ * vectors in the Core specification). Keys read over HCI or from the
+ * dongle in little-endian order must be reversed first.
+ */
+
+struct bglib_rpa_resolver;
+
+struct bglib_rpa_stats
+{
+    uint64_t lookups;
+    uint64_t cache_hits;
+    uint64_t resolved;
+    uint64_t aes_blocks;
+    unsigned irks;
+};
+
+/**Random address with the resolvable bit pattern**/
+static inline int bglib_rpa_is_resolvable(const bd_addr *addr, uint8 address_type)
+{
+    return address_type == 1 && (addr->addr[5] & 0xc0) == 0x40;
+}
+
+/**The Core specification's ah() function: lower 24 bits of e(irk, prand)**/
+uint32_t bglib_rpa_ah(const uint8 irk[16], uint32_t prand);
+
+/**cache_size: addresses remembered, rounded up to a power of two, 0 selects 4096**/
+struct bglib_rpa_resolver *bglib_rpa_create(unsigned cache_size);
+void bglib_rpa_destroy(struct bglib_rpa_resolver *r);
+
+/**id is returned by bglib_rpa_resolve; returns -1 if out of memory**/
+int bglib_rpa_add_irk(struct bglib_rpa_resolver *r, const uint8 irk[16], uint32_t id);
+/**Returns 1 if an IRK with this id was removed**/
+int bglib_rpa_remove_irk(struct bglib_rpa_resolver *r, uint32_t id);
+
+/**Returns 1 and the id of the matching IRK, 0 if addr is not resolvable with any of them**/
+int bglib_rpa_resolve(struct bglib_rpa_resolver *r, const bd_addr *addr, uint32_t *id);
+
+/**Use the portable AES even if AES-NI is available (benchmarks)**/
+void bglib_rpa_set_portable(struct bglib_rpa_resolver *r, int portable);
+/**"aes-ni" or "portable"**/
+const char *bglib_rpa_backend(const struct bglib_rpa_resolver *r);
+
+void bglib_rpa_get_stats(const struct bglib_rpa_resolver *r, struct bglib_rpa_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_RPA_H
@@ -0,0 +1,80 @@
+#ifndef BGLIB_RXMERGE_H
+#define BGLIB_RXMERGE_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "framer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Time-ordered merge of the frames of several adapters.
+ *
+ * Frames are queued per adapter and leave in order of time_ns, the read
+ * stamp minus the adapter's estimated UART latency. The head with the
+ * smallest time is released once every adapter has a frame queued (nothing
+ * older can arrive) or once it is window_ns old, so an idle adapter delays
+ * the stream by at most the window. Frames that arrive after a newer one
+ * has been released are still delivered and counted as late.
+ *
+ * Latency and drift come from a periodic hardware soft timer: after
+ * sending hardware_set_soft_timer(ticks, handle, 0) to an adapter, pass
+ * the send time to bglib_rxmerge_timer_started(). Timer events arrive at
+ * send + 2 * latency + k * period * (1 + drift) plus queueing noise; the
+ * lower envelope of the arrivals gives latency (half the round trip) and
+ * drift. Not thread-safe.
+ */
+
+#define BGLIB_RXMERGE_ADAPTERS_MAX  8
+
+struct bglib_rxmerge_clock
+{
+    int64_t latency_ns;         /* subtracted from mono_ns */
+    int64_t offset_ns;          /* host time of the adapter's timer start */
+    double drift_ppm;           /* adapter clock rate relative to CLOCK_MONOTONIC */
+    uint64_t samples;           /* timer events seen */
+    uint64_t jitter_ns;         /* smoothed delay of timer events above the envelope */
+};
+
+struct bglib_rxmerge_stats
+{
+    uint64_t pushed;
+    uint64_t emitted;
+    uint64_t late;              /* emitted older than an earlier emitted frame */
+    uint64_t full;              /* pushes refused, the adapter queue was full */
+    uint64_t max_reorder_ns;    /* largest lateness seen */
+};
+
+struct bglib_rxmerge;
+
+/**capacity is per adapter (rounded up to a power of two), window_ns 0 selects 5 ms**/
+struct bglib_rxmerge *bglib_rxmerge_create(unsigned adapters, unsigned capacity, uint64_t window_ns);
+void bglib_rxmerge_destroy(struct bglib_rxmerge *m);
+
+/**Queue a frame of rx->adapter and set its time_ns, returns -1 if the queue is full**/
+int bglib_rxmerge_push(struct bglib_rxmerge *m, const struct bglib_rx_frame *rx);
+
+/**Returns 1 and the oldest frame if it may be released at now_ns, 0 otherwise**/
+int bglib_rxmerge_pop(struct bglib_rxmerge *m, uint64_t now_ns, struct bglib_rx_frame *out);
+
+/**Returns 1 and the oldest frame regardless of the window, 0 when empty**/
+int bglib_rxmerge_flush(struct bglib_rxmerge *m, struct bglib_rx_frame *out);
+
+/**Start estimating from timer handle, ticks of 1/32768 s as sent in hardware_set_soft_timer**/
+void bglib_rxmerge_timer_started(struct bglib_rxmerge *m, unsigned adapter, uint8 handle,
+                                 uint64_t send_ns, uint32_t ticks);
+
+/**Fix the latency of adapter, disables the soft timer estimate**/
+void bglib_rxmerge_set_latency(struct bglib_rxmerge *m, unsigned adapter, int64_t latency_ns);
+
+void bglib_rxmerge_get_clock(const struct bglib_rxmerge *m, unsigned adapter, struct bglib_rxmerge_clock *out);
+void bglib_rxmerge_get_stats(const struct bglib_rxmerge *m, struct bglib_rxmerge_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_RXMERGE_H
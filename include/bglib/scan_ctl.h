@@ -0,0 +1,134 @@
+#ifndef BGLIB_SCAN_CTL_H
+#define BGLIB_SCAN_CTL_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Closed-loop scan settings for one adapter.
+ *
+ * The controller walks a ladder of scan settings ordered from the most
+ * received traffic (active scanning, window == interval, no filtering) to
+ * the least (passive, short window, controller duplicate filtering). Once
+ * per period it measures the UART receive utilisation from the bytes fed
+ * through bglib_scan_ctl_on_message() (10 bits per byte at the configured
+ * baud rate) and combines it with the RX ring fill and drop counters the
+ * caller samples. It steps down when the link is above target, the ring
+ * fills up or frames were dropped, and steps back up once the estimated
+ * load of the richer level fits below target for hold_ns. A level change
+ * is applied with gap_end_procedure, gap_set_scan_parameters,
+ * gap_set_filtering and gap_discover; the callback reports every decision.
+ * Not thread-safe.
+ */
+
+#define BGLIB_SCAN_CTL_LEVELS_MAX 16
+
+struct bglib_scan_ctl_level
+{
+    uint16 window;              /* 0.625 ms units, at most the interval */
+    uint8 active;               /* send scan requests */
+    uint8 scan_policy;          /* gap_scan_policy */
+    uint8 duplicates;           /* gap_set_filtering scan_duplicate_filtering */
+    float load;                 /* expected traffic relative to level 0, 0 derives it */
+};
+
+struct bglib_scan_ctl_config
+{
+    bglib_send_fn send;         /* NULL writes through bglib_output */
+    void *user;
+    uint32_t baud;              /* 0 selects 115200 */
+    float target;               /* receive utilisation to stay below, 0 selects 0.6 */
+    float fill_high;            /* ring fill that forces a step down, 0 selects 0.5 */
+    uint16 interval;            /* 0.625 ms units, 0 selects 160 (100 ms) */
+    uint8 mode;                 /* gap_discover_mode */
+    uint8 start_level;
+    uint64_t period_ns;         /* measurement period, 0 selects 1 s */
+    uint64_t hold_ns;           /* minimum time before stepping up, 0 selects 10 s */
+    uint64_t retry_ns;          /* delay after a failed command, 0 selects 1 s */
+    const struct bglib_scan_ctl_level *levels;  /* NULL selects the built-in ladder */
+    unsigned nlevels;
+};
+
+/**Queue and loss counters sampled by the caller, e.g. from bglib_scanq_get_stats**/
+struct bglib_scan_ctl_load
+{
+    unsigned rx_fill;           /* frames or bytes waiting */
+    unsigned rx_size;           /* capacity in the same unit, 0 if unknown */
+    uint64_t drops;             /* cumulative, any source */
+};
+
+enum bglib_scan_ctl_reason
+{
+    bglib_scan_ctl_utilisation, /* link above target */
+    bglib_scan_ctl_fill,        /* RX ring above fill_high */
+    bglib_scan_ctl_drops,       /* frames lost during the period */
+    bglib_scan_ctl_headroom,    /* richer level fits below target */
+    bglib_scan_ctl_restart      /* settings re-applied after a boot or failure */
+};
+
+struct bglib_scan_ctl_decision
+{
+    uint64_t time_ns;
+    unsigned from;
+    unsigned to;
+    enum bglib_scan_ctl_reason reason;
+    float utilisation;          /* of the period that triggered the decision */
+    float fill;
+    float events_per_s;         /* scan responses */
+    uint64_t drops;             /* during the period */
+};
+
+struct bglib_scan_ctl_stats
+{
+    unsigned level;
+    int applied;                /* the adapter runs the current level */
+    float utilisation;          /* last period */
+    float events_per_s;
+    uint64_t rx_bytes;
+    uint64_t scan_responses;
+    uint64_t steps_down;
+    uint64_t steps_up;
+    uint64_t errors;
+    uint64_t level_ns[BGLIB_SCAN_CTL_LEVELS_MAX];   /* time spent at each level */
+};
+
+typedef void (*bglib_scan_ctl_cb)(void *user, const struct bglib_scan_ctl_decision *decision);
+
+struct bglib_scan_ctl;
+
+/**cfg may be NULL for defaults**/
+struct bglib_scan_ctl *bglib_scan_ctl_create(const struct bglib_scan_ctl_config *cfg, bglib_scan_ctl_cb cb,
+                                             void *user);
+void bglib_scan_ctl_destroy(struct bglib_scan_ctl *ctl);
+
+/**Apply the current level and start scanning**/
+void bglib_scan_ctl_start(struct bglib_scan_ctl *ctl, uint64_t now_ns);
+void bglib_scan_ctl_stop(struct bglib_scan_ctl *ctl, uint64_t now_ns);
+
+/*
+ * Feed every message received from the adapter. Scan responses and other
+ * events are only counted and return 0; the controller's own command
+ * responses are consumed and return 1.
+ */
+int bglib_scan_ctl_on_message(struct bglib_scan_ctl *ctl, const struct ble_header *hdr, const uint8 *payload,
+                              uint64_t now_ns);
+
+/**Evaluate the period once it has elapsed and retry failed commands; load may be NULL**/
+void bglib_scan_ctl_poll(struct bglib_scan_ctl *ctl, const struct bglib_scan_ctl_load *load, uint64_t now_ns);
+
+/**Copy of the level in use**/
+void bglib_scan_ctl_level(const struct bglib_scan_ctl *ctl, struct bglib_scan_ctl_level *out);
+
+void bglib_scan_ctl_get_stats(const struct bglib_scan_ctl *ctl, uint64_t now_ns, struct bglib_scan_ctl_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_SCAN_CTL_H
@@ -0,0 +1,88 @@
+#ifndef BGLIB_SCAN_FILTER_H
+#define BGLIB_SCAN_FILTER_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compiled filter over gap_scan_response events.
+ *
+ * A rule is a conjunction of predicates. The rule set is compiled once into
+ * hash buckets keyed by each rule's most selective predicate (address
+ * prefix, company ID, 128-bit UUID, 16-bit UUID, name prefix); a frame is
+ * parsed once and only the rules in its buckets, plus rules with none of
+ * these predicates, are verified. Matching rules count a hit and vote with
+ * their action: a frame is dropped if a DROP rule matches, passed if a PASS
+ * rule matches, and gets the default verdict otherwise. A compiled filter
+ * is immutable and may be shared between threads.
+ */
+
+#define BGLIB_SCAN_MATCH_ADDR       0x01    /* address prefix */
+#define BGLIB_SCAN_MATCH_TYPE       0x02    /* address type */
+#define BGLIB_SCAN_MATCH_RSSI       0x04    /* rssi >= rssi_min */
+#define BGLIB_SCAN_MATCH_UUID16     0x08    /* service UUID present */
+#define BGLIB_SCAN_MATCH_UUID128    0x10
+#define BGLIB_SCAN_MATCH_COMPANY    0x20    /* manufacturer data company ID */
+#define BGLIB_SCAN_MATCH_NAME       0x40    /* local name prefix */
+
+enum bglib_scan_action
+{
+    bglib_scan_pass,
+    bglib_scan_drop
+};
+
+struct bglib_scan_rule
+{
+    unsigned match;             /* BGLIB_SCAN_MATCH_* in use */
+    bd_addr addr;               /* as in the event: addr[5] is the first byte of the printed form */
+    uint8 addr_bits;            /* prefix length from addr[5]; 24 is the OUI, 48 the full address */
+    uint8 address_type;
+    int8 rssi_min;
+    uint16 company;
+    uint16 uuid16;
+    uint8 uuid128[16];          /* little-endian, as on air */
+    uint8 name_len;
+    char name[30];              /* prefix, not NUL-terminated */
+    uint8 action;               /* bglib_scan_action */
+};
+
+struct bglib_scan_filter_stats
+{
+    uint64_t evaluated;
+    uint64_t passed;
+    uint64_t dropped;
+    uint64_t verified;          /* candidate rules checked */
+};
+
+struct bglib_scan_filter;
+
+/**Rules are copied; default_action applies to frames matching no rule**/
+struct bglib_scan_filter *bglib_scan_filter_compile(const struct bglib_scan_rule *rules, unsigned n,
+                                                    enum bglib_scan_action default_action);
+void bglib_scan_filter_destroy(struct bglib_scan_filter *f);
+
+/**Returns 1 if the frame passes; payload_len from the frame header**/
+int bglib_scan_filter_eval(struct bglib_scan_filter *f, const struct ble_msg_gap_scan_response_evt_t *msg,
+                           unsigned payload_len);
+
+/**Hits of rules[rule] given to bglib_scan_filter_compile**/
+uint64_t bglib_scan_filter_hits(const struct bglib_scan_filter *f, unsigned rule);
+void bglib_scan_filter_get_stats(const struct bglib_scan_filter *f, struct bglib_scan_filter_stats *out);
+
+/*
+ * bglib_dispatch filter: bglib_dispatch_add_filter(bglib_scan_filter_dispatch, f)
+ * drops rejected scan responses before any handler runs. Other messages pass.
+ */
+int bglib_scan_filter_dispatch(void *f, const struct ble_msg *msg, const struct ble_header *hdr,
+                               const uint8 *payload);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_SCAN_FILTER_H
@@ -0,0 +1,108 @@
+#ifndef BGLIB_SCAN_ORCH_H
+#define BGLIB_SCAN_ORCH_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Scanning with several dongles as one scanner.
+ *
+ * Every adapter gets the same interval and window, but its gap_discover is
+ * started at a phase offset: adapters 0-2 are one interval apart so they
+ * sit on different advertising channels, further adapters are shifted by a
+ * window to fill the gaps when window < interval. Adapters are prepared
+ * again (end_procedure, set_scan_parameters, discover) after a
+ * system_boot or a failed command, re-aligned to the original phase.
+ *
+ * Scan responses of all adapters are merged: receptions of the same
+ * sender, packet type and payload within dedupe_ns become one report with
+ * the best RSSI of each adapter. Not thread-safe; feed every adapter's
+ * messages from one thread or serialise the calls.
+ */
+
+#define BGLIB_SCAN_ADAPTERS_MAX 8
+#define BGLIB_SCAN_NOT_HEARD    127
+
+struct bglib_scan_adapter
+{
+    bglib_send_fn send;         /* NULL writes through bglib_output */
+    void *user;
+};
+
+struct bglib_scan_plan
+{
+    uint16 interval;            /* 0.625 ms units, 0 selects 160 (100 ms) */
+    uint16 window;              /* 0 selects interval */
+    uint8 mode;                 /* gap_discover_mode */
+    uint8 active_mask;          /* adapters sending scan requests */
+    unsigned pending;           /* reports being merged, 0 selects 1024 */
+    uint64_t dedupe_ns;         /* 0 selects 20 ms */
+    uint64_t retry_ns;          /* delay after a failed command, 0 selects 1 s */
+};
+
+struct bglib_scan_report
+{
+    bd_addr sender;
+    uint8 address_type;
+    uint8 packet_type;
+    uint8 bond;
+    uint8 adapters;             /* mask of adapters that heard it */
+    int8 rssi[BGLIB_SCAN_ADAPTERS_MAX];     /* best per adapter, BGLIB_SCAN_NOT_HEARD if not heard */
+    int8 best_rssi;
+    uint8 best_adapter;
+    uint8 data_len;
+    uint8 data[31];
+    uint64_t first_ns;
+};
+
+struct bglib_scan_coverage
+{
+    unsigned adapters;
+    unsigned scanning;          /* adapters currently discovering */
+    double duty[BGLIB_SCAN_ADAPTERS_MAX];   /* window / interval times the share of time spent scanning */
+    double coverage;            /* share of time some adapter listens, the windows do not overlap */
+    uint64_t restarts;
+    uint64_t errors;
+    uint64_t receptions;
+    uint64_t reports;
+};
+
+typedef void (*bglib_scan_report_cb)(void *user, const struct bglib_scan_report *report);
+
+struct bglib_scan_orch;
+
+/**plan may be NULL: 100 ms continuous observation scan, adapter 0 active**/
+struct bglib_scan_orch *bglib_scan_orch_create(const struct bglib_scan_adapter *adapters, unsigned n,
+                                               const struct bglib_scan_plan *plan,
+                                               bglib_scan_report_cb cb, void *user);
+void bglib_scan_orch_destroy(struct bglib_scan_orch *orch);
+
+/**Prepare all adapters and schedule the staggered discover starts**/
+void bglib_scan_orch_start(struct bglib_scan_orch *orch, uint64_t now_ns);
+/**Send gap_end_procedure to all adapters and flush pending reports**/
+void bglib_scan_orch_stop(struct bglib_scan_orch *orch, uint64_t now_ns);
+
+/**Send discover starts that are due and emit merged reports older than dedupe_ns**/
+void bglib_scan_orch_poll(struct bglib_scan_orch *orch, uint64_t now_ns);
+
+/*
+ * Feed every message received from adapter. Returns 1 if the orchestrator
+ * consumed it (its own command responses and scan responses), 0 otherwise.
+ */
+int bglib_scan_orch_on_message(struct bglib_scan_orch *orch, unsigned adapter, const struct ble_header *hdr,
+                               const uint8 *payload, uint64_t now_ns);
+
+void bglib_scan_orch_get_coverage(const struct bglib_scan_orch *orch, uint64_t now_ns,
+                                  struct bglib_scan_coverage *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_SCAN_ORCH_H
@@ -0,0 +1,98 @@
+#ifndef BGLIB_SCANLOG_H
+#define BGLIB_SCANLOG_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Columnar archive of scan responses.
+ *
+ * Rows are buffered and written in blocks of block_rows. Inside a block
+ * every field is a column: timestamps as zigzag varint deltas, senders as
+ * varint indexes into a per-block address dictionary, RSSI, packet type,
+ * bond and AD length as byte columns, and the AD data concatenated in a
+ * blob column. A payload equal to the previous one of the same sender in
+ * the block is stored once and marked as a repeat in the length column.
+ *
+ * Each block header carries its time range; closing the writer appends an
+ * index of all blocks. The reader maps the file and skips blocks outside
+ * the queried range without decoding them. Files left without an index
+ * (writer not closed) are recovered by walking the block headers. Files
+ * use host byte order. Writer and reader objects are not thread-safe.
+ */
+
+struct bglib_scanlog_writer;
+struct bglib_scanlog;
+
+struct bglib_scanlog_writer_stats
+{
+    uint64_t rows;
+    uint64_t blocks;
+    uint64_t bytes;             /* written to the file */
+    uint64_t raw_bytes;         /* scan response payloads plus 8-byte timestamps */
+    uint64_t repeats;           /* payloads stored as repeats */
+};
+
+/**Truncates path; block_rows 0 selects 4096**/
+struct bglib_scanlog_writer *bglib_scanlog_writer_create(const char *path, unsigned block_rows);
+
+/**Append one scan response, returns -1 on write error**/
+int bglib_scanlog_write(struct bglib_scanlog_writer *w, const struct ble_msg_gap_scan_response_evt_t *msg,
+                        unsigned payload_len, uint64_t time_ns);
+
+/**Write the rows buffered so far as a (short) block and flush the stream**/
+int bglib_scanlog_writer_flush(struct bglib_scanlog_writer *w);
+
+/**Flush, append the block index and close; returns -1 if anything failed to write**/
+int bglib_scanlog_writer_close(struct bglib_scanlog_writer *w);
+
+void bglib_scanlog_writer_get_stats(const struct bglib_scanlog_writer *w,
+                                    struct bglib_scanlog_writer_stats *out);
+
+/**One decoded row; data points into the mapped file**/
+struct bglib_scan_record
+{
+    uint64_t time_ns;
+    bd_addr sender;
+    uint8 address_type;
+    int8 rssi;
+    uint8 packet_type;
+    uint8 bond;
+    uint8 data_len;
+    const uint8 *data;
+};
+
+struct bglib_scanlog_block
+{
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint32_t rows;
+};
+
+/**Return nonzero to stop the query**/
+typedef int (*bglib_scanlog_cb)(void *user, const struct bglib_scan_record *rec);
+
+/**Map a scan log, returns NULL if it is missing or not a scan log**/
+struct bglib_scanlog *bglib_scanlog_open(const char *path);
+void bglib_scanlog_close(struct bglib_scanlog *log);
+
+unsigned bglib_scanlog_blocks(const struct bglib_scanlog *log);
+int bglib_scanlog_block_info(const struct bglib_scanlog *log, unsigned i, struct bglib_scanlog_block *out);
+
+/*
+ * Call cb for every row with from_ns <= time_ns < to_ns, in file order.
+ * Returns the number of rows delivered, or -1 if a block is corrupt.
+ */
+int64_t bglib_scanlog_query(const struct bglib_scanlog *log, uint64_t from_ns, uint64_t to_ns,
+                            bglib_scanlog_cb cb, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_SCANLOG_H
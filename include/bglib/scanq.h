@@ -0,0 +1,85 @@
+#ifndef BGLIB_SCANQ_H
+#define BGLIB_SCANQ_H
+
+#include <stdint.h>
+
+#include "cmd_def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded hand-off of scan responses from the reader thread to a consumer.
+ *
+ * The reader never waits for the consumer: when the queue is full the
+ * overload policy decides what is lost. BGLIB_SCANQ_CONFLATE keeps at most
+ * one queued event per sender (bd_addr + address type); a newer reception
+ * overwrites it in place, keeping its position in the queue. When all
+ * queued events are from distinct senders it drops the oldest.
+ * Both sides only hold the queue lock while copying one event.
+ */
+
+#define BGLIB_SCANQ_PAYLOAD_MAX 48  /* fixed fields + 31 bytes AD data, longer payloads are cut */
+
+enum bglib_scanq_policy
+{
+    BGLIB_SCANQ_DROP_OLDEST,
+    BGLIB_SCANQ_DROP_NEWEST,
+    BGLIB_SCANQ_CONFLATE
+};
+
+struct bglib_scan_event
+{
+    uint64_t time_ns;           /* of the latest reception */
+    uint32_t receptions;        /* conflated into this event, 1 otherwise */
+    uint8 payload_len;
+    uint8 payload[BGLIB_SCANQ_PAYLOAD_MAX];
+};
+
+static inline const struct ble_msg_gap_scan_response_evt_t *bglib_scan_event_msg(const struct bglib_scan_event *ev)
+{
+    return (const struct ble_msg_gap_scan_response_evt_t *)ev->payload;
+}
+
+struct bglib_scanq_stats
+{
+    uint64_t pushed;
+    uint64_t popped;
+    uint64_t dropped_oldest;
+    uint64_t dropped_newest;
+    uint64_t conflated;         /* receptions merged into a queued event */
+    unsigned depth;
+    unsigned max_depth;
+};
+
+struct bglib_scanq;
+
+/**capacity is rounded up to a power of two**/
+struct bglib_scanq *bglib_scanq_create(unsigned capacity, enum bglib_scanq_policy policy);
+void bglib_scanq_destroy(struct bglib_scanq *q);
+
+/**Returns 0 if queued, 1 if conflated, -1 if dropped (DROP_NEWEST on a full queue)**/
+int bglib_scanq_push(struct bglib_scanq *q, const struct ble_msg_gap_scan_response_evt_t *msg,
+                     unsigned payload_len, uint64_t now_ns);
+
+/**Returns 1 and the oldest event, 0 if the queue is empty**/
+int bglib_scanq_pop(struct bglib_scanq *q, struct bglib_scan_event *out);
+
+/**Like bglib_scanq_pop, waiting up to timeout_ns for an event**/
+int bglib_scanq_wait(struct bglib_scanq *q, struct bglib_scan_event *out, uint64_t timeout_ns);
+
+void bglib_scanq_get_stats(const struct bglib_scanq *q, struct bglib_scanq_stats *out);
+
+/*
+ * Dispatch filter (see bglib_dispatch_add_filter) queueing every scan
+ * response on q, stamped with CLOCK_MONOTONIC, instead of running its
+ * handler on the reader thread. Other messages pass.
+ */
+int bglib_scanq_dispatch(void *q, const struct ble_msg *msg, const struct ble_header *hdr, const uint8 *payload);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_SCANQ_H
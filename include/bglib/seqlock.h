@@ -0,0 +1,53 @@
+#ifndef BGLIB_SEQLOCK_H
+#define BGLIB_SEQLOCK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sequence lock for one writer and any number of readers. The writer never
+ * waits; readers copy the protected data and retry if the sequence was odd
+ * or changed meanwhile:
+ *
+ *     do
+ *     {
+ *         s = bglib_seq_read_begin(&x->seq);
+ *         copy = x->data;
+ *     } while (bglib_seq_read_retry(&x->seq, s));
+ */
+
+static inline void bglib_seq_write_begin(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void bglib_seq_write_end(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t bglib_seq_read_begin(const uint32_t *seq)
+{
+    uint32_t s;
+
+    /* write sections are a few stores long, spinning is cheaper than yielding */
+    while ((s = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1)
+        ;
+    return s;
+}
+
+static inline int bglib_seq_read_retry(const uint32_t *seq, uint32_t start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_SEQLOCK_H
@@ -0,0 +1,59 @@
+#ifndef BGLIB_TXQUEUE_H
+#define BGLIB_TXQUEUE_H
+
+#include <stdint.h>
+
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded lock-free multi-producer/single-consumer queue of encoded frames.
+ *
+ * Any number of threads may push; exactly one thread (the one owning the
+ * serial port) pops or drains. Once installed with bglib_set_tx_queue(),
+ * bglib_output points at a shim that publishes each finished frame of
+ * ble_send_message() here, and bglib_frame_output() pushes directly, so
+ * bytes of two commands can no longer interleave on the wire. The
+ * consumer writes through the bglib_output set before installation.
+ */
+
+struct bglib_txq_stats
+{
+    uint64_t pushed;
+    uint64_t popped;
+    uint64_t full;   /* pushes that found the queue full */
+};
+
+struct bglib_txq;
+
+/**capacity is rounded up to a power of two**/
+struct bglib_txq *bglib_txq_create(unsigned capacity);
+void bglib_txq_destroy(struct bglib_txq *q);
+
+/**Lock-free publish, returns -1 if the queue is full**/
+int bglib_txq_push(struct bglib_txq *q, const struct bglib_frame *frame);
+
+/**Consumer side, returns 0 if the queue is empty**/
+int bglib_txq_pop(struct bglib_txq *q, struct bglib_frame *frame);
+
+/**Pop everything queued and hand it to send (bglib_output when NULL), returns frames sent**/
+unsigned bglib_txq_drain(struct bglib_txq *q, bglib_send_fn send, void *user);
+
+void bglib_txq_get_stats(const struct bglib_txq *q, struct bglib_txq_stats *out);
+
+/*
+ * Route ble_send_message() through q (NULL restores direct bglib_output).
+ * Set bglib_output first and install the queue before other threads send.
+ * A producer that finds the queue full yields until the consumer catches up.
+ */
+void bglib_set_tx_queue(struct bglib_txq *q);
+struct bglib_txq *bglib_get_tx_queue(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BGLIB_TXQUEUE_H
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "adcache.h"
+#include "hash.h"
+
+#define AD_MAX  31              /* legacy advertising payload */
+
+struct payload
+{
+    uint64_t hash;
+    uint8 valid;
+    int8 beacons;               /* -1 not run or not replayable, 0 nothing decoded, 1 hits recorded */
+    uint8 len;
+    uint8 data[AD_MAX];         /* compared on a fingerprint match */
+    struct gap_ad_index index;
+    struct bglib_beacon_hits hits;
+};
+
+struct entry
+{
+    uint64_t key;               /* bglib_device.key, 0 if unused */
+    struct payload p[2];        /* advertisement, scan response */
+};
+
+struct bglib_adcache
+{
+    struct entry *entries;
+    unsigned capacity;
+    struct payload scratch;     /* messages without a table entry */
+    struct bglib_adcache_stats stats;
+};
+
+struct bglib_adcache *bglib_adcache_create(unsigned capacity)
+{
+    struct bglib_adcache *c;
+
+    if (!capacity)
+        return NULL;
+    c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+    c->capacity = capacity;
+    c->entries = calloc(c->capacity, sizeof(*c->entries));
+    if (!c->entries)
+    {
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+void bglib_adcache_destroy(struct bglib_adcache *c)
+{
+    if (!c)
+        return;
+    free(c->entries);
+    free(c);
+}
+
+int bglib_adcache_get(struct bglib_adcache *c, const struct bglib_device *dev,
+                      const struct ble_msg_gap_scan_response_evt_t *msg, unsigned payload_len,
+                      struct bglib_ad_view *view)
+{
+    struct payload *p;
+    uint64_t hash;
+
+    view->len = gap_ad_scan_data(msg, payload_len, &view->data);
+    hash = bglib_hash_ad(view->data, view->len);
+    c->stats.lookups++;
+
+    if (dev && dev->id < c->capacity)
+    {
+        struct entry *e = &c->entries[dev->id];
+
+        if (e->key != dev->key)
+        {
+            memset(e, 0, sizeof(*e));
+            e->key = dev->key;
+        }
+        p = &e->p[(msg->packet_type >> 1 & 3) == bglib_dev_scan_response];
+    }
+    else
+    {
+        p = &c->scratch;
+        p->valid = 0;
+    }
+
+    /* the index holds offsets into the data, so a fingerprint collision must not reuse it */
+    view->repeat = p->valid && p->hash == hash && p->len == view->len && !memcmp(p->data, view->data, view->len);
+    if (view->repeat)
+    {
+        c->stats.repeats++;
+    }
+    else
+    {
+        gap_ad_index_build(&p->index, view->data, view->len);
+        p->hash = hash;
+        p->valid = p != &c->scratch && view->len <= AD_MAX;
+        p->beacons = -1;
+        if (p->valid)
+        {
+            p->len = view->len;
+            memcpy(p->data, view->data, view->len);
+        }
+    }
+    view->index = &p->index;
+    view->entry = p;
+    return view->repeat;
+}
+
+unsigned bglib_adcache_beacons(struct bglib_adcache *c, struct bglib_beacon_registry *reg,
+                               const struct ble_msg_gap_scan_response_evt_t *msg, const struct bglib_ad_view *view)
+{
+    struct payload *p = view->entry;
+    unsigned n;
+
+    if (p->beacons == 0)
+    {
+        c->stats.beacon_skips++;
+        return 0;
+    }
+    if (p->beacons > 0)
+    {
+        c->stats.beacon_replays++;
+        return bglib_beacon_replay(reg, msg, view->data, view->index, &p->hits);
+    }
+    n = bglib_beacon_process_hits(reg, msg, view->data, view->index, &p->hits);
+    p->beacons = p->hits.count <= BGLIB_BEACON_HITS_MAX ? n > 0 : -1;
+    return n;
+}
+
+void bglib_adcache_forget(struct bglib_adcache *c, const struct bglib_device *dev)
+{
+    if (dev->id < c->capacity)
+        memset(&c->entries[dev->id], 0, sizeof(struct entry));
+}
+
+void bglib_adcache_clear(struct bglib_adcache *c)
+{
+    memset(c->entries, 0, c->capacity * sizeof(*c->entries));
+}
+
+void bglib_adcache_get_stats(const struct bglib_adcache *c, struct bglib_adcache_stats *out)
+{
+    *out = c->stats;
+}
@@ -0,0 +1,378 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "addrset.h"
+#include "dispatch.h"
+#include "hash.h"
+
+#define MAGIC           0x53414742u     /* "BGAS" */
+#define VERSION         1
+#define BLOCK_BITS      512
+#define DEFAULT_BITS    10
+
+struct addrset_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t blocks;
+    uint32_t hashes;
+    uint64_t count;
+    uint64_t reserved[5];
+};
+
+struct bloom_block
+{
+    uint64_t w[8];
+} __attribute__((aligned(64)));
+
+struct bglib_addrset
+{
+    const struct addrset_header *hdr;
+    const struct bloom_block *blocks;
+    const uint64_t *keys;
+    void *base;
+    size_t bytes;
+    int mapped;
+};
+
+struct bglib_addrfilter
+{
+    struct bglib_addrset *set;
+    unsigned epoch;
+    unsigned readers[2];
+    pthread_mutex_t swap_lock;
+    uint8 mode;
+    struct bglib_addrfilter_stats stats;
+};
+
+static uint64_t key_of(const bd_addr *addr)
+{
+    return bglib_addr_key(addr, 0);
+}
+
+static int cmp_key(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static size_t layout_bytes(uint32_t blocks, uint64_t count)
+{
+    return sizeof(struct bloom_block) + blocks * sizeof(struct bloom_block) + count * sizeof(uint64_t);
+}
+
+/* header in the first 64-byte block, then the Bloom blocks, then the keys */
+static void attach(struct bglib_addrset *set, void *base, size_t bytes)
+{
+    set->base = base;
+    set->bytes = bytes;
+    set->hdr = base;
+    set->blocks = (const struct bloom_block *)base + 1;
+    set->keys = (const uint64_t *)(set->blocks + set->hdr->blocks);
+}
+
+static void bloom_add(struct bloom_block *blocks, uint32_t nblocks, unsigned hashes, uint64_t key)
+{
+    uint64_t h = bglib_mix64(key);
+    struct bloom_block *b = &blocks[((h >> 32) * nblocks) >> 32];
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    unsigned i;
+
+    for (i = 0; i < hashes; i++, h1 += h2)
+        b->w[(h1 >> 6) & 7] |= (uint64_t)1 << (h1 & 63);
+}
+
+static int bloom_test(const struct bloom_block *blocks, uint32_t nblocks, unsigned hashes, uint64_t key)
+{
+    uint64_t h = bglib_mix64(key);
+    const struct bloom_block *b = &blocks[((h >> 32) * nblocks) >> 32];
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    uint64_t miss = 0;
+    unsigned i;
+
+    /* all probes hit the same cache line, accumulate instead of branching */
+    for (i = 0; i < hashes; i++, h1 += h2)
+        miss |= ~b->w[(h1 >> 6) & 7] & ((uint64_t)1 << (h1 & 63));
+    return !miss;
+}
+
+struct bglib_addrset *bglib_addrset_build(const bd_addr *addrs, size_t n, unsigned bits_per_addr)
+{
+    struct bglib_addrset *set = calloc(1, sizeof(*set));
+    struct addrset_header *hdr;
+    uint64_t *keys;
+    uint32_t nblocks;
+    unsigned hashes;
+    size_t i, count;
+    void *base;
+
+    if (!set)
+        return NULL;
+    if (!bits_per_addr)
+        bits_per_addr = DEFAULT_BITS;
+
+    keys = malloc((n ? n : 1) * sizeof(*keys));
+    if (!keys)
+    {
+        free(set);
+        return NULL;
+    }
+    for (i = 0; i < n; i++)
+        keys[i] = key_of(&addrs[i]);
+    qsort(keys, n, sizeof(*keys), cmp_key);
+    for (i = 0, count = 0; i < n; i++)
+    {
+        if (!count || keys[count - 1] != keys[i])
+            keys[count++] = keys[i];
+    }
+
+    /* k = bits * ln 2 minimises the false positive rate */
+    nblocks = (count * bits_per_addr + BLOCK_BITS - 1) / BLOCK_BITS;
+    if (!nblocks)
+        nblocks = 1;
+    hashes = bits_per_addr * 69 / 100;
+    if (hashes < 1)
+        hashes = 1;
+    if (hashes > 16)
+        hashes = 16;
+
+    base = aligned_alloc(64, (layout_bytes(nblocks, count) + 63) & ~(size_t)63);
+    if (!base)
+    {
+        free(keys);
+        free(set);
+        return NULL;
+    }
+    memset(base, 0, layout_bytes(nblocks, count));
+    hdr = base;
+    hdr->magic = MAGIC;
+    hdr->version = VERSION;
+    hdr->blocks = nblocks;
+    hdr->hashes = hashes;
+    hdr->count = count;
+    attach(set, base, layout_bytes(nblocks, count));
+
+    for (i = 0; i < count; i++)
+        bloom_add((struct bloom_block *)set->blocks, nblocks, hashes, keys[i]);
+    memcpy((uint64_t *)set->keys, keys, count * sizeof(*keys));
+    free(keys);
+    return set;
+}
+
+int bglib_addrset_save(const struct bglib_addrset *set, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    int ok;
+
+    if (!f)
+        return -1;
+    ok = fwrite(set->base, 1, set->bytes, f) == set->bytes;
+    if (fclose(f))
+        ok = 0;
+    return ok ? 0 : -1;
+}
+
+struct bglib_addrset *bglib_addrset_open(const char *path)
+{
+    const struct addrset_header *hdr;
+    struct bglib_addrset *set;
+    struct stat st;
+    void *base;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct bloom_block))
+    {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    hdr = base;
+    if (hdr->magic != MAGIC || hdr->version != VERSION || !hdr->blocks || !hdr->hashes ||
+        hdr->hashes > 16 || hdr->count > (uint64_t)st.st_size / sizeof(uint64_t) ||
+        layout_bytes(hdr->blocks, hdr->count) != (size_t)st.st_size)
+    {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    set = calloc(1, sizeof(*set));
+    if (!set)
+    {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    attach(set, base, st.st_size);
+    set->mapped = 1;
+    return set;
+}
+
+void bglib_addrset_close(struct bglib_addrset *set)
+{
+    if (!set)
+        return;
+    if (set->mapped)
+        munmap(set->base, set->bytes);
+    else
+        free(set->base);
+    free(set);
+}
+
+static int maybe_key(const struct bglib_addrset *set, uint64_t key)
+{
+    return bloom_test(set->blocks, set->hdr->blocks, set->hdr->hashes, key);
+}
+
+static int contains_key(const struct bglib_addrset *set, uint64_t key)
+{
+    const uint64_t *base = set->keys;
+    size_t n = set->hdr->count;
+
+    /* branch-free lower bound */
+    while (n > 1)
+    {
+        size_t half = n / 2;
+
+        base = base[half] <= key ? base + half : base;
+        n -= half;
+    }
+    return n && *base == key;
+}
+
+int bglib_addrset_maybe(const struct bglib_addrset *set, const bd_addr *addr)
+{
+    return maybe_key(set, key_of(addr));
+}
+
+int bglib_addrset_contains(const struct bglib_addrset *set, const bd_addr *addr)
+{
+    uint64_t key = key_of(addr);
+
+    return maybe_key(set, key) && contains_key(set, key);
+}
+
+void bglib_addrset_get_info(const struct bglib_addrset *set, struct bglib_addrset_info *out)
+{
+    out->count = set->hdr->count;
+    out->blocks = set->hdr->blocks;
+    out->hashes = set->hdr->hashes;
+    out->bytes = set->bytes;
+    out->mapped = set->mapped;
+}
+
+struct bglib_addrfilter *bglib_addrfilter_create(enum bglib_addrfilter_mode mode)
+{
+    struct bglib_addrfilter *af = calloc(1, sizeof(*af));
+
+    if (!af)
+        return NULL;
+    pthread_mutex_init(&af->swap_lock, NULL);
+    af->mode = mode;
+    return af;
+}
+
+void bglib_addrfilter_destroy(struct bglib_addrfilter *af)
+{
+    if (!af)
+        return;
+    bglib_addrset_close(af->set);
+    pthread_mutex_destroy(&af->swap_lock);
+    free(af);
+}
+
+/*
+ * Two reader counters, selected by the epoch at entry. The writer publishes
+ * the new set, flips the epoch and waits for the counter of the previous
+ * epoch to drain; readers arriving after the flip count on the other one,
+ * so the wait is bounded by the lookups already in progress. A reader
+ * re-checks the epoch after registering and only then loads the set, so a
+ * registration that raced with a flip is retried on the new counter
+ * instead of going unseen by the next swap.
+ */
+struct bglib_addrset *bglib_addrfilter_swap(struct bglib_addrfilter *af, struct bglib_addrset *set)
+{
+    struct bglib_addrset *old;
+    unsigned e;
+
+    pthread_mutex_lock(&af->swap_lock);
+    old = __atomic_exchange_n(&af->set, set, __ATOMIC_SEQ_CST);
+    e = __atomic_fetch_xor(&af->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+    while (__atomic_load_n(&af->readers[e], __ATOMIC_SEQ_CST))
+        sched_yield();
+    pthread_mutex_unlock(&af->swap_lock);
+    return old;
+}
+
+int bglib_addrfilter_check(struct bglib_addrfilter *af, const bd_addr *addr)
+{
+    const struct bglib_addrset *set;
+    uint64_t key = key_of(addr);
+    int listed = 0;
+    int pass;
+    unsigned e;
+
+    for (;;)
+    {
+        e = __atomic_load_n(&af->epoch, __ATOMIC_SEQ_CST) & 1;
+        __atomic_fetch_add(&af->readers[e], 1, __ATOMIC_SEQ_CST);
+        if ((__atomic_load_n(&af->epoch, __ATOMIC_SEQ_CST) & 1) == e)
+            break;
+        __atomic_fetch_sub(&af->readers[e], 1, __ATOMIC_RELEASE);
+    }
+    set = __atomic_load_n(&af->set, __ATOMIC_SEQ_CST);
+    if (!set)
+    {
+        __atomic_fetch_sub(&af->readers[e], 1, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&af->stats.checked, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    if (!maybe_key(set, key))
+        __atomic_fetch_add(&af->stats.bloom_rejects, 1, __ATOMIC_RELAXED);
+    else if (!(listed = contains_key(set, key)))
+        __atomic_fetch_add(&af->stats.false_positives, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&af->readers[e], 1, __ATOMIC_RELEASE);
+
+    pass = af->mode == bglib_addrfilter_allow ? listed : !listed;
+    __atomic_fetch_add(&af->stats.checked, 1, __ATOMIC_RELAXED);
+    if (listed)
+        __atomic_fetch_add(&af->stats.listed, 1, __ATOMIC_RELAXED);
+    if (!pass)
+        __atomic_fetch_add(&af->stats.dropped, 1, __ATOMIC_RELAXED);
+    return pass;
+}
+
+void bglib_addrfilter_get_stats(const struct bglib_addrfilter *af, struct bglib_addrfilter_stats *out)
+{
+    out->checked = __atomic_load_n(&af->stats.checked, __ATOMIC_RELAXED);
+    out->bloom_rejects = __atomic_load_n(&af->stats.bloom_rejects, __ATOMIC_RELAXED);
+    out->false_positives = __atomic_load_n(&af->stats.false_positives, __ATOMIC_RELAXED);
+    out->listed = __atomic_load_n(&af->stats.listed, __ATOMIC_RELAXED);
+    out->dropped = __atomic_load_n(&af->stats.dropped, __ATOMIC_RELAXED);
+}
+
+int bglib_addrfilter_dispatch(void *af, const struct ble_msg *msg, const struct ble_header *hdr,
+                              const uint8 *payload)
+{
+    /* sender follows rssi and packet_type */
+    if (bglib_msg_index(msg) != ble_evt_gap_scan_response_idx || bglib_payload_len(hdr) < 2 + sizeof(bd_addr))
+        return 1;
+    return bglib_addrfilter_check(af, (const bd_addr *)(payload + 2));
+}
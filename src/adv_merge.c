@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "adv_merge.h"
+#include "gap_ad.h"
+#include "hash.h"
+
+#define USED             ((uint64_t)1 << 63)
+#define DEFAULT_PENDING  256
+#define DEFAULT_WINDOW   50000000ull
+
+struct pending
+{
+    uint64_t key;
+    uint32_t seq;
+    struct bglib_adv_record rec;
+};
+
+struct fifo_entry
+{
+    uint64_t key;
+    uint32_t seq;
+};
+
+struct bglib_adv_merge
+{
+    struct pending *slots;
+    unsigned mask;
+    unsigned capacity;
+    unsigned count;
+    uint32_t seq;
+
+    /* insertion order, entries of already merged slots are skipped */
+    struct fifo_entry *fifo;
+    unsigned fifo_mask;
+    unsigned head;
+    unsigned tail;
+
+    uint64_t window_ns;
+    bglib_adv_merge_cb cb;
+    void *user;
+
+    struct bglib_adv_merge_stats stats;
+};
+
+struct bglib_adv_merge *bglib_adv_merge_create(unsigned capacity, uint64_t window_ns,
+                                               bglib_adv_merge_cb cb, void *user)
+{
+    struct bglib_adv_merge *m = calloc(1, sizeof(*m));
+    unsigned slots = 16;
+
+    if (!m)
+        return NULL;
+    m->capacity = capacity ? capacity : DEFAULT_PENDING;
+    m->window_ns = window_ns ? window_ns : DEFAULT_WINDOW;
+    m->cb = cb;
+    m->user = user;
+
+    while (slots - slots / 4 < m->capacity)
+        slots <<= 1;
+    m->mask = slots - 1;
+    m->fifo_mask = 2 * slots - 1;
+
+    m->slots = calloc(slots, sizeof(*m->slots));
+    m->fifo = malloc(2 * slots * sizeof(*m->fifo));
+    if (!m->slots || !m->fifo)
+    {
+        bglib_adv_merge_destroy(m);
+        return NULL;
+    }
+    return m;
+}
+
+void bglib_adv_merge_destroy(struct bglib_adv_merge *m)
+{
+    if (!m)
+        return;
+    free(m->slots);
+    free(m->fifo);
+    free(m);
+}
+
+static unsigned home(const struct bglib_adv_merge *m, uint64_t key)
+{
+    return bglib_mix64(key) & m->mask;
+}
+
+static unsigned probe(const struct bglib_adv_merge *m, uint64_t key)
+{
+    unsigned i = home(m, key);
+
+    while (m->slots[i].key && m->slots[i].key != key)
+        i = (i + 1) & m->mask;
+    return i;
+}
+
+static void delete_slot(struct bglib_adv_merge *m, unsigned i)
+{
+    unsigned j = i;
+    unsigned k;
+
+    m->count--;
+    for (;;)
+    {
+        j = (j + 1) & m->mask;
+        if (!m->slots[j].key)
+            break;
+        k = home(m, m->slots[j].key);
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        m->slots[i] = m->slots[j];
+        i = j;
+    }
+    m->slots[i].key = 0;
+}
+
+/* the slot is released before the callback, which may feed the merger again */
+static void emit_slot(struct bglib_adv_merge *m, unsigned i, uint8 flags)
+{
+    struct bglib_adv_record rec = m->slots[i].rec;
+
+    rec.flags |= flags;
+    delete_slot(m, i);
+    if (flags & BGLIB_ADV_EXPIRED)
+        m->stats.expired++;
+    if (flags & BGLIB_ADV_FORCED)
+        m->stats.forced++;
+    if (m->cb)
+        m->cb(m->user, &rec);
+}
+
+/* returns 1 if the head held a live advertisement */
+static int pop_head(struct bglib_adv_merge *m, uint8 flags)
+{
+    struct fifo_entry *e = &m->fifo[m->head & m->fifo_mask];
+    unsigned i = probe(m, e->key);
+
+    m->head++;
+    if (!m->slots[i].key || m->slots[i].seq != e->seq)
+        return 0;
+    emit_slot(m, i, flags);
+    return 1;
+}
+
+unsigned bglib_adv_merge_poll(struct bglib_adv_merge *m, uint64_t now_ns)
+{
+    unsigned n = 0;
+
+    while (m->head != m->tail)
+    {
+        struct fifo_entry *e = &m->fifo[m->head & m->fifo_mask];
+        unsigned i = probe(m, e->key);
+
+        if (m->slots[i].key && m->slots[i].seq == e->seq &&
+            m->slots[i].rec.adv_ns + m->window_ns > now_ns)
+            break;
+        n += pop_head(m, BGLIB_ADV_EXPIRED);
+    }
+    return n;
+}
+
+unsigned bglib_adv_merge_flush(struct bglib_adv_merge *m)
+{
+    unsigned n = 0;
+
+    while (m->head != m->tail)
+        n += pop_head(m, BGLIB_ADV_EXPIRED);
+    return n;
+}
+
+static void fill(struct bglib_adv_record *rec, const struct ble_msg_gap_scan_response_evt_t *msg)
+{
+    rec->sender = msg->sender;
+    rec->address_type = msg->address_type;
+    rec->bond = msg->bond;
+}
+
+static uint8 copy_data(uint8 *dst, const struct ble_msg_gap_scan_response_evt_t *msg, unsigned payload_len)
+{
+    const uint8 *data;
+    unsigned len = gap_ad_scan_data(msg, payload_len, &data);
+
+    if (len > BGLIB_ADV_DATA_MAX)
+        len = BGLIB_ADV_DATA_MAX;
+    memcpy(dst, data, len);
+    return len;
+}
+
+void bglib_adv_merge_update(struct bglib_adv_merge *m, const struct ble_msg_gap_scan_response_evt_t *msg,
+                            unsigned payload_len, uint64_t now_ns)
+{
+    uint64_t key = bglib_addr_key(&msg->sender, msg->address_type) | USED;
+    struct bglib_adv_record rec;
+    struct pending *p;
+    unsigned i;
+
+    bglib_adv_merge_poll(m, now_ns);
+    i = probe(m, key);
+
+    if (msg->packet_type == 4)
+    {
+        m->stats.scan_responses++;
+        if (m->slots[i].key)
+        {
+            p = &m->slots[i];
+            p->rec.scan_rssi = msg->rssi;
+            p->rec.rsp_ns = now_ns;
+            p->rec.rsp_len = copy_data(p->rec.rsp, msg, payload_len);
+            m->stats.merged++;
+            emit_slot(m, i, BGLIB_ADV_HAS_SCAN_RSP);
+            return;
+        }
+
+        memset(&rec, 0, sizeof(rec));
+        fill(&rec, msg);
+        rec.packet_type = msg->packet_type;
+        rec.flags = BGLIB_ADV_HAS_SCAN_RSP;
+        rec.scan_rssi = msg->rssi;
+        rec.rsp_ns = now_ns;
+        rec.rsp_len = copy_data(rec.rsp, msg, payload_len);
+        m->stats.orphans++;
+        if (m->cb)
+            m->cb(m->user, &rec);
+        return;
+    }
+
+    m->stats.advertisements++;
+
+    /* a new advertising event closes the previous one of the same sender */
+    if (m->slots[i].key)
+        emit_slot(m, i, BGLIB_ADV_EXPIRED);
+
+    memset(&rec, 0, sizeof(rec));
+    fill(&rec, msg);
+    rec.packet_type = msg->packet_type;
+    rec.flags = BGLIB_ADV_HAS_ADV;
+    rec.rssi = msg->rssi;
+    rec.adv_ns = now_ns;
+    rec.adv_len = copy_data(rec.adv, msg, payload_len);
+
+    /* non-connectable advertisements are not followed by a scan response */
+    if (msg->packet_type == 2)
+    {
+        if (m->cb)
+            m->cb(m->user, &rec);
+        return;
+    }
+
+    while (m->count == m->capacity || m->tail - m->head > m->fifo_mask)
+        pop_head(m, BGLIB_ADV_FORCED);
+
+    i = probe(m, key);
+    p = &m->slots[i];
+    p->key = key;
+    p->seq = ++m->seq;
+    p->rec = rec;
+    m->count++;
+
+    m->fifo[m->tail & m->fifo_mask].key = key;
+    m->fifo[m->tail & m->fifo_mask].seq = p->seq;
+    m->tail++;
+}
+
+void bglib_adv_merge_get_stats(const struct bglib_adv_merge *m, struct bglib_adv_merge_stats *out)
+{
+    *out = m->stats;
+    out->pending = m->count;
+}
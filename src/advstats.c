@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "advstats.h"
+#include "seqlock.h"
+
+#define DEFAULT_WINDOW  10000000000ull
+
+/* packet counts of the last BGLIB_ADVSTATS_SLOTS sub-windows */
+struct window
+{
+    uint64_t epoch;             /* sub-window of counts[epoch % SLOTS] */
+    uint32_t counts[BGLIB_ADVSTATS_SLOTS];
+};
+
+struct entry
+{
+    uint32_t seq;
+    uint64_t key;               /* 0 if unused */
+    uint64_t packets;
+    uint32_t types[bglib_dev_packet_last];
+    int8 rssi_min;
+    int8 rssi_max;
+    double mean;                /* Welford */
+    double m2;
+    uint64_t first_ns;
+    uint64_t last_ns;
+    uint64_t interval_ns;       /* previous inter-arrival time */
+    int64_t jitter_ns;
+    struct window w;
+} __attribute__((aligned(64)));
+
+struct bglib_advstats
+{
+    struct entry *entries;
+    unsigned capacity;
+    uint64_t slot_ns;
+
+    uint32_t seq;               /* guards first_ns and w */
+    uint64_t first_ns;
+    struct window w;
+    uint64_t packets;
+    uint64_t types[bglib_dev_packet_last];
+    uint64_t rssi[BGLIB_ADVSTATS_RSSI_BINS];
+    struct bglib_histogram interval_us;
+};
+
+static void window_add(struct window *w, uint64_t slot_ns, uint64_t now_ns)
+{
+    uint64_t e = now_ns / slot_ns;
+
+    if (e > w->epoch)
+    {
+        if (e - w->epoch >= BGLIB_ADVSTATS_SLOTS)
+            memset(w->counts, 0, sizeof(w->counts));
+        else
+            while (w->epoch < e)
+                w->counts[++w->epoch % BGLIB_ADVSTATS_SLOTS] = 0;
+        w->epoch = e;
+    }
+    w->counts[w->epoch % BGLIB_ADVSTATS_SLOTS]++;
+}
+
+static double window_rate(const struct window *w, uint64_t slot_ns, uint64_t first_ns, uint64_t now_ns)
+{
+    uint64_t e = now_ns / slot_ns;
+    uint64_t span;
+    uint64_t sum = 0;
+    unsigned age;
+    unsigned i;
+
+    if (e < w->epoch)
+        e = w->epoch;
+    if (e - w->epoch >= BGLIB_ADVSTATS_SLOTS || now_ns <= first_ns)
+        return 0;
+    age = (unsigned)(e - w->epoch);
+    for (i = 0; i + age < BGLIB_ADVSTATS_SLOTS; i++)
+        sum += w->counts[(w->epoch - i) % BGLIB_ADVSTATS_SLOTS];
+
+    /* the current sub-window is partial, a young device has not filled the window */
+    span = (BGLIB_ADVSTATS_SLOTS - 1) * slot_ns + now_ns % slot_ns;
+    if (span > now_ns - first_ns)
+        span = now_ns - first_ns;
+    return span ? sum * 1e9 / span : 0;
+}
+
+struct bglib_advstats *bglib_advstats_create(unsigned capacity, uint64_t window_ns)
+{
+    struct bglib_advstats *st;
+
+    if (!capacity)
+        return NULL;
+    st = calloc(1, sizeof(*st));
+    if (!st)
+        return NULL;
+    st->capacity = capacity;
+    st->slot_ns = (window_ns ? window_ns : DEFAULT_WINDOW) / BGLIB_ADVSTATS_SLOTS;
+    if (!st->slot_ns)
+        st->slot_ns = 1;
+    st->entries = aligned_alloc(64, st->capacity * sizeof(*st->entries));
+    if (!st->entries)
+    {
+        free(st);
+        return NULL;
+    }
+    memset(st->entries, 0, st->capacity * sizeof(*st->entries));
+    bglib_histogram_reset(&st->interval_us);
+    return st;
+}
+
+void bglib_advstats_destroy(struct bglib_advstats *st)
+{
+    if (!st)
+        return;
+    free(st->entries);
+    free(st);
+}
+
+void bglib_advstats_update(struct bglib_advstats *st, const struct bglib_device *dev,
+                           const struct ble_msg_gap_scan_response_evt_t *msg, uint64_t now_ns)
+{
+    unsigned kind = (msg->packet_type >> 1) & 3;
+    unsigned bin = msg->rssi < 0 ? -msg->rssi : 0;
+    struct entry *e;
+    double delta;
+    int8 rssi = msg->rssi;
+
+    if (dev->id >= st->capacity)
+        return;
+    if (bin >= BGLIB_ADVSTATS_RSSI_BINS)
+        bin = BGLIB_ADVSTATS_RSSI_BINS - 1;
+    e = &st->entries[dev->id];
+
+    bglib_seq_write_begin(&e->seq);
+    if (e->key != dev->key)
+    {
+        /* id reused without bglib_advstats_forget() */
+        memset((char *)e + sizeof(e->seq), 0, sizeof(*e) - sizeof(e->seq));
+        e->key = dev->key;
+    }
+    if (!e->packets)
+    {
+        e->first_ns = now_ns;
+        e->rssi_min = e->rssi_max = rssi;
+    }
+    else if (now_ns >= e->last_ns)
+    {
+        uint64_t interval = now_ns - e->last_ns;
+        int64_t d = (int64_t)(interval - e->interval_ns);
+
+        if (e->packets > 1)
+            e->jitter_ns += ((d < 0 ? -d : d) - e->jitter_ns) / 16;
+        e->interval_ns = interval;
+        bglib_histogram_record(&st->interval_us, interval / 1000);
+    }
+    if (rssi < e->rssi_min)
+        e->rssi_min = rssi;
+    if (rssi > e->rssi_max)
+        e->rssi_max = rssi;
+    e->packets++;
+    e->types[kind]++;
+    delta = rssi - e->mean;
+    e->mean += delta / e->packets;
+    e->m2 += delta * (rssi - e->mean);
+    e->last_ns = now_ns;
+    window_add(&e->w, st->slot_ns, now_ns);
+    bglib_seq_write_end(&e->seq);
+
+    bglib_seq_write_begin(&st->seq);
+    if (!st->first_ns)
+        st->first_ns = now_ns;
+    window_add(&st->w, st->slot_ns, now_ns);
+    bglib_seq_write_end(&st->seq);
+
+    __atomic_fetch_add(&st->packets, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->types[kind], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->rssi[bin], 1, __ATOMIC_RELAXED);
+}
+
+void bglib_advstats_forget(struct bglib_advstats *st, const struct bglib_device *dev)
+{
+    struct entry *e;
+
+    if (dev->id >= st->capacity)
+        return;
+    e = &st->entries[dev->id];
+    bglib_seq_write_begin(&e->seq);
+    memset((char *)e + sizeof(e->seq), 0, sizeof(*e) - sizeof(e->seq));
+    bglib_seq_write_end(&e->seq);
+}
+
+int bglib_advstats_device(const struct bglib_advstats *st, uint32_t id, uint64_t now_ns,
+                          struct bglib_adv_device_stats *out)
+{
+    struct entry e;
+    uint32_t s;
+
+    if (id >= st->capacity)
+        return 0;
+    do
+    {
+        s = bglib_seq_read_begin(&st->entries[id].seq);
+        memcpy(&e, &st->entries[id], sizeof(e));
+    } while (bglib_seq_read_retry(&st->entries[id].seq, s));
+
+    memset(out, 0, sizeof(*out));
+    if (!e.key)
+        return 0;
+    out->key = e.key;
+    out->packets = e.packets;
+    memcpy(out->types, e.types, sizeof(out->types));
+    out->pps = window_rate(&e.w, st->slot_ns, e.first_ns, now_ns);
+    out->rssi_min = e.rssi_min;
+    out->rssi_max = e.rssi_max;
+    out->rssi_mean = e.mean;
+    out->rssi_var = e.packets > 1 ? e.m2 / (e.packets - 1) : 0;
+    out->interval_ns = e.packets > 1 ? (e.last_ns - e.first_ns) / (e.packets - 1) : 0;
+    out->jitter_ns = e.jitter_ns;
+    out->last_ns = e.last_ns;
+    return 1;
+}
+
+void bglib_advstats_gateway(const struct bglib_advstats *st, uint64_t now_ns, struct bglib_adv_gateway_stats *out)
+{
+    struct window w;
+    uint64_t first;
+    uint32_t s;
+    int i;
+
+    do
+    {
+        s = bglib_seq_read_begin(&st->seq);
+        first = st->first_ns;
+        w = st->w;
+    } while (bglib_seq_read_retry(&st->seq, s));
+
+    out->pps = first ? window_rate(&w, st->slot_ns, first, now_ns) : 0;
+    out->packets = __atomic_load_n(&st->packets, __ATOMIC_RELAXED);
+    for (i = 0; i < bglib_dev_packet_last; i++)
+        out->types[i] = __atomic_load_n(&st->types[i], __ATOMIC_RELAXED);
+    for (i = 0; i < BGLIB_ADVSTATS_RSSI_BINS; i++)
+        out->rssi[i] = __atomic_load_n(&st->rssi[i], __ATOMIC_RELAXED);
+    bglib_histogram_snapshot(&st->interval_us, &out->interval_us);
+}
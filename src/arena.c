@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "dispatch.h"
+
+#define DEFAULT_CHUNK (64 * 1024)
+#define ALIGN(n)      (((n) + 7) & ~(size_t)7)
+
+struct arena_chunk
+{
+    struct arena_chunk *prev;
+    size_t size;
+    size_t used;
+    uint8 data[] __attribute__((aligned(8)));
+};
+
+struct bglib_arena
+{
+    size_t chunk_size;
+    struct arena_chunk *current;
+    struct arena_chunk *cache;
+    size_t chunks;
+    size_t cached;
+    size_t in_use;
+    uint64_t mallocs;
+};
+
+static BGLIB_THREAD_LOCAL struct bglib_arena *current_arena;
+
+struct bglib_arena *bglib_arena_create(size_t chunk_size)
+{
+    struct bglib_arena *arena = calloc(1, sizeof(*arena));
+
+    if (!arena)
+        return NULL;
+    arena->chunk_size = chunk_size ? ALIGN(chunk_size) : DEFAULT_CHUNK;
+    return arena;
+}
+
+static void free_chain(struct arena_chunk *c)
+{
+    while (c)
+    {
+        struct arena_chunk *prev = c->prev;
+        free(c);
+        c = prev;
+    }
+}
+
+void bglib_arena_destroy(struct bglib_arena *arena)
+{
+    if (!arena)
+        return;
+    if (current_arena == arena)
+        current_arena = NULL;
+    free_chain(arena->current);
+    free_chain(arena->cache);
+    free(arena);
+}
+
+static struct arena_chunk *new_chunk(struct bglib_arena *arena, size_t size)
+{
+    struct arena_chunk *c;
+
+    if (size <= arena->chunk_size && arena->cache)
+    {
+        c = arena->cache;
+        arena->cache = c->prev;
+        arena->cached--;
+    }
+    else
+    {
+        if (size < arena->chunk_size)
+            size = arena->chunk_size;
+        c = malloc(sizeof(*c) + size);
+        if (!c)
+            return NULL;
+        c->size = size;
+        arena->mallocs++;
+    }
+
+    c->used = 0;
+    c->prev = arena->current;
+    arena->current = c;
+    arena->chunks++;
+    return c;
+}
+
+void *bglib_arena_alloc(struct bglib_arena *arena, size_t size)
+{
+    struct arena_chunk *c = arena->current;
+    void *p;
+
+    size = ALIGN(size);
+    if (!c || c->size - c->used < size)
+    {
+        c = new_chunk(arena, size);
+        if (!c)
+            return NULL;
+    }
+
+    p = c->data + c->used;
+    c->used += size;
+    arena->in_use += size;
+    return p;
+}
+
+struct bglib_arena_mark bglib_arena_mark(const struct bglib_arena *arena)
+{
+    struct bglib_arena_mark mark;
+
+    mark.chunk = arena->current;
+    mark.used = arena->current ? arena->current->used : 0;
+    return mark;
+}
+
+void bglib_arena_rewind(struct bglib_arena *arena, struct bglib_arena_mark mark)
+{
+    while (arena->current && arena->current != mark.chunk)
+    {
+        struct arena_chunk *c = arena->current;
+
+        arena->current = c->prev;
+        arena->chunks--;
+        arena->in_use -= c->used;
+
+        /* oversized chunks go back to the heap, regular ones to the cache */
+        if (c->size == arena->chunk_size)
+        {
+            c->prev = arena->cache;
+            arena->cache = c;
+            arena->cached++;
+        }
+        else
+            free(c);
+    }
+
+    if (arena->current)
+    {
+        arena->in_use -= arena->current->used - mark.used;
+        arena->current->used = mark.used;
+    }
+}
+
+void bglib_arena_reset(struct bglib_arena *arena)
+{
+    struct bglib_arena_mark empty = { NULL, 0 };
+
+    bglib_arena_rewind(arena, empty);
+}
+
+void bglib_arena_get_stats(const struct bglib_arena *arena, struct bglib_arena_stats *out)
+{
+    out->in_use = arena->in_use;
+    out->chunks = arena->chunks;
+    out->cached = arena->cached;
+    out->mallocs = arena->mallocs;
+}
+
+const void *bglib_arena_retain(struct bglib_arena *arena, const struct ble_header *hdr, const void *payload)
+{
+    uint16 len = bglib_payload_len(hdr);
+    uint8 *p;
+
+    /* header goes right before the payload, see bglib_retained_header() */
+    p = bglib_arena_alloc(arena, 8 + len);
+    if (!p)
+        return NULL;
+    memcpy(p + 8 - sizeof(*hdr), hdr, sizeof(*hdr));
+    memcpy(p + 8, payload, len);
+    return p + 8;
+}
+
+void bglib_arena_set_current(struct bglib_arena *arena)
+{
+    current_arena = arena;
+}
+
+struct bglib_arena *bglib_arena_current(void)
+{
+    return current_arena;
+}
+
+const void *bglib_retain(const void *evt)
+{
+    const struct ble_header *hdr;
+    const uint8 *payload;
+
+    if (!current_arena || !bglib_dispatch_current(&hdr, &payload) || payload != evt)
+        return NULL;
+    return bglib_arena_retain(current_arena, hdr, payload);
+}
+
+struct bglib_frame_slab
+{
+    struct bglib_frame *frames;
+    struct bglib_frame **free;
+    unsigned nfree;
+};
+
+struct bglib_frame_slab *bglib_frame_slab_create(unsigned frames)
+{
+    struct bglib_frame_slab *slab = calloc(1, sizeof(*slab));
+    unsigned i;
+
+    if (!slab)
+        return NULL;
+    slab->frames = malloc(frames * sizeof(*slab->frames));
+    slab->free = malloc(frames * sizeof(*slab->free));
+    if (!slab->frames || !slab->free)
+    {
+        bglib_frame_slab_destroy(slab);
+        return NULL;
+    }
+    for (i = 0; i < frames; i++)
+        slab->free[i] = &slab->frames[frames - 1 - i];
+    slab->nfree = frames;
+    return slab;
+}
+
+void bglib_frame_slab_destroy(struct bglib_frame_slab *slab)
+{
+    if (!slab)
+        return;
+    free(slab->frames);
+    free(slab->free);
+    free(slab);
+}
+
+struct bglib_frame *bglib_frame_slab_get(struct bglib_frame_slab *slab)
+{
+    return slab->nfree ? slab->free[--slab->nfree] : NULL;
+}
+
+void bglib_frame_slab_put(struct bglib_frame_slab *slab, struct bglib_frame *frame)
+{
+    slab->free[slab->nfree++] = frame;
+}
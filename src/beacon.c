@@ -0,0 +1,398 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "beacon.h"
+#include "gap_ad.h"
+#include "hash.h"
+
+#define SLOTS       64          /* power of two, more than twice BGLIB_BEACON_DECODERS_MAX */
+#define ANY         0x1000000u
+#define END         0xff
+#define HIT_ANY     0x80        /* bglib_beacon_hits.decoder flag */
+
+struct decoder
+{
+    bglib_beacon_decoder fn;
+    void *user;
+    uint8 next;
+};
+
+struct slot
+{
+    uint32_t key;               /* 0 is free: ad_type << 16 | id + 1, or ANY | ad_type << 16 */
+    uint8 head;
+};
+
+struct bglib_beacon_registry
+{
+    struct bglib_beacon_callbacks cb;
+    struct decoder decoders[BGLIB_BEACON_DECODERS_MAX];
+    unsigned count;
+    struct slot slots[SLOTS];
+    uint32_t keyed[8];          /* AD types with identifier-keyed decoders */
+    uint32_t any[8];            /* AD types with BGLIB_BEACON_ANY_ID decoders */
+};
+
+static uint16 be16(const uint8 *p)
+{
+    return (uint16)p[0] << 8 | p[1];
+}
+
+static uint32_t be32(const uint8 *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint32_t make_key(uint8 ad_type, int id)
+{
+    if (id < 0)
+        return ANY | (uint32_t)ad_type << 16;
+    return ((uint32_t)ad_type << 16 | (uint16)id) + 1;
+}
+
+static struct slot *find_slot(struct bglib_beacon_registry *reg, uint32_t key)
+{
+    unsigned i = (unsigned)bglib_mix64(key) & (SLOTS - 1);
+
+    while (reg->slots[i].key && reg->slots[i].key != key)
+        i = (i + 1) & (SLOTS - 1);
+    return &reg->slots[i];
+}
+
+static void record_hit(struct bglib_beacon_hits *hits, uint8 ad, uint8 decoder)
+{
+    if (!hits)
+        return;
+    if (hits->count < BGLIB_BEACON_HITS_MAX)
+    {
+        hits->ad[hits->count] = ad;
+        hits->decoder[hits->count] = decoder;
+    }
+    if (hits->count <= BGLIB_BEACON_HITS_MAX)
+        hits->count++;
+}
+
+/* hit_any marks decoders reached through a BGLIB_BEACON_ANY_ID key */
+static unsigned run_chain(struct bglib_beacon_registry *reg, const struct slot *s,
+                          const struct ble_msg_gap_scan_response_evt_t *msg, uint16 id,
+                          const uint8 *data, uint8 len, struct bglib_beacon_hits *hits, uint8 ad, uint8 hit_any)
+{
+    unsigned n = 0;
+    uint8 i;
+
+    if (!s->key)
+        return 0;
+    for (i = s->head; i != END; i = reg->decoders[i].next)
+    {
+        if (reg->decoders[i].fn(reg->decoders[i].user, msg, id, data, len) > 0)
+        {
+            record_hit(hits, ad, i | hit_any);
+            n++;
+        }
+    }
+    return n;
+}
+
+static int decode_ibeacon(void *user, const struct ble_msg_gap_scan_response_evt_t *msg, uint16 id,
+                          const uint8 *data, uint8 len)
+{
+    struct bglib_beacon_registry *reg = user;
+    struct bglib_ibeacon b;
+
+    if (len < 23 || data[0] != 0x02 || data[1] != 0x15)
+        return 0;
+    b.uuid = data + 2;
+    b.major = be16(data + 18);
+    b.minor = be16(data + 20);
+    b.tx_power = (int8)data[22];
+    reg->cb.ibeacon(reg->cb.user, msg, &b);
+    return 1;
+}
+
+static int decode_altbeacon(void *user, const struct ble_msg_gap_scan_response_evt_t *msg, uint16 id,
+                            const uint8 *data, uint8 len)
+{
+    struct bglib_beacon_registry *reg = user;
+    struct bglib_altbeacon b;
+
+    /* any company ID, recognised by the beacon code */
+    if (len < 26 || data[2] != 0xbe || data[3] != 0xac)
+        return 0;
+    b.company = data[0] | (uint16)data[1] << 8;
+    b.id = data + 4;
+    b.ref_rssi = (int8)data[24];
+    b.reserved = data[25];
+    reg->cb.altbeacon(reg->cb.user, msg, &b);
+    return 1;
+}
+
+static int decode_eddystone(void *user, const struct ble_msg_gap_scan_response_evt_t *msg, uint16 id,
+                            const uint8 *data, uint8 len)
+{
+    struct bglib_beacon_registry *reg = user;
+    const struct bglib_beacon_callbacks *cb = &reg->cb;
+
+    if (len < 1)
+        return 0;
+    switch (data[0])
+    {
+        case 0x00:
+        {
+            struct bglib_eddystone_uid b;
+
+            if (!cb->eddystone_uid || len < 18)
+                return 0;
+            b.tx_power = (int8)data[1];
+            b.namespace_id = data + 2;
+            b.instance = data + 12;
+            cb->eddystone_uid(cb->user, msg, &b);
+            return 1;
+        }
+        case 0x10:
+        {
+            struct bglib_eddystone_url b;
+
+            if (!cb->eddystone_url || len < 3)
+                return 0;
+            b.tx_power = (int8)data[1];
+            b.scheme = data[2];
+            b.url = data + 3;
+            b.url_len = len - 3;
+            cb->eddystone_url(cb->user, msg, &b);
+            return 1;
+        }
+        case 0x20:
+        {
+            struct bglib_eddystone_tlm b;
+
+            if (!cb->eddystone_tlm || len < 2)
+                return 0;
+            memset(&b, 0, sizeof(b));
+            b.version = data[1];
+            if (b.version == 0)
+            {
+                if (len < 14)
+                    return 0;
+                b.battery_mv = be16(data + 2);
+                b.temperature = (int16)be16(data + 4);
+                b.adv_count = be32(data + 6);
+                b.uptime = be32(data + 10);
+            }
+            else
+            {
+                b.temperature = -32768;
+                b.etlm = data + 2;
+                b.etlm_len = len - 2;
+            }
+            cb->eddystone_tlm(cb->user, msg, &b);
+            return 1;
+        }
+        case 0x30:
+        {
+            struct bglib_eddystone_eid b;
+
+            if (!cb->eddystone_eid || len < 10)
+                return 0;
+            b.tx_power = (int8)data[1];
+            b.eid = data + 2;
+            cb->eddystone_eid(cb->user, msg, &b);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+struct bglib_beacon_registry *bglib_beacon_create(const struct bglib_beacon_callbacks *cb)
+{
+    struct bglib_beacon_registry *reg = calloc(1, sizeof(*reg));
+
+    if (!reg)
+        return NULL;
+    if (!cb)
+        return reg;
+
+    reg->cb = *cb;
+    if (cb->ibeacon)
+        bglib_beacon_register(reg, gap_ad_type_manufacturer_data, BGLIB_COMPANY_APPLE, decode_ibeacon, reg);
+    if (cb->altbeacon)
+        bglib_beacon_register(reg, gap_ad_type_manufacturer_data, BGLIB_BEACON_ANY_ID, decode_altbeacon, reg);
+    if (cb->eddystone_uid || cb->eddystone_url || cb->eddystone_tlm || cb->eddystone_eid)
+        bglib_beacon_register(reg, gap_ad_type_service_data_16bit, BGLIB_UUID_EDDYSTONE, decode_eddystone, reg);
+    return reg;
+}
+
+void bglib_beacon_destroy(struct bglib_beacon_registry *reg)
+{
+    free(reg);
+}
+
+int bglib_beacon_register(struct bglib_beacon_registry *reg, uint8 ad_type, int id,
+                          bglib_beacon_decoder fn, void *user)
+{
+    struct slot *s = find_slot(reg, make_key(ad_type, id));
+    struct decoder *d;
+    uint8 i;
+
+    if (reg->count == BGLIB_BEACON_DECODERS_MAX)
+        return -1;
+
+    d = &reg->decoders[reg->count];
+    d->fn = fn;
+    d->user = user;
+    d->next = END;
+
+    /* append, decoders of one key run in registration order */
+    if (!s->key)
+    {
+        s->key = make_key(ad_type, id);
+        s->head = reg->count;
+    }
+    else
+    {
+        for (i = s->head; reg->decoders[i].next != END; i = reg->decoders[i].next)
+            ;
+        reg->decoders[i].next = reg->count;
+    }
+    reg->count++;
+
+    if (id < 0)
+        reg->any[ad_type >> 5] |= (uint32_t)1 << (ad_type & 31);
+    else
+        reg->keyed[ad_type >> 5] |= (uint32_t)1 << (ad_type & 31);
+    return 0;
+}
+
+static unsigned process_ad(struct bglib_beacon_registry *reg, const struct ble_msg_gap_scan_response_evt_t *msg,
+                           const struct gap_ad *ad, struct bglib_beacon_hits *hits, uint8 index)
+{
+    uint32_t bit = (uint32_t)1 << (ad->type & 31);
+    unsigned n = 0;
+
+    if ((reg->keyed[ad->type >> 5] & bit) && ad->len >= 2)
+    {
+        uint16 id = ad->data[0] | (uint16)ad->data[1] << 8;
+
+        n += run_chain(reg, find_slot(reg, make_key(ad->type, id)), msg, id, ad->data + 2, ad->len - 2,
+                       hits, index, 0);
+    }
+    if (reg->any[ad->type >> 5] & bit)
+        n += run_chain(reg, find_slot(reg, make_key(ad->type, BGLIB_BEACON_ANY_ID)), msg,
+                       ad->len >= 2 ? ad->data[0] | (uint16)ad->data[1] << 8 : 0, ad->data, ad->len,
+                       hits, index, HIT_ANY);
+    return n;
+}
+
+unsigned bglib_beacon_process(struct bglib_beacon_registry *reg, const struct ble_msg_gap_scan_response_evt_t *msg,
+                              unsigned payload_len)
+{
+    struct gap_ad_iter it;
+    struct gap_ad ad;
+    const uint8 *data;
+    unsigned len = gap_ad_scan_data(msg, payload_len, &data);
+    unsigned n = 0;
+
+    gap_ad_iter_init(&it, data, len);
+    while (gap_ad_iter_next(&it, &ad) > 0)
+        n += process_ad(reg, msg, &ad, NULL, 0);
+    return n;
+}
+
+static void ad_at(const uint8 *data, const struct gap_ad_index *idx, unsigned i, struct gap_ad *ad)
+{
+    const uint8 *p = data + idx->offset[i];
+
+    ad->type = p[1];
+    ad->len = p[0] - 1;
+    ad->data = p + 2;
+}
+
+unsigned bglib_beacon_process_hits(struct bglib_beacon_registry *reg,
+                                   const struct ble_msg_gap_scan_response_evt_t *msg, const uint8 *data,
+                                   const struct gap_ad_index *idx, struct bglib_beacon_hits *hits)
+{
+    uint32_t wanted = 0;
+    unsigned n = 0;
+    unsigned i;
+
+    if (hits)
+        hits->count = 0;
+    for (i = 0; i < 8; i++)
+        wanted |= (reg->keyed[i] | reg->any[i]) & idx->present[i];
+    if (!wanted)
+        return 0;
+
+    for (i = 0; i < idx->count; i++)
+    {
+        struct gap_ad ad;
+
+        ad_at(data, idx, i, &ad);
+        n += process_ad(reg, msg, &ad, hits, i);
+    }
+    return n;
+}
+
+unsigned bglib_beacon_process_index(struct bglib_beacon_registry *reg,
+                                    const struct ble_msg_gap_scan_response_evt_t *msg, const uint8 *data,
+                                    const struct gap_ad_index *idx)
+{
+    return bglib_beacon_process_hits(reg, msg, data, idx, NULL);
+}
+
+unsigned bglib_beacon_replay(struct bglib_beacon_registry *reg, const struct ble_msg_gap_scan_response_evt_t *msg,
+                             const uint8 *data, const struct gap_ad_index *idx, const struct bglib_beacon_hits *hits)
+{
+    unsigned n = 0;
+    unsigned i;
+
+    for (i = 0; i < hits->count && i < BGLIB_BEACON_HITS_MAX; i++)
+    {
+        const struct decoder *d = &reg->decoders[hits->decoder[i] & ~HIT_ANY];
+        struct gap_ad ad;
+        uint16 id;
+
+        ad_at(data, idx, hits->ad[i], &ad);
+        id = ad.len >= 2 ? ad.data[0] | (uint16)ad.data[1] << 8 : 0;
+        if (hits->decoder[i] & HIT_ANY)
+            n += d->fn(d->user, msg, id, ad.data, ad.len) > 0;
+        else
+            n += d->fn(d->user, msg, id, ad.data + 2, ad.len - 2) > 0;
+    }
+    return n;
+}
+
+static void append(char *buf, unsigned size, unsigned *n, const char *s)
+{
+    for (; *s; s++, ++*n)
+    {
+        if (*n + 1 < size)
+            buf[*n] = *s;
+    }
+}
+
+unsigned bglib_eddystone_url_expand(const struct bglib_eddystone_url *url, char *buf, unsigned size)
+{
+    static const char *const schemes[] = { "http://www.", "https://www.", "http://", "https://" };
+    static const char *const codes[] =
+    {
+        ".com/", ".org/", ".edu/", ".net/", ".info/", ".biz/", ".gov/",
+        ".com", ".org", ".edu", ".net", ".info", ".biz", ".gov"
+    };
+    unsigned n = 0;
+    unsigned i;
+
+    if (url->scheme < 4)
+        append(buf, size, &n, schemes[url->scheme]);
+    for (i = 0; i < url->url_len; i++)
+    {
+        uint8 c = url->url[i];
+        char one[2] = { (char)c, 0 };
+
+        if (c < 14)
+            append(buf, size, &n, codes[c]);
+        else if (c > 0x20 && c < 0x7f)
+            append(buf, size, &n, one);
+    }
+    if (size)
+        buf[n < size ? n : size - 1] = 0;
+    return n;
+}
@@ -0,0 +1,343 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock.h"
+#include "cmd_sched.h"
+
+/* connection keys: 0 is "no connection", 1..256 are connection handles + 1 */
+#define NKEYS 257
+
+struct sched_entry
+{
+    struct bglib_frame frame;
+    uint64_t submitted;
+    uint64_t deadline;
+    int next;
+    uint8 cls;
+};
+
+struct sched_class
+{
+    int head[NKEYS];
+    int tail[NKEYS];
+    int16_t ring_next[NKEYS];
+    int16_t ring_prev[NKEYS];
+    int rr;                 /* next key to serve, -1 if the class is empty */
+    unsigned queued;
+    struct bglib_sched_stats stats;
+};
+
+struct bglib_sched
+{
+    bglib_send_fn send;
+    void *user;
+    uint64_t timeout_ns;
+    uint64_t slack_ns;
+
+    struct sched_entry *entries;
+    int free_list;
+
+    int inflight;           /* entry index, -1 if idle */
+    uint64_t sent_at;
+
+    struct sched_class classes[bglib_sched_class_last];
+};
+
+struct bglib_sched *bglib_sched_create(unsigned capacity, bglib_send_fn send, void *user)
+{
+    struct bglib_sched *sched;
+    unsigned i;
+    int c;
+
+    if (!capacity)
+        return NULL;
+
+    sched = calloc(1, sizeof(*sched));
+    if (!sched)
+        return NULL;
+    sched->entries = calloc(capacity, sizeof(*sched->entries));
+    if (!sched->entries)
+    {
+        free(sched);
+        return NULL;
+    }
+
+    sched->send = send;
+    sched->user = user;
+    sched->timeout_ns = 1000000000ull;
+    sched->slack_ns = 5000000ull;
+    sched->inflight = -1;
+
+    for (i = 0; i < capacity; i++)
+        sched->entries[i].next = (i + 1 < capacity) ? (int)i + 1 : -1;
+    sched->free_list = 0;
+
+    for (c = 0; c < bglib_sched_class_last; c++)
+    {
+        struct sched_class *q = &sched->classes[c];
+        for (i = 0; i < NKEYS; i++)
+            q->head[i] = q->tail[i] = -1;
+        q->rr = -1;
+        bglib_histogram_reset(&q->stats.latency_us);
+        bglib_histogram_reset(&q->stats.service_us);
+    }
+
+    return sched;
+}
+
+void bglib_sched_destroy(struct bglib_sched *sched)
+{
+    if (!sched)
+        return;
+    free(sched->entries);
+    free(sched);
+}
+
+void bglib_sched_set_timeout(struct bglib_sched *sched, uint64_t timeout_ns)
+{
+    sched->timeout_ns = timeout_ns;
+}
+
+void bglib_sched_set_slack(struct bglib_sched *sched, uint64_t slack_ns)
+{
+    sched->slack_ns = slack_ns;
+}
+
+enum bglib_sched_class bglib_sched_classify(uint8 msgid)
+{
+    const struct ble_msg *msg = ble_get_msg(msgid);
+
+    switch (msg->hdr.cls)
+    {
+        case ble_cls_system:
+        case ble_cls_gap:
+            return bglib_sched_control;
+        case ble_cls_connection:
+            if (msg->hdr.command == ble_cmd_connection_disconnect_id)
+                return bglib_sched_control;
+            return bglib_sched_connection;
+        case ble_cls_attclient:
+            if (msg->hdr.command == ble_cmd_attclient_write_command_id ||
+                msg->hdr.command == ble_cmd_attclient_prepare_write_id)
+                return bglib_sched_bulk;
+            return bglib_sched_connection;
+        case ble_cls_sm:
+            return bglib_sched_connection;
+        default:
+            return bglib_sched_bulk;
+    }
+}
+
+static void ring_insert(struct sched_class *q, int key)
+{
+    if (q->rr < 0)
+    {
+        q->ring_next[key] = q->ring_prev[key] = key;
+        q->rr = key;
+        return;
+    }
+    /* join at the end of the current round */
+    q->ring_next[key] = q->rr;
+    q->ring_prev[key] = q->ring_prev[q->rr];
+    q->ring_next[q->ring_prev[q->rr]] = key;
+    q->ring_prev[q->rr] = key;
+}
+
+static void ring_remove(struct sched_class *q, int key)
+{
+    if (q->ring_next[key] == key)
+    {
+        q->rr = -1;
+        return;
+    }
+    q->ring_next[q->ring_prev[key]] = q->ring_next[key];
+    q->ring_prev[q->ring_next[key]] = q->ring_prev[key];
+    if (q->rr == key)
+        q->rr = q->ring_next[key];
+}
+
+int bglib_sched_submit(struct bglib_sched *sched, int cls, int connection,
+                       uint64_t deadline_ns, uint8 msgid, ...)
+{
+    struct sched_class *q;
+    struct sched_entry *e;
+    int idx;
+    int key;
+    va_list va;
+
+    if (cls < 0 || cls >= bglib_sched_class_last)
+        cls = bglib_sched_classify(msgid);
+    q = &sched->classes[cls];
+
+    idx = sched->free_list;
+    if (idx < 0)
+    {
+        q->stats.rejected++;
+        return -1;
+    }
+    e = &sched->entries[idx];
+    sched->free_list = e->next;
+
+    va_start(va, msgid);
+    bglib_frame_encode_va(&e->frame, msgid, va);
+    va_end(va);
+
+    e->submitted = bglib_monotonic_ns();
+    e->deadline = deadline_ns;
+    e->cls = cls;
+    e->next = -1;
+
+    key = (connection < 0 || connection > 255) ? 0 : connection + 1;
+    if (q->tail[key] < 0)
+    {
+        q->head[key] = idx;
+        ring_insert(q, key);
+    }
+    else
+        sched->entries[q->tail[key]].next = idx;
+    q->tail[key] = idx;
+
+    q->queued++;
+    q->stats.submitted++;
+
+    bglib_sched_poll(sched);
+    return 0;
+}
+
+static int pick(struct bglib_sched *sched, struct sched_class *q, uint64_t now)
+{
+    int key = q->rr;
+    int best = -1;
+    uint64_t best_deadline = 0;
+    int idx;
+
+    /* earliest deadline among the urgent queue heads, if any */
+    do
+    {
+        const struct sched_entry *e = &sched->entries[q->head[key]];
+        if (e->deadline && e->deadline <= now + sched->slack_ns &&
+            (best < 0 || e->deadline < best_deadline))
+        {
+            best = key;
+            best_deadline = e->deadline;
+        }
+        key = q->ring_next[key];
+    } while (key != q->rr);
+
+    if (best < 0)
+        best = q->rr;
+
+    idx = q->head[best];
+    q->head[best] = sched->entries[idx].next;
+    if (q->head[best] < 0)
+    {
+        q->tail[best] = -1;
+        ring_remove(q, best);
+    }
+    else if (best == q->rr)
+        q->rr = q->ring_next[best];
+    q->queued--;
+
+    return idx;
+}
+
+static int expects_response(const struct bglib_frame *frame)
+{
+    const struct ble_header *hdr = bglib_frame_header(frame);
+
+    if (hdr->cls == ble_cls_system && hdr->command == ble_cmd_system_reset_id)
+        return 0;
+    if (hdr->cls == ble_cls_dfu && hdr->command == ble_cmd_dfu_reset_id)
+        return 0;
+    return 1;
+}
+
+static void release(struct bglib_sched *sched, int idx)
+{
+    sched->entries[idx].next = sched->free_list;
+    sched->free_list = idx;
+}
+
+static void complete(struct bglib_sched *sched, uint64_t now)
+{
+    struct sched_entry *e = &sched->entries[sched->inflight];
+    struct bglib_sched_stats *st = &sched->classes[e->cls].stats;
+
+    st->completed++;
+    bglib_histogram_record(&st->latency_us, (now - e->submitted) / 1000);
+    bglib_histogram_record(&st->service_us, (now - sched->sent_at) / 1000);
+
+    release(sched, sched->inflight);
+    sched->inflight = -1;
+}
+
+int bglib_sched_poll(struct bglib_sched *sched)
+{
+    uint64_t now = bglib_monotonic_ns();
+    int c;
+
+    if (sched->inflight >= 0)
+    {
+        struct sched_entry *e = &sched->entries[sched->inflight];
+
+        if (now - sched->sent_at < sched->timeout_ns)
+            return 0;
+        sched->classes[e->cls].stats.timeouts++;
+        release(sched, sched->inflight);
+        sched->inflight = -1;
+    }
+
+    for (c = 0; c < bglib_sched_class_last; c++)
+    {
+        struct sched_class *q = &sched->classes[c];
+        struct sched_entry *e;
+
+        if (!q->queued)
+            continue;
+
+        sched->inflight = pick(sched, q, now);
+        sched->sent_at = now;
+        e = &sched->entries[sched->inflight];
+
+        if (sched->send)
+            sched->send(sched->user, &e->frame);
+        else
+            bglib_frame_output(&e->frame);
+
+        if (!expects_response(&e->frame))
+            complete(sched, now);
+        return 1;
+    }
+
+    return 0;
+}
+
+int bglib_sched_on_message(struct bglib_sched *sched, const struct ble_header *hdr)
+{
+    const struct ble_header *sent;
+
+    if (sched->inflight < 0 || (hdr->type_hilen & 0x80) != ble_msg_type_rsp)
+        return 0;
+
+    sent = bglib_frame_header(&sched->entries[sched->inflight].frame);
+    if (sent->cls != hdr->cls || sent->command != hdr->command)
+        return 0;
+
+    complete(sched, bglib_monotonic_ns());
+    bglib_sched_poll(sched);
+    return 1;
+}
+
+int bglib_sched_busy(const struct bglib_sched *sched)
+{
+    return sched->inflight >= 0;
+}
+
+void bglib_sched_get_stats(const struct bglib_sched *sched, enum bglib_sched_class cls,
+                           struct bglib_sched_stats *out)
+{
+    const struct sched_class *q = &sched->classes[cls];
+
+    *out = q->stats;
+    out->queued = q->queued;
+}
@@ -0,0 +1,808 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "conn_mgr.h"
+#include "dispatch.h"
+#include "hash.h"
+
+#define DEFAULT_CONNECTIONS 64
+#define DEFAULT_TIMEOUT     5000000000ull
+#define DEFAULT_BACKOFF_MIN 250000000ull
+#define DEFAULT_BACKOFF_MAX 30000000000ull
+#define DEFAULT_WHITELIST   8
+#define DEFAULT_SELECTIVE   2
+#define WHITELIST_MAX       16
+#define NO_CONN             0xff
+#define NO_HANDLE           0xff
+
+enum adapter_state
+{
+    st_idle,
+    st_query_sent,      /* system_get_connections in flight */
+    st_clear_sent,      /* system_whitelist_clear in flight */
+    st_append_sent,     /* system_whitelist_append in flight */
+    st_connect_sent,    /* gap_connect_direct / gap_connect_selective in flight */
+    st_connecting,      /* connect procedure running */
+    st_cancel_sent      /* gap_end_procedure in flight */
+};
+
+struct adapter
+{
+    bglib_send_fn send;
+    void *user;
+    uint8 state;
+    uint8 max;
+    uint8 count;                        /* established connections */
+    uint8 handle;                       /* of the running attempt, NO_HANDLE until known */
+    uint8 cancelled;                    /* handle of the last cancelled attempt */
+    uint8 disconnects;                  /* connection_disconnect responses expected */
+    uint8 selective;
+    uint8 nbatch;                       /* entries of the attempt, 0 if none */
+    uint8 appended;                     /* whitelist entries written */
+    uint8 batch[WHITELIST_MAX];
+    uint8 conns[BGLIB_CONN_HANDLES_MAX]; /* handle -> entry, NO_CONN if unused */
+    uint64_t attempt_ns;
+};
+
+struct entry
+{
+    struct bglib_conn conn;
+    uint64_t order;                     /* queue position */
+};
+
+struct bglib_conn_mgr
+{
+    struct adapter adapters[BGLIB_CONN_ADAPTERS_MAX];
+    unsigned n;
+    struct entry *entries;
+    unsigned capacity;
+    unsigned next;                      /* allocation cursor, delays id reuse */
+    uint64_t order;
+    uint64_t timeout_ns;
+    struct bglib_conn_params params;
+    struct bglib_conn_reconnect reconnect;
+    uint64_t jitter;
+    bglib_conn_cb cb;
+    void *cb_user;
+    struct bglib_conn_mgr_stats stats;
+};
+
+struct bglib_conn_mgr *bglib_conn_mgr_create(const struct bglib_conn_adapter *adapters, unsigned n,
+                                             const struct bglib_conn_mgr_config *cfg, bglib_conn_cb cb,
+                                             void *user)
+{
+    struct bglib_conn_mgr *mgr;
+    struct bglib_conn_reconnect *r;
+    unsigned i;
+
+    if (!n || n > BGLIB_CONN_ADAPTERS_MAX)
+        return NULL;
+    mgr = calloc(1, sizeof(*mgr));
+    if (!mgr)
+        return NULL;
+    mgr->n = n;
+    mgr->capacity = cfg && cfg->connections ? cfg->connections : DEFAULT_CONNECTIONS;
+    /* entry indexes are stored in uint8 */
+    if (mgr->capacity >= NO_CONN)
+        mgr->capacity = NO_CONN - 1;
+    mgr->timeout_ns = cfg && cfg->connect_timeout_ns ? cfg->connect_timeout_ns : DEFAULT_TIMEOUT;
+    if (cfg)
+    {
+        mgr->params = cfg->params;
+        mgr->reconnect = cfg->reconnect;
+    }
+    if (!mgr->params.interval_min)
+        mgr->params.interval_min = 24;
+    if (!mgr->params.interval_max)
+        mgr->params.interval_max = mgr->params.interval_min > 40 ? mgr->params.interval_min : 40;
+    if (!mgr->params.timeout)
+        mgr->params.timeout = 100;
+
+    r = &mgr->reconnect;
+    if (!r->backoff_min_ns)
+        r->backoff_min_ns = DEFAULT_BACKOFF_MIN;
+    if (!r->backoff_max_ns)
+        r->backoff_max_ns = DEFAULT_BACKOFF_MAX;
+    if (r->backoff_max_ns < r->backoff_min_ns)
+        r->backoff_max_ns = r->backoff_min_ns;
+    if (!r->whitelist_max)
+        r->whitelist_max = DEFAULT_WHITELIST;
+    if (r->whitelist_max > WHITELIST_MAX)
+        r->whitelist_max = WHITELIST_MAX;
+    if (!r->selective_min)
+        r->selective_min = DEFAULT_SELECTIVE;
+    mgr->jitter = (uintptr_t)mgr;
+    mgr->cb = cb;
+    mgr->cb_user = user;
+    bglib_histogram_reset(&mgr->stats.reconnect_us);
+    bglib_histogram_reset(&mgr->stats.backoff_us);
+
+    for (i = 0; i < n; i++)
+    {
+        struct adapter *a = &mgr->adapters[i];
+
+        a->send = adapters[i].send;
+        a->user = adapters[i].user;
+        a->max = adapters[i].max_connections;
+        if (a->max > BGLIB_CONN_HANDLES_MAX)
+            a->max = BGLIB_CONN_HANDLES_MAX;
+        a->handle = NO_HANDLE;
+        a->cancelled = NO_HANDLE;
+        memset(a->conns, NO_CONN, sizeof(a->conns));
+    }
+
+    mgr->entries = calloc(mgr->capacity, sizeof(*mgr->entries));
+    if (!mgr->entries)
+    {
+        free(mgr);
+        return NULL;
+    }
+    for (i = 0; i < mgr->capacity; i++)
+        mgr->entries[i].conn.id = i;
+    return mgr;
+}
+
+void bglib_conn_mgr_destroy(struct bglib_conn_mgr *mgr)
+{
+    if (!mgr)
+        return;
+    free(mgr->entries);
+    free(mgr);
+}
+
+void bglib_conn_mgr_start(struct bglib_conn_mgr *mgr, uint64_t now_ns)
+{
+    unsigned i;
+
+    (void)now_ns;
+    for (i = 0; i < mgr->n; i++)
+    {
+        struct adapter *a = &mgr->adapters[i];
+
+        if (!a->max && a->state == st_idle)
+        {
+            a->state = st_query_sent;
+            bglib_frame_send(a->send, a->user, ble_cmd_system_get_connections_idx);
+        }
+    }
+}
+
+static struct bglib_conn *lookup(const struct bglib_conn_mgr *mgr, const bd_addr *address, uint8 address_type)
+{
+    unsigned i;
+
+    /* a gateway holds tens of connections, a scan is cheaper than keeping an index */
+    for (i = 0; i < mgr->capacity; i++)
+    {
+        struct bglib_conn *c = &mgr->entries[i].conn;
+
+        if (c->state != bglib_conn_free && c->address_type == address_type &&
+            !memcmp(&c->address, address, sizeof(*address)))
+            return c;
+    }
+    return NULL;
+}
+
+/* free the entry first so the callback may queue the device again */
+static void close_conn(struct bglib_conn_mgr *mgr, struct bglib_conn *c, enum bglib_conn_event event,
+                       uint16 reason)
+{
+    struct bglib_conn copy = *c;
+
+    c->state = bglib_conn_free;
+    c->user = NULL;
+    if (event == bglib_conn_ev_failed)
+        mgr->stats.failures++;
+    else
+        mgr->stats.disconnects++;
+    if (mgr->cb)
+        mgr->cb(mgr->cb_user, &copy, event, reason);
+}
+
+static void schedule_retry(struct bglib_conn_mgr *mgr, struct bglib_conn *c, uint64_t now)
+{
+    const struct bglib_conn_reconnect *r = &mgr->reconnect;
+    uint64_t delay = r->backoff_min_ns;
+    unsigned i;
+
+    for (i = 0; i < c->attempts && delay < r->backoff_max_ns; i++)
+        delay <<= 1;
+    if (delay > r->backoff_max_ns)
+        delay = r->backoff_max_ns;
+    /* equal jitter: peers lost together spread over the upper half */
+    mgr->jitter = bglib_mix64(mgr->jitter + bglib_addr_key(&c->address, c->address_type));
+    delay = delay / 2 + mgr->jitter % (delay / 2 + 1);
+
+    c->state = bglib_conn_lost;
+    c->retry_ns = now + delay;
+    bglib_histogram_record(&mgr->stats.backoff_us, delay / 1000);
+}
+
+/* the established connection c dropped */
+static void lose_conn(struct bglib_conn_mgr *mgr, struct bglib_conn *c, uint16 reason, uint64_t now)
+{
+    if (!mgr->reconnect.enabled)
+    {
+        close_conn(mgr, c, bglib_conn_ev_disconnected, reason);
+        return;
+    }
+    c->handle = NO_HANDLE;
+    c->lost_ns = now;
+    c->attempts = 0;
+    mgr->stats.losses++;
+    schedule_retry(mgr, c, now);
+    if (mgr->cb)
+        mgr->cb(mgr->cb_user, c, bglib_conn_ev_lost, reason);
+}
+
+/*
+ * The adapter's attempt ended without a connection for its members (all
+ * of them, or all but the one that connected, which the caller removed
+ * from the batch). Fresh requests fail; lost peers back off, except after
+ * a selective procedure that connected someone else, and except cancel.
+ */
+static void end_attempt(struct bglib_conn_mgr *mgr, struct adapter *a, uint16 reason, int retry_now,
+                        int cancel, uint64_t now)
+{
+    uint8 batch[WHITELIST_MAX];
+    unsigned n = a->nbatch;
+    unsigned i;
+
+    memcpy(batch, a->batch, n);
+    a->nbatch = 0;
+    a->handle = NO_HANDLE;
+    for (i = 0; i < n; i++)
+    {
+        struct bglib_conn *c = &mgr->entries[batch[i]].conn;
+
+        if (c->id == (unsigned)cancel)
+        {
+            close_conn(mgr, c, bglib_conn_ev_failed, BGLIB_CONN_REASON_CANCELLED);
+        }
+        else if (!c->lost_ns)
+        {
+            close_conn(mgr, c, bglib_conn_ev_failed, reason);
+        }
+        else if (retry_now || cancel >= 0)
+        {
+            c->state = bglib_conn_lost;
+            c->retry_ns = now;
+        }
+        else if (++c->attempts == mgr->reconnect.max_attempts)
+        {
+            close_conn(mgr, c, bglib_conn_ev_failed, BGLIB_CONN_REASON_RETRIES);
+        }
+        else
+        {
+            schedule_retry(mgr, c, now);
+        }
+    }
+}
+
+static void cancel_attempt(struct bglib_conn_mgr *mgr, struct adapter *a, uint16 reason, int cancel, uint64_t now)
+{
+    if (a->state >= st_connect_sent)
+    {
+        a->cancelled = a->handle;
+        a->state = st_cancel_sent;
+        bglib_frame_send(a->send, a->user, ble_cmd_gap_end_procedure_idx);
+    }
+    else
+    {
+        /* still writing the whitelist: the pending response finds the batch empty */
+        a->state = st_cancel_sent;
+    }
+    end_attempt(mgr, a, reason, 0, cancel, now);
+}
+
+int bglib_conn_mgr_connect(struct bglib_conn_mgr *mgr, const bd_addr *address, uint8 address_type,
+                           const struct bglib_conn_params *params, void *user, uint64_t now_ns)
+{
+    struct bglib_conn *c = lookup(mgr, address, address_type);
+    unsigned i;
+
+    if (c)
+        return c->id;
+    for (i = 0; i < mgr->capacity; i++)
+    {
+        struct entry *e = &mgr->entries[(mgr->next + i) % mgr->capacity];
+
+        if (e->conn.state != bglib_conn_free)
+            continue;
+        mgr->next = (e->conn.id + 1) % mgr->capacity;
+        c = &e->conn;
+        i = c->id;
+        memset(c, 0, sizeof(*c));
+        c->id = i;
+        c->state = bglib_conn_queued;
+        c->address = *address;
+        c->address_type = address_type;
+        c->handle = NO_HANDLE;
+        c->params = params ? *params : mgr->params;
+        c->requested_ns = now_ns;
+        c->user = user;
+        e->order = mgr->order++;
+        mgr->stats.requests++;
+        return c->id;
+    }
+    return -1;
+}
+
+int bglib_conn_mgr_disconnect(struct bglib_conn_mgr *mgr, unsigned id, uint64_t now_ns)
+{
+    struct bglib_conn *c;
+    struct adapter *a;
+
+    if (id >= mgr->capacity || mgr->entries[id].conn.state == bglib_conn_free)
+        return -1;
+    c = &mgr->entries[id].conn;
+    a = &mgr->adapters[c->adapter];
+
+    switch (c->state)
+    {
+        case bglib_conn_queued:
+        case bglib_conn_lost:
+            close_conn(mgr, c, bglib_conn_ev_failed, BGLIB_CONN_REASON_CANCELLED);
+            break;
+
+        case bglib_conn_connecting:
+            cancel_attempt(mgr, a, BGLIB_CONN_REASON_CANCELLED, id, now_ns);
+            break;
+
+        case bglib_conn_connected:
+            c->state = bglib_conn_disconnecting;
+            a->disconnects++;
+            bglib_frame_send(a->send, a->user, ble_cmd_connection_disconnect_idx, c->handle);
+            break;
+
+        default:
+            break;
+    }
+    return 0;
+}
+
+/* least connections / max among adapters free to start an attempt */
+static int pick_adapter(const struct bglib_conn_mgr *mgr)
+{
+    int best = -1;
+    unsigned i;
+
+    for (i = 0; i < mgr->n; i++)
+    {
+        const struct adapter *a = &mgr->adapters[i];
+        const struct adapter *b;
+
+        if (a->state != st_idle || !a->max || a->count >= a->max)
+            continue;
+        b = best < 0 ? NULL : &mgr->adapters[best];
+        if (!b || a->count * b->max < b->count * a->max)
+            best = i;
+    }
+    return best;
+}
+
+static struct entry *queue_head(const struct bglib_conn_mgr *mgr)
+{
+    struct entry *head = NULL;
+    unsigned i;
+
+    for (i = 0; i < mgr->capacity; i++)
+    {
+        struct entry *e = &mgr->entries[i];
+
+        if (e->conn.state == bglib_conn_queued && (!head || e->order < head->order))
+            head = e;
+    }
+    return head;
+}
+
+/* up to max lost peers whose retry is due, longest waiting first */
+static unsigned due_peers(const struct bglib_conn_mgr *mgr, uint8 *out, unsigned max, uint64_t now)
+{
+    unsigned n = 0;
+    unsigned i, j;
+
+    for (i = 0; i < mgr->capacity; i++)
+    {
+        const struct bglib_conn *c = &mgr->entries[i].conn;
+
+        if (c->state != bglib_conn_lost || c->retry_ns > now)
+            continue;
+        for (j = n; j > 0 && mgr->entries[out[j - 1]].conn.retry_ns > c->retry_ns; j--)
+            if (j < max)
+                out[j] = out[j - 1];
+        if (j < max)
+        {
+            out[j] = i;
+            if (n < max)
+                n++;
+        }
+    }
+    return n;
+}
+
+static void start_attempt(struct bglib_conn_mgr *mgr, unsigned k, const uint8 *batch, unsigned n, uint64_t now)
+{
+    struct adapter *a = &mgr->adapters[k];
+    const struct bglib_conn *first = &mgr->entries[batch[0]].conn;
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+    {
+        struct bglib_conn *c = &mgr->entries[batch[i]].conn;
+
+        c->state = bglib_conn_connecting;
+        c->adapter = k;
+        c->handle = NO_HANDLE;
+        c->attempt_ns = now;
+        a->batch[i] = batch[i];
+    }
+    a->nbatch = n;
+    a->handle = NO_HANDLE;
+    a->attempt_ns = now;
+    a->selective = n > 1;
+    mgr->stats.attempts++;
+
+    if (a->selective)
+    {
+        mgr->stats.selective_attempts++;
+        a->appended = 0;
+        a->state = st_clear_sent;
+        bglib_frame_send(a->send, a->user, ble_cmd_system_whitelist_clear_idx);
+        return;
+    }
+    a->state = st_connect_sent;
+    bglib_frame_send(a->send, a->user, ble_cmd_gap_connect_direct_idx, first->address.addr, first->address_type,
+                     first->params.interval_min, first->params.interval_max, first->params.timeout,
+                     first->params.latency);
+}
+
+void bglib_conn_mgr_poll(struct bglib_conn_mgr *mgr, uint64_t now_ns)
+{
+    uint8 batch[WHITELIST_MAX];
+    struct entry *e;
+    unsigned i, n;
+    int k;
+
+    for (i = 0; i < mgr->n; i++)
+    {
+        struct adapter *a = &mgr->adapters[i];
+
+        if (a->nbatch && now_ns - a->attempt_ns >= mgr->timeout_ns)
+        {
+            mgr->stats.timeouts++;
+            cancel_attempt(mgr, a, BGLIB_CONN_REASON_TIMEOUT, -1, now_ns);
+        }
+    }
+
+    /* lost peers first: they were connected and their data is missing */
+    while ((k = pick_adapter(mgr)) >= 0)
+    {
+        n = due_peers(mgr, batch, mgr->reconnect.whitelist_max, now_ns);
+        if (n)
+        {
+            start_attempt(mgr, k, batch, n >= mgr->reconnect.selective_min ? n : 1, now_ns);
+        }
+        else if ((e = queue_head(mgr)))
+        {
+            batch[0] = e->conn.id;
+            start_attempt(mgr, k, batch, 1, now_ns);
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+static void adapter_reset(struct bglib_conn_mgr *mgr, struct adapter *a, unsigned adapter, uint64_t now)
+{
+    unsigned i;
+
+    if (a->nbatch)
+        end_attempt(mgr, a, BGLIB_CONN_REASON_RESET, 0, -1, now);
+    a->state = st_idle;
+    a->cancelled = NO_HANDLE;
+    a->disconnects = 0;
+    a->count = 0;
+    memset(a->conns, NO_CONN, sizeof(a->conns));
+    for (i = 0; i < mgr->capacity; i++)
+    {
+        struct bglib_conn *c = &mgr->entries[i].conn;
+
+        if (c->adapter != adapter || c->state < bglib_conn_connected)
+            continue;
+        if (c->state == bglib_conn_connected)
+            lose_conn(mgr, c, BGLIB_CONN_REASON_RESET, now);
+        else
+            close_conn(mgr, c, bglib_conn_ev_disconnected, BGLIB_CONN_REASON_RESET);
+    }
+    if (!a->max)
+    {
+        a->state = st_query_sent;
+        bglib_frame_send(a->send, a->user, ble_cmd_system_get_connections_idx);
+    }
+}
+
+/* member of the running attempt the new connection belongs to */
+static struct bglib_conn *attempt_member(struct bglib_conn_mgr *mgr, struct adapter *a,
+                                         const struct ble_msg_connection_status_evt_t *evt)
+{
+    unsigned i;
+
+    for (i = 0; i < a->nbatch; i++)
+    {
+        struct bglib_conn *c = &mgr->entries[a->batch[i]].conn;
+
+        if (c->address_type == evt->address_type && !memcmp(&c->address, &evt->address, sizeof(bd_addr)))
+        {
+            a->batch[i] = a->batch[--a->nbatch];
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static void on_status(struct bglib_conn_mgr *mgr, struct adapter *a,
+                      const struct ble_msg_connection_status_evt_t *evt, uint64_t now)
+{
+    struct bglib_conn *c;
+    unsigned id;
+
+    if (evt->connection >= BGLIB_CONN_HANDLES_MAX || !(evt->flags & connection_connected))
+        return;
+    id = a->conns[evt->connection];
+    if (id != NO_CONN)
+    {
+        c = &mgr->entries[id].conn;
+        c->interval = evt->conn_interval;
+        c->timeout = evt->timeout;
+        c->latency = evt->latency;
+        c->bonding = evt->bonding;
+        if (mgr->cb)
+            mgr->cb(mgr->cb_user, c, bglib_conn_ev_updated, 0);
+        return;
+    }
+
+    if (!a->nbatch || evt->connection != a->handle || !(c = attempt_member(mgr, a, evt)))
+    {
+        /* the procedure completed while gap_end_procedure was on its way */
+        if (evt->connection == a->cancelled)
+        {
+            a->cancelled = NO_HANDLE;
+            a->disconnects++;
+            mgr->stats.strays++;
+            bglib_frame_send(a->send, a->user, ble_cmd_connection_disconnect_idx, evt->connection);
+        }
+        return;
+    }
+
+    c->state = bglib_conn_connected;
+    c->handle = evt->connection;
+    c->interval = evt->conn_interval;
+    c->timeout = evt->timeout;
+    c->latency = evt->latency;
+    c->bonding = evt->bonding;
+    c->connected_ns = now;
+    a->conns[c->handle] = c->id;
+    a->count++;
+    a->state = st_idle;
+    mgr->stats.established++;
+    if (c->lost_ns)
+    {
+        mgr->stats.reconnects++;
+        bglib_histogram_record(&mgr->stats.reconnect_us, (now - c->lost_ns) / 1000);
+        c->lost_ns = 0;
+        c->attempts = 0;
+    }
+    /* a selective procedure ends with its first connection, the others go again at once */
+    end_attempt(mgr, a, 0, 1, -1, now);
+    if (mgr->cb)
+        mgr->cb(mgr->cb_user, c, bglib_conn_ev_connected, 0);
+}
+
+static void on_disconnected(struct bglib_conn_mgr *mgr, struct adapter *a,
+                            const struct ble_msg_connection_disconnected_evt_t *evt, uint64_t now)
+{
+    struct bglib_conn *c;
+    unsigned id;
+
+    if (evt->connection >= BGLIB_CONN_HANDLES_MAX)
+        return;
+    id = a->conns[evt->connection];
+    if (id == NO_CONN)
+    {
+        /* the attempt's connection failed to establish */
+        if (a->nbatch && evt->connection == a->handle)
+        {
+            a->state = st_idle;
+            end_attempt(mgr, a, evt->reason, 0, -1, now);
+        }
+        return;
+    }
+    a->conns[evt->connection] = NO_CONN;
+    a->count--;
+    c = &mgr->entries[id].conn;
+    if (c->state == bglib_conn_connected)
+        lose_conn(mgr, c, evt->reason, now);
+    else
+        close_conn(mgr, c, bglib_conn_ev_disconnected, evt->reason);
+}
+
+/* a command of the attempt was rejected */
+static void attempt_failed(struct bglib_conn_mgr *mgr, struct adapter *a, uint16 result, uint64_t now)
+{
+    a->state = st_idle;
+    end_attempt(mgr, a, result, 0, -1, now);
+}
+
+static void append_next(struct adapter *a, const struct bglib_conn_mgr *mgr)
+{
+    const struct bglib_conn *c;
+
+    if (a->appended < a->nbatch)
+    {
+        c = &mgr->entries[a->batch[a->appended++]].conn;
+        a->state = st_append_sent;
+        bglib_frame_send(a->send, a->user, ble_cmd_system_whitelist_append_idx, c->address.addr, c->address_type);
+        return;
+    }
+    c = &mgr->entries[a->batch[0]].conn;
+    a->state = st_connect_sent;
+    bglib_frame_send(a->send, a->user, ble_cmd_gap_connect_selective_idx, c->params.interval_min,
+                     c->params.interval_max, c->params.timeout, c->params.latency);
+}
+
+int bglib_conn_mgr_on_message(struct bglib_conn_mgr *mgr, unsigned adapter, const struct ble_header *hdr,
+                              const uint8 *payload, uint64_t now_ns)
+{
+    const struct ble_msg *msg = bglib_lookup_msg(hdr);
+    struct adapter *a;
+    uint16 result;
+
+    if (!msg || adapter >= mgr->n)
+        return 0;
+    a = &mgr->adapters[adapter];
+    result = bglib_payload_len(hdr) >= 2 ? payload[0] | (uint16)payload[1] << 8 : 0;
+
+    switch (bglib_msg_index(msg))
+    {
+        case ble_evt_connection_status_idx:
+            on_status(mgr, a, (const struct ble_msg_connection_status_evt_t *)payload, now_ns);
+            return 0;
+
+        case ble_evt_connection_disconnected_idx:
+            on_disconnected(mgr, a, (const struct ble_msg_connection_disconnected_evt_t *)payload, now_ns);
+            return 0;
+
+        case ble_evt_system_boot_idx:
+            adapter_reset(mgr, a, adapter, now_ns);
+            return 0;
+
+        case ble_rsp_system_get_connections_idx:
+            if (a->state != st_query_sent)
+                return 0;
+            a->max = payload[0] < BGLIB_CONN_HANDLES_MAX ? payload[0] : BGLIB_CONN_HANDLES_MAX;
+            a->state = st_idle;
+            return 1;
+
+        case ble_rsp_system_whitelist_clear_idx:
+        case ble_rsp_system_whitelist_append_idx:
+            if (a->state == st_cancel_sent && !a->nbatch)
+            {
+                a->state = st_idle;
+                return 1;
+            }
+            if (a->state != st_clear_sent && a->state != st_append_sent)
+                return 0;
+            /* clear has no result field, result reads 0 */
+            if (result)
+                attempt_failed(mgr, a, result, now_ns);
+            else
+                append_next(a, mgr);
+            return 1;
+
+        case ble_rsp_gap_connect_direct_idx:
+        case ble_rsp_gap_connect_selective_idx:
+        {
+            /* both responses are result, connection_handle */
+            const struct ble_msg_gap_connect_direct_rsp_t *rsp = (const void *)payload;
+
+            if (a->state == st_cancel_sent && !a->nbatch)
+            {
+                /* cancelled before the handle was known */
+                if (!result)
+                    a->cancelled = rsp->connection_handle;
+                return 1;
+            }
+            if (a->state != st_connect_sent)
+                return 0;
+            if (result || rsp->connection_handle >= BGLIB_CONN_HANDLES_MAX)
+            {
+                attempt_failed(mgr, a, result, now_ns);
+                return 1;
+            }
+            a->handle = rsp->connection_handle;
+            a->state = st_connecting;
+            return 1;
+        }
+
+        case ble_rsp_gap_end_procedure_idx:
+            if (a->state != st_cancel_sent)
+                return 0;
+            a->state = st_idle;
+            return 1;
+
+        case ble_rsp_connection_disconnect_idx:
+            if (!a->disconnects)
+                return 0;
+            a->disconnects--;
+            return 1;
+    }
+    return 0;
+}
+
+const struct bglib_conn *bglib_conn_mgr_get(const struct bglib_conn_mgr *mgr, unsigned id)
+{
+    if (id >= mgr->capacity || mgr->entries[id].conn.state == bglib_conn_free)
+        return NULL;
+    return &mgr->entries[id].conn;
+}
+
+const struct bglib_conn *bglib_conn_mgr_find(const struct bglib_conn_mgr *mgr, const bd_addr *address,
+                                             uint8 address_type)
+{
+    return lookup(mgr, address, address_type);
+}
+
+const struct bglib_conn *bglib_conn_mgr_by_handle(const struct bglib_conn_mgr *mgr, unsigned adapter,
+                                                  uint8 handle)
+{
+    if (adapter >= mgr->n || handle >= BGLIB_CONN_HANDLES_MAX || mgr->adapters[adapter].conns[handle] == NO_CONN)
+        return NULL;
+    return &mgr->entries[mgr->adapters[adapter].conns[handle]].conn;
+}
+
+void bglib_conn_mgr_foreach(const struct bglib_conn_mgr *mgr,
+                            void (*fn)(void *user, const struct bglib_conn *conn), void *user)
+{
+    unsigned i;
+
+    for (i = 0; i < mgr->capacity; i++)
+        if (mgr->entries[i].conn.state != bglib_conn_free)
+            fn(user, &mgr->entries[i].conn);
+}
+
+void bglib_conn_mgr_get_stats(const struct bglib_conn_mgr *mgr, struct bglib_conn_mgr_stats *out)
+{
+    unsigned i;
+
+    *out = mgr->stats;
+    out->queued = out->lost = out->connecting = out->connected = 0;
+    for (i = 0; i < mgr->capacity; i++)
+    {
+        switch (mgr->entries[i].conn.state)
+        {
+            case bglib_conn_queued:
+                out->queued++;
+                break;
+            case bglib_conn_lost:
+                out->lost++;
+                break;
+            case bglib_conn_connecting:
+                out->connecting++;
+                break;
+            case bglib_conn_connected:
+            case bglib_conn_disconnecting:
+                out->connected++;
+                break;
+            default:
+                break;
+        }
+    }
+    for (i = 0; i < mgr->n; i++)
+    {
+        out->adapter_connections[i] = mgr->adapters[i].count;
+        out->adapter_max[i] = mgr->adapters[i].max;
+    }
+}
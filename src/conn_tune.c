@@ -0,0 +1,474 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "conn_tune.h"
+#include "dispatch.h"
+
+#define DEFAULT_PERIOD       2000000000ull
+#define DEFAULT_CONFIRM      5000000000ull
+#define DEFAULT_HOLD         30000000000ull
+#define DEFAULT_IDLE_PERIODS 5
+#define DEFAULT_BUSY_BACKLOG 4
+#define UNIT_S               0.00125f   /* connection interval unit */
+#define BUSY_PACKETS         3.0f       /* per interval */
+#define BUSY_PROCEDURE       4.0f       /* intervals per acknowledged procedure */
+
+static const struct
+{
+    const char *name;
+    struct bglib_conn_params params;    /* interval_min, interval_max, timeout, latency */
+} profiles[bglib_conn_profile_last] = {
+    {"low-power", {320, 400, 600, 4}},
+    {"balanced", {24, 40, 100, 0}},
+    {"low-latency", {8, 16, 100, 0}},
+    {"throughput", {6, 8, 100, 0}},
+};
+
+enum tune_state
+{
+    st_steady,
+    st_update_sent,     /* connection_update in flight */
+    st_confirming       /* accepted, waiting for connection_status */
+};
+
+struct entry
+{
+    uint8 used;
+    uint8 pinned;
+    uint8 state;
+    uint8 profile;
+    uint8 target;
+    uint8 reason;
+    uint16 interval;
+    unsigned idle;                      /* consecutive idle periods */
+    unsigned backlog;
+    uint64_t period_start;
+    uint32_t packets;
+    uint32_t procedures;
+    uint64_t procedure_ns;
+    uint64_t procedure_start;           /* 0 if none running */
+    uint64_t sent_ns;
+    uint64_t hold_until;
+    float packets_per_s;
+    float procedure_us;
+};
+
+struct adapter
+{
+    bglib_send_fn send;
+    void *user;
+    struct entry conns[BGLIB_CONN_HANDLES_MAX];
+};
+
+struct bglib_conn_tune
+{
+    struct adapter adapters[BGLIB_CONN_ADAPTERS_MAX];
+    unsigned n;
+    int automatic;
+    uint8 min_profile;
+    uint8 max_profile;
+    uint64_t period_ns;
+    uint64_t confirm_ns;
+    uint64_t hold_ns;
+    unsigned idle_periods;
+    unsigned busy_backlog;
+    bglib_conn_tune_cb cb;
+    void *cb_user;
+    struct bglib_conn_tune_stats stats;
+};
+
+void bglib_conn_profile_params(enum bglib_conn_profile profile, struct bglib_conn_params *out)
+{
+    *out = profiles[profile < bglib_conn_profile_last ? profile : bglib_conn_profile_balanced].params;
+}
+
+const char *bglib_conn_profile_name(enum bglib_conn_profile profile)
+{
+    return profile < bglib_conn_profile_last ? profiles[profile].name : "unknown";
+}
+
+struct bglib_conn_tune *bglib_conn_tune_create(const struct bglib_conn_adapter *adapters, unsigned n,
+                                               const struct bglib_conn_tune_config *cfg,
+                                               bglib_conn_tune_cb cb, void *user)
+{
+    struct bglib_conn_tune *t;
+    unsigned i;
+
+    if (!n || n > BGLIB_CONN_ADAPTERS_MAX)
+        return NULL;
+    t = calloc(1, sizeof(*t));
+    if (!t)
+        return NULL;
+    t->n = n;
+    for (i = 0; i < n; i++)
+    {
+        t->adapters[i].send = adapters[i].send;
+        t->adapters[i].user = adapters[i].user;
+    }
+    t->max_profile = bglib_conn_profile_throughput;
+    if (cfg)
+    {
+        t->automatic = cfg->automatic;
+        if (cfg->max_profile && cfg->max_profile < bglib_conn_profile_last)
+            t->max_profile = cfg->max_profile;
+        t->min_profile = cfg->min_profile <= t->max_profile ? cfg->min_profile : t->max_profile;
+    }
+    t->period_ns = cfg && cfg->period_ns ? cfg->period_ns : DEFAULT_PERIOD;
+    t->confirm_ns = cfg && cfg->confirm_ns ? cfg->confirm_ns : DEFAULT_CONFIRM;
+    t->hold_ns = cfg && cfg->hold_ns ? cfg->hold_ns : DEFAULT_HOLD;
+    t->idle_periods = cfg && cfg->idle_periods ? cfg->idle_periods : DEFAULT_IDLE_PERIODS;
+    t->busy_backlog = cfg && cfg->busy_backlog ? cfg->busy_backlog : DEFAULT_BUSY_BACKLOG;
+    t->cb = cb;
+    t->cb_user = user;
+    return t;
+}
+
+void bglib_conn_tune_destroy(struct bglib_conn_tune *t)
+{
+    free(t);
+}
+
+static struct entry *lookup(const struct bglib_conn_tune *t, unsigned adapter, uint8 connection)
+{
+    struct entry *e;
+
+    if (adapter >= t->n || connection >= BGLIB_CONN_HANDLES_MAX)
+        return NULL;
+    e = (struct entry *)&t->adapters[adapter].conns[connection];
+    return e->used ? e : NULL;
+}
+
+static int in_profile(uint16 interval, unsigned profile)
+{
+    return interval >= profiles[profile].params.interval_min && interval <= profiles[profile].params.interval_max;
+}
+
+/* profile of an interval the tuner did not choose: the closest range */
+static uint8 nearest_profile(uint16 interval)
+{
+    unsigned best = 0, dist = ~0u;
+    unsigned i;
+
+    for (i = 0; i < bglib_conn_profile_last; i++)
+    {
+        const struct bglib_conn_params *p = &profiles[i].params;
+        unsigned d = interval < p->interval_min ? p->interval_min - interval :
+                     interval > p->interval_max ? interval - p->interval_max : 0;
+
+        if (d < dist)
+        {
+            best = i;
+            dist = d;
+        }
+    }
+    return best;
+}
+
+static void report(struct bglib_conn_tune *t, unsigned adapter, uint8 connection, const struct entry *e,
+                   enum bglib_conn_profile from, enum bglib_conn_tune_result result, uint16 error)
+{
+    struct bglib_conn_tune_event ev;
+
+    if (!t->cb)
+        return;
+    ev.adapter = adapter;
+    ev.connection = connection;
+    ev.from = from;
+    ev.to = e->target;
+    ev.reason = e->reason;
+    ev.result = result;
+    ev.interval = e->interval;
+    ev.error = error;
+    t->cb(t->cb_user, &ev);
+}
+
+static void request(struct bglib_conn_tune *t, unsigned adapter, uint8 connection, struct entry *e,
+                    unsigned profile, enum bglib_conn_tune_reason reason, uint64_t now)
+{
+    const struct bglib_conn_params *p = &profiles[profile].params;
+
+    e->target = profile;
+    e->reason = reason;
+    e->state = st_update_sent;
+    e->sent_ns = now;
+    e->idle = 0;
+    t->stats.requested++;
+    if (profile > e->profile)
+        t->stats.steps_up++;
+    else if (profile < e->profile)
+        t->stats.steps_down++;
+    /* note the BGAPI order: latency before timeout */
+    bglib_frame_send(t->adapters[adapter].send, t->adapters[adapter].user, ble_cmd_connection_update_idx,
+                     connection, p->interval_min, p->interval_max, p->latency, p->timeout);
+    report(t, adapter, connection, e, e->profile, bglib_conn_tune_requested, 0);
+}
+
+/* the update did not take: keep the old profile and leave the connection alone for hold_ns */
+static void settle_failed(struct bglib_conn_tune *t, unsigned adapter, uint8 connection, struct entry *e,
+                          enum bglib_conn_tune_result result, uint16 error, uint64_t now)
+{
+    enum bglib_conn_profile from = e->profile;
+
+    e->state = st_steady;
+    e->hold_until = now + t->hold_ns;
+    report(t, adapter, connection, e, from, result, error);
+    e->target = e->profile;
+}
+
+int bglib_conn_tune_apply(struct bglib_conn_tune *t, unsigned adapter, uint8 connection,
+                          enum bglib_conn_profile profile, uint64_t now_ns)
+{
+    struct entry *e = lookup(t, adapter, connection);
+
+    if (!e || profile >= bglib_conn_profile_last)
+        return -1;
+    e->pinned = 1;
+    if (e->state == st_steady && e->profile == profile && in_profile(e->interval, profile))
+        return 0;
+    request(t, adapter, connection, e, profile, bglib_conn_tune_manual, now_ns);
+    return 0;
+}
+
+void bglib_conn_tune_unpin(struct bglib_conn_tune *t, unsigned adapter, uint8 connection)
+{
+    struct entry *e = lookup(t, adapter, connection);
+
+    if (e)
+        e->pinned = 0;
+}
+
+void bglib_conn_tune_set_backlog(struct bglib_conn_tune *t, unsigned adapter, uint8 connection, unsigned queued)
+{
+    struct entry *e = lookup(t, adapter, connection);
+
+    if (e)
+        e->backlog = queued;
+}
+
+static void restart_period(struct entry *e, uint64_t now)
+{
+    e->period_start = now;
+    e->packets = 0;
+    e->procedures = 0;
+    e->procedure_ns = 0;
+}
+
+static void on_status(struct bglib_conn_tune *t, unsigned adapter, const struct ble_msg_connection_status_evt_t *evt,
+                      uint64_t now)
+{
+    struct entry *e;
+
+    if (evt->connection >= BGLIB_CONN_HANDLES_MAX || !(evt->flags & connection_connected))
+        return;
+    e = &t->adapters[adapter].conns[evt->connection];
+    if (!e->used)
+    {
+        memset(e, 0, sizeof(*e));
+        e->used = 1;
+        e->interval = evt->conn_interval;
+        e->profile = e->target = nearest_profile(evt->conn_interval);
+        restart_period(e, now);
+        return;
+    }
+
+    e->interval = evt->conn_interval;
+    if (e->state != st_steady && in_profile(e->interval, e->target))
+    {
+        enum bglib_conn_profile from = e->profile;
+
+        e->profile = e->target;
+        e->state = st_steady;
+        t->stats.confirmed++;
+        restart_period(e, now);
+        report(t, adapter, evt->connection, e, from, bglib_conn_tune_confirmed, 0);
+    }
+}
+
+/* attclient messages all start with the connection handle */
+static void on_attclient(struct bglib_conn_tune *t, unsigned adapter, unsigned idx, const uint8 *payload,
+                         uint16 result, uint64_t now)
+{
+    struct entry *e = lookup(t, adapter, payload[0]);
+
+    if (!e)
+        return;
+    switch (idx)
+    {
+        case ble_rsp_attclient_write_command_idx:
+            if (!result)
+                e->packets++;
+            break;
+
+        case ble_rsp_attclient_indicate_confirm_idx:
+            break;
+
+        case ble_evt_attclient_procedure_completed_idx:
+            e->packets++;
+            if (e->procedure_start)
+            {
+                e->procedures++;
+                e->procedure_ns += now - e->procedure_start;
+                e->procedure_start = 0;
+            }
+            break;
+
+        default:
+            if (idx >= ble_evt_attclient_indicated_idx)
+                e->packets++;
+            else if (!result && !e->procedure_start)
+                e->procedure_start = now;
+            break;
+    }
+}
+
+int bglib_conn_tune_on_message(struct bglib_conn_tune *t, unsigned adapter, const struct ble_header *hdr,
+                               const uint8 *payload, uint64_t now_ns)
+{
+    const struct ble_msg *msg = bglib_lookup_msg(hdr);
+    unsigned len = bglib_payload_len(hdr);
+    unsigned idx;
+    uint16 result;
+    struct entry *e;
+
+    if (!msg || adapter >= t->n || !len)
+        return 0;
+    idx = bglib_msg_index(msg);
+    result = len >= 3 ? payload[1] | (uint16)payload[2] << 8 : 0;
+
+    if ((idx >= ble_rsp_attclient_find_by_type_value_idx && idx <= ble_rsp_attclient_read_multiple_idx) ||
+        (idx >= ble_evt_attclient_indicated_idx && idx <= ble_evt_attclient_read_multiple_response_idx))
+    {
+        on_attclient(t, adapter, idx, payload, result, now_ns);
+        return 0;
+    }
+
+    switch (idx)
+    {
+        case ble_evt_connection_status_idx:
+            on_status(t, adapter, (const struct ble_msg_connection_status_evt_t *)payload, now_ns);
+            return 0;
+
+        case ble_evt_connection_disconnected_idx:
+            if (payload[0] < BGLIB_CONN_HANDLES_MAX)
+                t->adapters[adapter].conns[payload[0]].used = 0;
+            return 0;
+
+        case ble_evt_system_boot_idx:
+            memset(t->adapters[adapter].conns, 0, sizeof(t->adapters[adapter].conns));
+            return 0;
+
+        case ble_rsp_connection_update_idx:
+            e = lookup(t, adapter, payload[0]);
+            if (!e || e->state != st_update_sent)
+                return 0;
+            if (result)
+            {
+                t->stats.rejected++;
+                settle_failed(t, adapter, payload[0], e, bglib_conn_tune_rejected, result, now_ns);
+            }
+            else
+            {
+                e->state = st_confirming;
+            }
+            return 1;
+    }
+    return 0;
+}
+
+static void evaluate(struct bglib_conn_tune *t, unsigned adapter, uint8 connection, struct entry *e, uint64_t now)
+{
+    float seconds = (now - e->period_start) / 1e9f;
+    float interval_s = e->interval * UNIT_S;
+    float rate = e->packets / seconds;
+    float procedure_s = e->procedures ? e->procedure_ns / 1e9f / e->procedures : 0;
+    float slower_s;
+    int busy;
+
+    e->packets_per_s = rate;
+    e->procedure_us = procedure_s * 1e6f;
+    restart_period(e, now);
+    if (!t->automatic || e->pinned || now < e->hold_until)
+        return;
+
+    if (e->profile < t->min_profile)
+    {
+        request(t, adapter, connection, e, t->min_profile, bglib_conn_tune_busy, now);
+        return;
+    }
+    if (e->profile > t->max_profile)
+    {
+        request(t, adapter, connection, e, t->max_profile, bglib_conn_tune_idle, now);
+        return;
+    }
+
+    busy = e->backlog >= t->busy_backlog || procedure_s > BUSY_PROCEDURE * interval_s ||
+           rate * interval_s > BUSY_PACKETS;
+    if (busy)
+    {
+        e->idle = 0;
+        if (e->profile < t->max_profile)
+            request(t, adapter, connection, e, e->profile + 1, bglib_conn_tune_busy, now);
+        return;
+    }
+    if (e->profile <= t->min_profile)
+        return;
+
+    /* would the longer interval still carry less than a packet per interval */
+    slower_s = profiles[e->profile - 1].params.interval_max * UNIT_S;
+    if (e->backlog || rate * slower_s >= 1)
+    {
+        e->idle = 0;
+        return;
+    }
+    if (++e->idle >= t->idle_periods)
+        request(t, adapter, connection, e, e->profile - 1, bglib_conn_tune_idle, now);
+}
+
+void bglib_conn_tune_poll(struct bglib_conn_tune *t, uint64_t now_ns)
+{
+    unsigned i, h;
+
+    for (i = 0; i < t->n; i++)
+    {
+        for (h = 0; h < BGLIB_CONN_HANDLES_MAX; h++)
+        {
+            struct entry *e = &t->adapters[i].conns[h];
+
+            if (!e->used)
+                continue;
+            if (e->state != st_steady)
+            {
+                if (now_ns - e->sent_ns >= t->confirm_ns)
+                {
+                    t->stats.unconfirmed++;
+                    settle_failed(t, i, h, e, bglib_conn_tune_unconfirmed, 0, now_ns);
+                }
+                continue;
+            }
+            if (now_ns - e->period_start >= t->period_ns)
+                evaluate(t, i, h, e, now_ns);
+        }
+    }
+}
+
+int bglib_conn_tune_get(const struct bglib_conn_tune *t, unsigned adapter, uint8 connection,
+                        struct bglib_conn_tune_state *out)
+{
+    const struct entry *e = lookup(t, adapter, connection);
+
+    if (!e)
+        return -1;
+    out->profile = e->profile;
+    out->target = e->target;
+    out->pinned = e->pinned;
+    out->interval = e->interval;
+    out->packets_per_s = e->packets_per_s;
+    out->procedure_us = e->procedure_us;
+    out->backlog = e->backlog;
+    return 0;
+}
+
+void bglib_conn_tune_get_stats(const struct bglib_conn_tune *t, struct bglib_conn_tune_stats *out)
+{
+    *out = t->stats;
+}
@@ -0,0 +1,499 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "devtable.h"
+#include "gap_ad.h"
+#include "hash.h"
+#include "seqlock.h"
+
+#define USED            ((uint64_t)1 << 63)
+#define DEFAULT_DEVICES 1024
+#define DEFAULT_SHIFT   3
+#define SHM_MAGIC       0x54444742u     /* "BGDT" */
+#define SHM_VERSION     1
+#define ENTRY_BYTES     offsetof(struct bglib_device, seq)
+
+/* start of a shared segment, the slots follow at offset 64 */
+struct shm_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t capacity;
+    uint32_t seq;               /* odd while entries move between slots */
+    uint32_t count;
+    uint32_t entry_size;
+    uint32_t reserved;
+} __attribute__((aligned(64)));
+
+struct bglib_devtable_view
+{
+    const struct shm_header *hdr;
+    const struct bglib_device *slots;
+    size_t bytes;
+};
+
+struct bglib_devtable
+{
+    struct bglib_device *slots;
+    struct shm_header *shm;     /* NULL for a private table */
+    struct shm_header local;    /* seq and count of a private table */
+    size_t shm_bytes;
+    char *shm_name;
+    uint32_t *free_ids;
+    unsigned nfree;
+    unsigned mask;
+    unsigned capacity;
+    unsigned count;
+
+    uint64_t ttl_ns;
+    int rssi_delta;
+    unsigned ewma_shift;
+    unsigned events;
+
+    bglib_devtable_cb cb;
+    void *cb_user;
+    bglib_devtable_evict_cb evict;
+    void *evict_user;
+
+    struct bglib_devtable_stats stats;
+};
+
+static int shm_create(struct bglib_devtable *tbl, const char *name, unsigned slots)
+{
+    size_t bytes = sizeof(struct shm_header) + slots * sizeof(struct bglib_device);
+    void *base;
+    int fd;
+
+    /* never take over a segment readers may still have mapped */
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return -1;
+    base = MAP_FAILED;
+    if (!ftruncate(fd, bytes))
+        base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base != MAP_FAILED)
+    {
+        tbl->shm_name = strdup(name);
+        if (!tbl->shm_name)
+            munmap(base, bytes);
+    }
+    if (base == MAP_FAILED || !tbl->shm_name)
+    {
+        shm_unlink(name);
+        return -1;
+    }
+
+    /* ftruncate zero-filled the segment; readers check the magic last */
+    tbl->shm = base;
+    tbl->shm_bytes = bytes;
+    tbl->slots = (struct bglib_device *)(tbl->shm + 1);
+    tbl->shm->version = SHM_VERSION;
+    tbl->shm->slots = slots;
+    tbl->shm->capacity = tbl->capacity;
+    tbl->shm->entry_size = sizeof(struct bglib_device);
+    __atomic_store_n(&tbl->shm->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+struct bglib_devtable *bglib_devtable_create(const struct bglib_devtable_config *cfg)
+{
+    struct bglib_devtable *tbl = calloc(1, sizeof(*tbl));
+    unsigned slots = 16;
+    unsigned i;
+
+    if (!tbl)
+        return NULL;
+    if (cfg)
+    {
+        tbl->capacity = cfg->capacity;
+        tbl->ttl_ns = cfg->ttl_ns;
+        tbl->rssi_delta = cfg->rssi_delta;
+        tbl->ewma_shift = cfg->ewma_shift;
+        tbl->events = cfg->events;
+    }
+    if (!tbl->capacity)
+        tbl->capacity = DEFAULT_DEVICES;
+    if (!tbl->ewma_shift || tbl->ewma_shift > 8)
+        tbl->ewma_shift = DEFAULT_SHIFT;
+    if (!tbl->events)
+        tbl->events = BGLIB_DEV_ALL;
+
+    /* keep the load factor at or below 3/4 so probe sequences stay short */
+    while (slots - slots / 4 < tbl->capacity)
+        slots <<= 1;
+    tbl->mask = slots - 1;
+
+    tbl->shm = &tbl->local;
+    tbl->free_ids = malloc(tbl->capacity * sizeof(*tbl->free_ids));
+    if (cfg && cfg->shm_name)
+    {
+        if (shm_create(tbl, cfg->shm_name, slots))
+        {
+            bglib_devtable_destroy(tbl);
+            return NULL;
+        }
+    }
+    else
+    {
+        tbl->slots = aligned_alloc(64, slots * sizeof(*tbl->slots));
+        if (tbl->slots)
+            memset(tbl->slots, 0, slots * sizeof(*tbl->slots));
+    }
+    if (!tbl->slots || !tbl->free_ids)
+    {
+        bglib_devtable_destroy(tbl);
+        return NULL;
+    }
+    for (i = 0; i < tbl->capacity; i++)
+        tbl->free_ids[i] = tbl->capacity - 1 - i;
+    tbl->nfree = tbl->capacity;
+    return tbl;
+}
+
+void bglib_devtable_destroy(struct bglib_devtable *tbl)
+{
+    if (!tbl)
+        return;
+    if (tbl->shm_name)
+    {
+        munmap(tbl->shm, tbl->shm_bytes);
+        shm_unlink(tbl->shm_name);
+        free(tbl->shm_name);
+    }
+    else
+    {
+        free(tbl->slots);
+    }
+    free(tbl->free_ids);
+    free(tbl);
+}
+
+void bglib_devtable_set_callback(struct bglib_devtable *tbl, bglib_devtable_cb cb, void *user)
+{
+    tbl->cb = cb;
+    tbl->cb_user = user;
+}
+
+void bglib_devtable_set_evict_callback(struct bglib_devtable *tbl, bglib_devtable_evict_cb cb, void *user)
+{
+    tbl->evict = cb;
+    tbl->evict_user = user;
+}
+
+static unsigned home(const struct bglib_devtable *tbl, uint64_t key)
+{
+    return bglib_mix64(key) & tbl->mask;
+}
+
+/* slot holding key, or the empty slot ending its probe sequence */
+static unsigned probe(const struct bglib_devtable *tbl, uint64_t key)
+{
+    unsigned i = home(tbl, key);
+
+    while (tbl->slots[i].key && tbl->slots[i].key != key)
+        i = (i + 1) & tbl->mask;
+    return i;
+}
+
+/* backward-shift deletion: no tombstones, probe sequences stay minimal */
+static void delete_slot(struct bglib_devtable *tbl, unsigned i)
+{
+    unsigned j = i;
+    unsigned k;
+
+    tbl->free_ids[tbl->nfree++] = tbl->slots[i].id;
+    tbl->count--;
+
+    /* readers probing while entries move retry on the table sequence */
+    bglib_seq_write_begin(&tbl->shm->seq);
+    for (;;)
+    {
+        j = (j + 1) & tbl->mask;
+        if (!tbl->slots[j].key)
+            break;
+        k = home(tbl, tbl->slots[j].key);
+        /* move j into the hole unless its home lies cyclically in (i, j] */
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        bglib_seq_write_begin(&tbl->slots[i].seq);
+        memcpy(&tbl->slots[i], &tbl->slots[j], ENTRY_BYTES);
+        bglib_seq_write_end(&tbl->slots[i].seq);
+        i = j;
+    }
+    bglib_seq_write_begin(&tbl->slots[i].seq);
+    tbl->slots[i].key = 0;
+    bglib_seq_write_end(&tbl->slots[i].seq);
+    tbl->shm->count = tbl->count;
+    bglib_seq_write_end(&tbl->shm->seq);
+}
+
+static void evict_slot(struct bglib_devtable *tbl, unsigned i)
+{
+    if (tbl->evict)
+        tbl->evict(tbl->evict_user, &tbl->slots[i]);
+    delete_slot(tbl, i);
+}
+
+unsigned bglib_devtable_update(struct bglib_devtable *tbl, const struct ble_msg_gap_scan_response_evt_t *msg,
+                               unsigned payload_len, uint64_t now_ns, const struct bglib_device **dev)
+{
+    uint64_t key = bglib_addr_key(&msg->sender, msg->address_type) | USED;
+    unsigned kind = (msg->packet_type >> 1) & 3;
+    unsigned events = 0;
+    struct bglib_device *d;
+    const uint8 *data;
+    unsigned len;
+    uint32_t hash;
+    unsigned i;
+    int avg;
+
+    tbl->stats.updates++;
+    i = probe(tbl, key);
+    if (!tbl->slots[i].key && tbl->count == tbl->capacity)
+    {
+        if (tbl->ttl_ns && bglib_devtable_expire(tbl, now_ns))
+            i = probe(tbl, key);
+        if (tbl->count == tbl->capacity)
+        {
+            tbl->stats.dropped++;
+            if (dev)
+                *dev = NULL;
+            return 0;
+        }
+    }
+
+    len = gap_ad_scan_data(msg, payload_len, &data);
+    hash = (uint32_t)bglib_hash_ad(data, len);
+    d = &tbl->slots[i];
+
+    bglib_seq_write_begin(&d->seq);
+    if (!d->key)
+    {
+        memset(d, 0, ENTRY_BYTES);
+        d->key = key;
+        d->id = tbl->free_ids[--tbl->nfree];
+        d->first_seen = now_ns;
+        d->rssi_avg = msg->rssi * 16;
+        d->rssi_reported = msg->rssi;
+        d->payload_hash[kind == bglib_dev_scan_response] = hash;
+        tbl->count++;
+        tbl->shm->count = tbl->count;
+        tbl->stats.inserted++;
+        events = BGLIB_DEV_NEW;
+    }
+    else
+    {
+        uint32_t *last = &d->payload_hash[kind == bglib_dev_scan_response];
+        int moved;
+
+        /* the first scan response of a known device is a change too */
+        if (*last != hash || !d->packets[kind])
+            events |= BGLIB_DEV_PAYLOAD_CHANGED;
+        *last = hash;
+
+        avg = d->rssi_avg;
+        avg += (msg->rssi * 16 - avg) / (1 << tbl->ewma_shift);
+        d->rssi_avg = avg;
+        moved = avg / 16 - d->rssi_reported;
+        if (tbl->rssi_delta && (moved >= tbl->rssi_delta || -moved >= tbl->rssi_delta))
+            events |= BGLIB_DEV_RSSI_MOVED;
+    }
+
+    d->last_seen = now_ns;
+    d->rssi = msg->rssi;
+    d->packets[kind]++;
+    if (events & BGLIB_DEV_RSSI_MOVED)
+        d->rssi_reported = d->rssi_avg / 16;
+    bglib_seq_write_end(&d->seq);
+
+    if (dev)
+        *dev = d;
+    events &= tbl->events;
+    if (events && tbl->cb)
+    {
+        tbl->stats.reported++;
+        tbl->cb(tbl->cb_user, d, events, msg);
+    }
+    return events;
+}
+
+const struct bglib_device *bglib_devtable_find(const struct bglib_devtable *tbl, const bd_addr *addr,
+                                               uint8 address_type)
+{
+    unsigned i = probe(tbl, bglib_addr_key(addr, address_type) | USED);
+
+    return tbl->slots[i].key ? &tbl->slots[i] : NULL;
+}
+
+unsigned bglib_devtable_expire(struct bglib_devtable *tbl, uint64_t now_ns)
+{
+    unsigned n = 0;
+    unsigned i = 0;
+
+    if (!tbl->ttl_ns || now_ns < tbl->ttl_ns)
+        return 0;
+    while (i <= tbl->mask)
+    {
+        if (tbl->slots[i].key && tbl->slots[i].last_seen < now_ns - tbl->ttl_ns)
+        {
+            /* another entry may have shifted into i, look at it again */
+            evict_slot(tbl, i);
+            n++;
+            continue;
+        }
+        i++;
+    }
+    tbl->stats.expired += n;
+    return n;
+}
+
+int bglib_devtable_remove(struct bglib_devtable *tbl, const bd_addr *addr, uint8 address_type)
+{
+    unsigned i = probe(tbl, bglib_addr_key(addr, address_type) | USED);
+
+    if (!tbl->slots[i].key)
+        return 0;
+    evict_slot(tbl, i);
+    return 1;
+}
+
+void bglib_devtable_foreach(const struct bglib_devtable *tbl,
+                            void (*fn)(void *user, const struct bglib_device *dev), void *user)
+{
+    unsigned i;
+
+    for (i = 0; i <= tbl->mask; i++)
+    {
+        if (tbl->slots[i].key)
+            fn(user, &tbl->slots[i]);
+    }
+}
+
+unsigned bglib_devtable_capacity(const struct bglib_devtable *tbl)
+{
+    return tbl->capacity;
+}
+
+void bglib_devtable_get_stats(const struct bglib_devtable *tbl, struct bglib_devtable_stats *out)
+{
+    *out = tbl->stats;
+    out->devices = tbl->count;
+}
+
+struct bglib_devtable_view *bglib_devtable_attach(const char *shm_name)
+{
+    struct bglib_devtable_view *view;
+    const struct shm_header *hdr;
+    struct stat st;
+    void *base;
+    int fd;
+
+    fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*hdr))
+    {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    hdr = base;
+    view = calloc(1, sizeof(*view));
+    if (!view || __atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC || hdr->version != SHM_VERSION ||
+        hdr->entry_size != sizeof(struct bglib_device) || !hdr->slots || (hdr->slots & (hdr->slots - 1)) ||
+        sizeof(*hdr) + (size_t)hdr->slots * sizeof(struct bglib_device) > (size_t)st.st_size)
+    {
+        free(view);
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    view->hdr = hdr;
+    view->slots = (const struct bglib_device *)(hdr + 1);
+    view->bytes = st.st_size;
+    return view;
+}
+
+void bglib_devtable_detach(struct bglib_devtable_view *view)
+{
+    if (!view)
+        return;
+    munmap((void *)view->hdr, view->bytes);
+    free(view);
+}
+
+static void read_entry(const struct bglib_device *slot, struct bglib_device *out)
+{
+    uint32_t s;
+
+    do
+    {
+        s = bglib_seq_read_begin(&slot->seq);
+        memcpy(out, slot, ENTRY_BYTES);
+    } while (bglib_seq_read_retry(&slot->seq, s));
+    out->seq = s;
+}
+
+int bglib_devtable_view_find(const struct bglib_devtable_view *view, const bd_addr *addr, uint8 address_type,
+                             struct bglib_device *out)
+{
+    uint64_t key = bglib_addr_key(addr, address_type) | USED;
+    unsigned mask = view->hdr->slots - 1;
+    int found;
+
+    for (;;)
+    {
+        uint32_t s = bglib_seq_read_begin(&view->hdr->seq);
+        unsigned i = bglib_mix64(key) & mask;
+        unsigned n;
+
+        found = 0;
+        for (n = 0; n <= mask; n++, i = (i + 1) & mask)
+        {
+            read_entry(&view->slots[i], out);
+            if (!out->key)
+                break;
+            if (out->key == key)
+            {
+                found = 1;
+                break;
+            }
+        }
+        if (!bglib_seq_read_retry(&view->hdr->seq, s))
+            return found;
+    }
+}
+
+unsigned bglib_devtable_view_foreach(const struct bglib_devtable_view *view,
+                                     void (*fn)(void *user, const struct bglib_device *dev), void *user)
+{
+    struct bglib_device dev;
+    unsigned n = 0;
+    unsigned i;
+
+    for (i = 0; i < view->hdr->slots; i++)
+    {
+        read_entry(&view->slots[i], &dev);
+        if (dev.key)
+        {
+            fn(user, &dev);
+            n++;
+        }
+    }
+    return n;
+}
+
+unsigned bglib_devtable_view_count(const struct bglib_devtable_view *view)
+{
+    return __atomic_load_n(&view->hdr->count, __ATOMIC_RELAXED);
+}
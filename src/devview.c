@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "devview.h"
+#include "seqlock.h"
+
+#define NONE        0xffffffffu
+#define LEVELS      128         /* level l holds devices at -l dBm, clamped */
+#define DEFAULT_MAX 64
+
+struct node
+{
+    uint32_t prev;              /* same RSSI level */
+    uint32_t next;
+    uint32_t mprev;             /* most recently heard order */
+    uint32_t mnext;
+    uint64_t key;
+    uint64_t last_seen;
+    int8 rssi;
+    uint8 level;
+    uint8 present;
+};
+
+struct snapshot
+{
+    uint32_t seq;
+    uint64_t at_ns;
+    unsigned nstrong;
+    unsigned nrecent;
+    struct bglib_devview_entry *strong;
+    struct bglib_devview_entry *recent;
+};
+
+struct bglib_devview
+{
+    struct node *nodes;
+    unsigned capacity;
+    uint32_t heads[LEVELS];
+    uint64_t levels[LEVELS / 64];   /* bitmap of non-empty levels */
+    uint32_t mru_head;
+    uint32_t mru_tail;
+    unsigned top_max;
+    unsigned recent_max;
+    struct snapshot snaps[2];
+    unsigned front;
+};
+
+struct bglib_devview *bglib_devview_create(unsigned capacity, unsigned top_max, unsigned recent_max)
+{
+    struct bglib_devview *v;
+    unsigned i;
+
+    if (!capacity)
+        return NULL;
+    v = calloc(1, sizeof(*v));
+    if (!v)
+        return NULL;
+    v->capacity = capacity;
+    v->top_max = top_max ? top_max : DEFAULT_MAX;
+    v->recent_max = recent_max ? recent_max : DEFAULT_MAX;
+    v->nodes = calloc(v->capacity, sizeof(*v->nodes));
+    for (i = 0; i < 2; i++)
+    {
+        v->snaps[i].strong = malloc(v->top_max * sizeof(struct bglib_devview_entry));
+        v->snaps[i].recent = malloc(v->recent_max * sizeof(struct bglib_devview_entry));
+    }
+    if (!v->nodes || !v->snaps[0].strong || !v->snaps[0].recent || !v->snaps[1].strong || !v->snaps[1].recent)
+    {
+        bglib_devview_destroy(v);
+        return NULL;
+    }
+    for (i = 0; i < LEVELS; i++)
+        v->heads[i] = NONE;
+    v->mru_head = v->mru_tail = NONE;
+    return v;
+}
+
+void bglib_devview_destroy(struct bglib_devview *v)
+{
+    unsigned i;
+
+    if (!v)
+        return;
+    for (i = 0; i < 2; i++)
+    {
+        free(v->snaps[i].strong);
+        free(v->snaps[i].recent);
+    }
+    free(v->nodes);
+    free(v);
+}
+
+static void unlink_level(struct bglib_devview *v, uint32_t id)
+{
+    struct node *n = &v->nodes[id];
+
+    if (n->prev != NONE)
+        v->nodes[n->prev].next = n->next;
+    else
+        v->heads[n->level] = n->next;
+    if (n->next != NONE)
+        v->nodes[n->next].prev = n->prev;
+    if (v->heads[n->level] == NONE)
+        v->levels[n->level / 64] &= ~((uint64_t)1 << (n->level % 64));
+}
+
+static void link_level(struct bglib_devview *v, uint32_t id, uint8 level)
+{
+    struct node *n = &v->nodes[id];
+
+    n->level = level;
+    n->prev = NONE;
+    n->next = v->heads[level];
+    if (n->next != NONE)
+        v->nodes[n->next].prev = id;
+    v->heads[level] = id;
+    v->levels[level / 64] |= (uint64_t)1 << (level % 64);
+}
+
+static void unlink_mru(struct bglib_devview *v, uint32_t id)
+{
+    struct node *n = &v->nodes[id];
+
+    if (n->mprev != NONE)
+        v->nodes[n->mprev].mnext = n->mnext;
+    else
+        v->mru_head = n->mnext;
+    if (n->mnext != NONE)
+        v->nodes[n->mnext].mprev = n->mprev;
+    else
+        v->mru_tail = n->mprev;
+}
+
+static void link_mru(struct bglib_devview *v, uint32_t id)
+{
+    struct node *n = &v->nodes[id];
+
+    n->mprev = NONE;
+    n->mnext = v->mru_head;
+    if (n->mnext != NONE)
+        v->nodes[n->mnext].mprev = id;
+    else
+        v->mru_tail = id;
+    v->mru_head = id;
+}
+
+void bglib_devview_update(struct bglib_devview *v, const struct bglib_device *dev)
+{
+    int rssi = bglib_device_rssi(dev);
+    uint8 level = rssi >= 0 ? 0 : -rssi < LEVELS ? -rssi : LEVELS - 1;
+    struct node *n;
+
+    if (dev->id >= v->capacity)
+        return;
+    n = &v->nodes[dev->id];
+    if (n->present && n->key != dev->key)
+        bglib_devview_forget(v, dev);
+    if (!n->present)
+    {
+        n->present = 1;
+        n->key = dev->key;
+        link_level(v, dev->id, level);
+        link_mru(v, dev->id);
+    }
+    else
+    {
+        if (n->level != level)
+        {
+            unlink_level(v, dev->id);
+            link_level(v, dev->id, level);
+        }
+        if (v->mru_head != dev->id)
+        {
+            unlink_mru(v, dev->id);
+            link_mru(v, dev->id);
+        }
+    }
+    n->rssi = rssi;
+    n->last_seen = dev->last_seen;
+}
+
+void bglib_devview_forget(struct bglib_devview *v, const struct bglib_device *dev)
+{
+    struct node *n;
+
+    if (dev->id >= v->capacity)
+        return;
+    n = &v->nodes[dev->id];
+    if (!n->present)
+        return;
+    unlink_level(v, dev->id);
+    unlink_mru(v, dev->id);
+    n->present = 0;
+}
+
+static void fill(struct bglib_devview_entry *e, const struct node *n, uint32_t id)
+{
+    unsigned i;
+
+    for (i = 0; i < 6; i++)
+        e->addr.addr[i] = n->key >> (8 * i);
+    e->address_type = n->key >> 48;
+    e->rssi = n->rssi;
+    e->id = id;
+    e->last_seen = n->last_seen;
+}
+
+void bglib_devview_publish(struct bglib_devview *v, uint64_t now_ns)
+{
+    unsigned back = v->front ^ 1;
+    struct snapshot *s = &v->snaps[back];
+    unsigned count = 0;
+    unsigned w;
+    uint32_t id;
+
+    bglib_seq_write_begin(&s->seq);
+    s->at_ns = now_ns;
+    for (w = 0; w < LEVELS / 64 && count < v->top_max; w++)
+    {
+        uint64_t bits = v->levels[w];
+
+        while (bits && count < v->top_max)
+        {
+            unsigned level = w * 64 + __builtin_ctzll(bits);
+
+            bits &= bits - 1;
+            for (id = v->heads[level]; id != NONE && count < v->top_max; id = v->nodes[id].next)
+                fill(&s->strong[count++], &v->nodes[id], id);
+        }
+    }
+    s->nstrong = count;
+
+    count = 0;
+    for (id = v->mru_head; id != NONE && count < v->recent_max; id = v->nodes[id].mnext)
+        fill(&s->recent[count++], &v->nodes[id], id);
+    s->nrecent = count;
+    bglib_seq_write_end(&s->seq);
+
+    __atomic_store_n(&v->front, back, __ATOMIC_RELEASE);
+}
+
+unsigned bglib_devview_strongest(const struct bglib_devview *v, struct bglib_devview_entry *out, unsigned k,
+                                 uint64_t *published_ns)
+{
+    const struct snapshot *s;
+    unsigned n;
+    uint64_t at;
+    uint32_t seq;
+
+    do
+    {
+        s = &v->snaps[__atomic_load_n(&v->front, __ATOMIC_ACQUIRE)];
+        seq = bglib_seq_read_begin(&s->seq);
+        n = s->nstrong < k ? s->nstrong : k;
+        memcpy(out, s->strong, n * sizeof(*out));
+        at = s->at_ns;
+    } while (bglib_seq_read_retry(&s->seq, seq));
+
+    if (published_ns)
+        *published_ns = at;
+    return n;
+}
+
+unsigned bglib_devview_recent(const struct bglib_devview *v, uint64_t since_ns, struct bglib_devview_entry *out,
+                              unsigned max, uint64_t *published_ns)
+{
+    const struct snapshot *s;
+    unsigned n;
+    uint64_t at;
+    uint32_t seq;
+
+    do
+    {
+        s = &v->snaps[__atomic_load_n(&v->front, __ATOMIC_ACQUIRE)];
+        seq = bglib_seq_read_begin(&s->seq);
+        for (n = 0; n < s->nrecent && n < max && s->recent[n].last_seen >= since_ns; n++)
+            out[n] = s->recent[n];
+        at = s->at_ns;
+    } while (bglib_seq_read_retry(&s->seq, seq));
+
+    if (published_ns)
+        *published_ns = at;
+    return n;
+}
@@ -0,0 +1,90 @@
+#include "dispatch.h"
+#include "executor.h"
+#include "frame.h"
+
+static struct bglib_executor *dispatch_executor;
+
+static struct
+{
+    bglib_dispatch_filter fn;
+    void *user;
+} filters[BGLIB_DISPATCH_FILTERS_MAX];
+static unsigned nfilters;
+
+static BGLIB_THREAD_LOCAL const struct ble_header *current_hdr;
+static BGLIB_THREAD_LOCAL const uint8 *current_payload;
+
+void bglib_dispatch_set_executor(struct bglib_executor *exec)
+{
+    __atomic_store_n(&dispatch_executor, exec, __ATOMIC_RELEASE);
+}
+
+int bglib_dispatch(const struct ble_header *hdr, const uint8 *payload)
+{
+    const struct ble_msg *msg = bglib_lookup_msg(hdr);
+    struct bglib_executor *exec;
+    unsigned i;
+
+    if (!msg)
+        return -1;
+
+    for (i = 0; i < nfilters; i++)
+    {
+        if (!filters[i].fn(filters[i].user, msg, hdr, payload))
+            return 1;
+    }
+
+    exec = __atomic_load_n(&dispatch_executor, __ATOMIC_ACQUIRE);
+    if (exec && bglib_exec_submit(exec, msg, payload, bglib_payload_len(hdr)))
+        return 0;
+
+    bglib_dispatch_run(msg, hdr, payload);
+    return 0;
+}
+
+void bglib_dispatch_run(const struct ble_msg *msg, const struct ble_header *hdr, const uint8 *payload)
+{
+    const struct ble_header *prev_hdr = current_hdr;
+    const uint8 *prev_payload = current_payload;
+
+    current_hdr = hdr;
+    current_payload = payload;
+    msg->handler(payload);
+    current_hdr = prev_hdr;
+    current_payload = prev_payload;
+}
+
+int bglib_dispatch_current(const struct ble_header **hdr, const uint8 **payload)
+{
+    if (!current_hdr)
+        return 0;
+    *hdr = current_hdr;
+    *payload = current_payload;
+    return 1;
+}
+
+int bglib_dispatch_add_filter(bglib_dispatch_filter fn, void *user)
+{
+    if (nfilters == BGLIB_DISPATCH_FILTERS_MAX)
+        return -1;
+    filters[nfilters].fn = fn;
+    filters[nfilters].user = user;
+    nfilters++;
+    return 0;
+}
+
+void bglib_dispatch_remove_filter(bglib_dispatch_filter fn, void *user)
+{
+    unsigned i;
+
+    for (i = 0; i < nfilters; i++)
+    {
+        if (filters[i].fn == fn && filters[i].user == user)
+        {
+            for (; i + 1 < nfilters; i++)
+                filters[i] = filters[i + 1];
+            nfilters--;
+            return;
+        }
+    }
+}
@@ -0,0 +1,471 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock.h"
+#include "dispatch.h"
+#include "executor.h"
+#include "frame.h"
+
+#define MAX_WORKERS 64
+#define MSG_SLOTS   256
+#define NO_TASK     0xFFFFFFFFu
+
+struct exec_task
+{
+    const struct ble_msg *msg;
+    uint64_t enqueued;
+    uint32_t next_free;
+    uint16 len;
+    uint8 data[BGLIB_FRAME_MAX];
+};
+
+/* fixed-capacity deque of task indices, guarded by the owning worker's lock */
+struct task_ring
+{
+    uint32_t *items;
+    unsigned mask;
+    unsigned head;
+    unsigned count;
+};
+
+struct worker
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct task_ring local;   /* may be stolen from the back */
+    struct task_ring serial;  /* keyed tasks, owner only */
+    int sleeping;
+    unsigned id;
+    struct bglib_executor *exec;
+} __attribute__((aligned(64)));
+
+struct route
+{
+    int offloaded;
+    bglib_exec_key_fn key;
+    struct bglib_exec_handler_stats *stats;
+};
+
+struct bglib_executor
+{
+    unsigned nworkers;
+    struct worker *workers;
+    struct exec_task *tasks;
+    unsigned pool_size;
+
+    uint64_t free_head;     /* aba tag << 32 | task index */
+    uint64_t idle_mask;
+    unsigned rr;
+    int stop;
+
+    uint64_t pending;
+    pthread_mutex_t flush_lock;
+    pthread_cond_t flush_cond;
+
+    struct bglib_exec_stats stats;
+    struct route routes[MSG_SLOTS];
+};
+
+static int ring_init(struct task_ring *r, unsigned capacity)
+{
+    unsigned size = 2;
+
+    while (size < capacity)
+        size <<= 1;
+    r->items = malloc(size * sizeof(*r->items));
+    r->mask = size - 1;
+    r->head = 0;
+    r->count = 0;
+    return r->items ? 0 : -1;
+}
+
+static void ring_push_back(struct task_ring *r, uint32_t idx)
+{
+    r->items[(r->head + r->count) & r->mask] = idx;
+    r->count++;
+}
+
+static uint32_t ring_pop_front(struct task_ring *r)
+{
+    uint32_t idx;
+
+    if (!r->count)
+        return NO_TASK;
+    idx = r->items[r->head];
+    r->head = (r->head + 1) & r->mask;
+    r->count--;
+    return idx;
+}
+
+static uint32_t ring_pop_back(struct task_ring *r)
+{
+    if (!r->count)
+        return NO_TASK;
+    r->count--;
+    return r->items[(r->head + r->count) & r->mask];
+}
+
+static uint32_t pool_get(struct bglib_executor *exec)
+{
+    uint64_t old = __atomic_load_n(&exec->free_head, __ATOMIC_ACQUIRE);
+    uint64_t next;
+    uint32_t idx;
+
+    do
+    {
+        idx = (uint32_t)old;
+        if (idx == NO_TASK)
+            return NO_TASK;
+        next = ((old >> 32) + 1) << 32 |
+               __atomic_load_n(&exec->tasks[idx].next_free, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&exec->free_head, &old, next, 1,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return idx;
+}
+
+static void pool_put(struct bglib_executor *exec, uint32_t idx)
+{
+    uint64_t old = __atomic_load_n(&exec->free_head, __ATOMIC_RELAXED);
+    uint64_t next;
+
+    do
+    {
+        __atomic_store_n(&exec->tasks[idx].next_free, (uint32_t)old, __ATOMIC_RELAXED);
+        next = ((old >> 32) + 1) << 32 | idx;
+    } while (!__atomic_compare_exchange_n(&exec->free_head, &old, next, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void run_task(struct bglib_executor *exec, uint32_t idx)
+{
+    struct exec_task *task = &exec->tasks[idx];
+    struct bglib_exec_handler_stats *st = exec->routes[bglib_msg_index(task->msg)].stats;
+    struct ble_header hdr = task->msg->hdr;
+    uint64_t start = bglib_monotonic_ns();
+    uint64_t end;
+
+    hdr.lolen = task->len & 0xff;
+    hdr.type_hilen = (hdr.type_hilen & 0xF8) | (task->len >> 8);
+    bglib_dispatch_run(task->msg, &hdr, task->data);
+    end = bglib_monotonic_ns();
+
+    if (st)
+    {
+        __atomic_fetch_add(&st->executed, 1, __ATOMIC_RELAXED);
+        bglib_histogram_record(&st->queue_us, (start - task->enqueued) / 1000);
+        bglib_histogram_record(&st->run_us, (end - start) / 1000);
+    }
+
+    pool_put(exec, idx);
+
+    if (__atomic_sub_fetch(&exec->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        pthread_mutex_lock(&exec->flush_lock);
+        pthread_cond_broadcast(&exec->flush_cond);
+        pthread_mutex_unlock(&exec->flush_lock);
+    }
+}
+
+static uint32_t steal(struct bglib_executor *exec, struct worker *self)
+{
+    unsigned i;
+
+    for (i = 1; i < exec->nworkers; i++)
+    {
+        struct worker *victim = &exec->workers[(self->id + i) % exec->nworkers];
+        uint32_t idx;
+
+        if (!__atomic_load_n(&victim->local.count, __ATOMIC_RELAXED))
+            continue;
+        pthread_mutex_lock(&victim->lock);
+        idx = ring_pop_back(&victim->local);
+        pthread_mutex_unlock(&victim->lock);
+        if (idx != NO_TASK)
+        {
+            __atomic_fetch_add(&exec->stats.stolen, 1, __ATOMIC_RELAXED);
+            return idx;
+        }
+    }
+    return NO_TASK;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct bglib_executor *exec = w->exec;
+    uint64_t bit = (uint64_t)1 << w->id;
+
+    for (;;)
+    {
+        uint32_t idx;
+
+        pthread_mutex_lock(&w->lock);
+        idx = ring_pop_front(&w->serial);
+        if (idx == NO_TASK)
+            idx = ring_pop_front(&w->local);
+        pthread_mutex_unlock(&w->lock);
+
+        if (idx == NO_TASK)
+            idx = steal(exec, w);
+
+        if (idx != NO_TASK)
+        {
+            run_task(exec, idx);
+            continue;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        if (!w->serial.count && !w->local.count)
+        {
+            if (__atomic_load_n(&exec->stop, __ATOMIC_ACQUIRE))
+            {
+                pthread_mutex_unlock(&w->lock);
+                break;
+            }
+            w->sleeping = 1;
+            __atomic_fetch_or(&exec->idle_mask, bit, __ATOMIC_RELEASE);
+            pthread_cond_wait(&w->wake, &w->lock);
+            __atomic_fetch_and(&exec->idle_mask, ~bit, __ATOMIC_RELEASE);
+            w->sleeping = 0;
+        }
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    return NULL;
+}
+
+struct bglib_executor *bglib_exec_create(unsigned threads, unsigned pool_size)
+{
+    struct bglib_executor *exec;
+    unsigned i;
+
+    if (!threads || threads > MAX_WORKERS || !pool_size)
+        return NULL;
+
+    exec = calloc(1, sizeof(*exec));
+    if (!exec)
+        return NULL;
+    exec->nworkers = threads;
+    exec->pool_size = pool_size;
+    exec->tasks = calloc(pool_size, sizeof(*exec->tasks));
+    if (posix_memalign((void **)&exec->workers, 64, threads * sizeof(*exec->workers)))
+        exec->workers = NULL;
+    if (!exec->tasks || !exec->workers)
+        goto fail;
+    memset(exec->workers, 0, threads * sizeof(*exec->workers));
+
+    for (i = 0; i < pool_size; i++)
+        exec->tasks[i].next_free = (i + 1 < pool_size) ? i + 1 : NO_TASK;
+    exec->free_head = 0;
+
+    pthread_mutex_init(&exec->flush_lock, NULL);
+    pthread_cond_init(&exec->flush_cond, NULL);
+
+    for (i = 0; i < threads; i++)
+    {
+        struct worker *w = &exec->workers[i];
+
+        if (ring_init(&w->local, pool_size) || ring_init(&w->serial, pool_size))
+            goto fail;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->wake, NULL);
+        w->id = i;
+        w->exec = exec;
+    }
+    for (i = 0; i < threads; i++)
+        pthread_create(&exec->workers[i].thread, NULL, worker_main, &exec->workers[i]);
+
+    return exec;
+
+fail:
+    if (exec->workers)
+    {
+        for (i = 0; i < threads; i++)
+        {
+            free(exec->workers[i].local.items);
+            free(exec->workers[i].serial.items);
+        }
+    }
+    free(exec->workers);
+    free(exec->tasks);
+    free(exec);
+    return NULL;
+}
+
+void bglib_exec_destroy(struct bglib_executor *exec)
+{
+    unsigned i;
+
+    if (!exec)
+        return;
+
+    __atomic_store_n(&exec->stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < exec->nworkers; i++)
+    {
+        pthread_mutex_lock(&exec->workers[i].lock);
+        pthread_cond_signal(&exec->workers[i].wake);
+        pthread_mutex_unlock(&exec->workers[i].lock);
+    }
+    for (i = 0; i < exec->nworkers; i++)
+    {
+        struct worker *w = &exec->workers[i];
+
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->wake);
+        free(w->local.items);
+        free(w->serial.items);
+    }
+    for (i = 0; i < MSG_SLOTS; i++)
+        free(exec->routes[i].stats);
+
+    pthread_mutex_destroy(&exec->flush_lock);
+    pthread_cond_destroy(&exec->flush_cond);
+    free(exec->workers);
+    free(exec->tasks);
+    free(exec);
+}
+
+int bglib_exec_offload(struct bglib_executor *exec, const struct ble_msg *msg, bglib_exec_key_fn key)
+{
+    struct route *r = &exec->routes[bglib_msg_index(msg)];
+
+    if (!r->stats)
+    {
+        r->stats = calloc(1, sizeof(*r->stats));
+        if (!r->stats)
+            return -1;
+        bglib_histogram_reset(&r->stats->queue_us);
+        bglib_histogram_reset(&r->stats->run_us);
+    }
+    r->key = key;
+    __atomic_store_n(&r->offloaded, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void bglib_exec_inline(struct bglib_executor *exec, const struct ble_msg *msg)
+{
+    __atomic_store_n(&exec->routes[bglib_msg_index(msg)].offloaded, 0, __ATOMIC_RELEASE);
+}
+
+static uint64_t mix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    return k;
+}
+
+int bglib_exec_submit(struct bglib_executor *exec, const struct ble_msg *msg,
+                      const uint8 *payload, uint16 len)
+{
+    const struct route *r = &exec->routes[bglib_msg_index(msg)];
+    struct exec_task *task;
+    struct worker *w;
+    uint32_t idx;
+    int sleeping;
+
+    if (!__atomic_load_n(&r->offloaded, __ATOMIC_ACQUIRE))
+        return 0;
+
+    while ((idx = pool_get(exec)) == NO_TASK)
+    {
+        __atomic_fetch_add(&exec->stats.pool_waits, 1, __ATOMIC_RELAXED);
+        sched_yield();
+    }
+
+    if (len > BGLIB_FRAME_MAX)
+        len = BGLIB_FRAME_MAX;
+    task = &exec->tasks[idx];
+    task->msg = msg;
+    task->len = len;
+    memcpy(task->data, payload, len);
+    task->enqueued = bglib_monotonic_ns();
+
+    __atomic_fetch_add(&exec->pending, 1, __ATOMIC_ACQ_REL);
+    __atomic_fetch_add(&exec->stats.submitted, 1, __ATOMIC_RELAXED);
+
+    if (r->key)
+        w = &exec->workers[mix64(r->key(msg, payload, len)) % exec->nworkers];
+    else
+        w = &exec->workers[__atomic_fetch_add(&exec->rr, 1, __ATOMIC_RELAXED) % exec->nworkers];
+
+    pthread_mutex_lock(&w->lock);
+    ring_push_back(r->key ? &w->serial : &w->local, idx);
+    sleeping = w->sleeping;
+    if (sleeping)
+        pthread_cond_signal(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+
+    /* target is busy: wake an idle worker so it can steal the task */
+    if (!sleeping && !r->key)
+    {
+        uint64_t idle = __atomic_load_n(&exec->idle_mask, __ATOMIC_ACQUIRE);
+
+        if (idle)
+        {
+            struct worker *thief = &exec->workers[__builtin_ctzll(idle)];
+
+            pthread_mutex_lock(&thief->lock);
+            pthread_cond_signal(&thief->wake);
+            pthread_mutex_unlock(&thief->lock);
+        }
+    }
+
+    return 1;
+}
+
+void bglib_exec_flush(struct bglib_executor *exec)
+{
+    pthread_mutex_lock(&exec->flush_lock);
+    while (__atomic_load_n(&exec->pending, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&exec->flush_cond, &exec->flush_lock);
+    pthread_mutex_unlock(&exec->flush_lock);
+}
+
+void bglib_exec_get_stats(const struct bglib_executor *exec, struct bglib_exec_stats *out)
+{
+    out->submitted = __atomic_load_n(&exec->stats.submitted, __ATOMIC_RELAXED);
+    out->stolen = __atomic_load_n(&exec->stats.stolen, __ATOMIC_RELAXED);
+    out->pool_waits = __atomic_load_n(&exec->stats.pool_waits, __ATOMIC_RELAXED);
+}
+
+int bglib_exec_get_handler_stats(const struct bglib_executor *exec, const struct ble_msg *msg,
+                                 struct bglib_exec_handler_stats *out)
+{
+    const struct route *r = &exec->routes[bglib_msg_index(msg)];
+
+    if (!r->stats)
+        return -1;
+    out->executed = __atomic_load_n(&r->stats->executed, __ATOMIC_RELAXED);
+    bglib_histogram_snapshot(&r->stats->queue_us, &out->queue_us);
+    bglib_histogram_snapshot(&r->stats->run_us, &out->run_us);
+    return 0;
+}
+
+uint64_t bglib_exec_key_connection(const struct ble_msg *msg, const uint8 *payload, uint16 len)
+{
+    return len ? payload[0] : 0;
+}
+
+uint64_t bglib_exec_key_address(const struct ble_msg *msg, const uint8 *payload, uint16 len)
+{
+    uint64_t key = 0;
+    unsigned offset;
+
+    /* both gap_scan_response.sender and connection_status.address sit at offset 2 */
+    if ((msg->hdr.type_hilen & 0x80) == ble_msg_type_evt &&
+        ((msg->hdr.cls == ble_cls_gap && msg->hdr.command == ble_evt_gap_scan_response_id) ||
+         (msg->hdr.cls == ble_cls_connection && msg->hdr.command == ble_evt_connection_status_id)))
+        offset = 2;
+    else
+        return len ? payload[0] : 0;
+
+    if (len < offset + sizeof(bd_addr))
+        return 0;
+    memcpy(&key, payload + offset, sizeof(bd_addr));
+    return key;
+}
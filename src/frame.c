@@ -0,0 +1,182 @@
+#include <sched.h>
+#include <string.h>
+
+#include "frame.h"
+#include "txqueue.h"
+
+static struct bglib_txq *tx_queue;
+static void (*direct_output)(uint8 len1, uint8 *data1, uint16 len2, uint8 *data2);
+
+uint16 bglib_frame_encode_va(struct bglib_frame *frame, uint8 msgid, va_list va)
+{
+    const struct ble_msg *msg = ble_get_msg(msgid);
+    struct ble_header *hdr = (struct ble_header *)frame->data;
+    uint8 *b = frame->data + sizeof(struct ble_header);
+    uint32 i = msg->params;
+    uint32 u32;
+    uint16 u16;
+    uint8 *hw;
+    uint8 *data_ptr = 0;
+    uint16 data_len = 0;
+
+    *hdr = msg->hdr;
+
+    while (i)
+    {
+        switch (i & 0xF)
+        {
+            case 7: /*int32*/
+            case 6: /*uint32*/
+                u32 = va_arg(va, uint32);
+                *b++ = u32 & 0xff; u32 >>= 8;
+                *b++ = u32 & 0xff; u32 >>= 8;
+                *b++ = u32 & 0xff; u32 >>= 8;
+                *b++ = u32 & 0xff;
+                break;
+            case 5: /*int16*/
+            case 4: /*uint16*/
+                u16 = va_arg(va, unsigned);
+                *b++ = u16 & 0xff; u16 >>= 8;
+                *b++ = u16 & 0xff;
+                break;
+            case 3: /*int8*/
+            case 2: /*uint8*/
+                *b++ = va_arg(va, int) & 0xff;
+                break;
+            case 9: /*string*/
+            case 8: /*uint8 array*/
+                data_len = va_arg(va, int) & 0xff;
+                /* the array is the last parameter; header, prefix and copy agree on the clamped length */
+                if (data_len > BGLIB_FRAME_MAX - (b + 1 - frame->data))
+                    data_len = BGLIB_FRAME_MAX - (b + 1 - frame->data);
+                *b++ = data_len;
+
+                u16 = data_len + hdr->lolen;
+                hdr->lolen = u16 & 0xff;
+                hdr->type_hilen |= u16 >> 8;
+
+                data_ptr = va_arg(va, uint8 *);
+                break;
+            case 10: /*hwaddr*/
+                hw = va_arg(va, uint8 *);
+                memcpy(b, hw, sizeof(bd_addr));
+                b += sizeof(bd_addr);
+                break;
+            case 11: /*uint16 array*/
+                data_len = va_arg(va, int);
+                if (data_len > BGLIB_FRAME_MAX - (b + 2 - frame->data))
+                    data_len = BGLIB_FRAME_MAX - (b + 2 - frame->data);
+                *b++ = data_len & 0xff;
+                *b++ = data_len >> 8;
+
+                u16 = data_len + hdr->lolen;
+                hdr->lolen = u16 & 0xff;
+                hdr->type_hilen |= u16 >> 8;
+
+                data_ptr = va_arg(va, uint8 *);
+                break;
+        }
+        i = i >> 4;
+    }
+
+    frame->split = b - frame->data;
+    if (data_len)
+        memcpy(b, data_ptr, data_len);
+    frame->len = frame->split + data_len;
+
+    return frame->len;
+}
+
+uint16 bglib_frame_encode(struct bglib_frame *frame, uint8 msgid, ...)
+{
+    uint16 len;
+    va_list va;
+
+    va_start(va, msgid);
+    len = bglib_frame_encode_va(frame, msgid, va);
+    va_end(va);
+
+    return len;
+}
+
+void bglib_frame_send(bglib_send_fn send, void *user, uint8 msgid, ...)
+{
+    struct bglib_frame frame;
+    va_list va;
+
+    va_start(va, msgid);
+    bglib_frame_encode_va(&frame, msgid, va);
+    va_end(va);
+
+    if (send)
+        send(user, &frame);
+    else
+        bglib_frame_output(&frame);
+}
+
+static void push_frame(struct bglib_txq *q, const struct bglib_frame *frame)
+{
+    while (bglib_txq_push(q, frame))
+        sched_yield();
+}
+
+/*
+ * The generated ble_send_message() writes through bglib_output. While a
+ * queue is installed that pointer is this shim, which reassembles the two
+ * parts into a frame, and the application's writer is kept in
+ * direct_output for the consumer.
+ */
+static void queue_output(uint8 len1, uint8 *data1, uint16 len2, uint8 *data2)
+{
+    struct bglib_txq *q = __atomic_load_n(&tx_queue, __ATOMIC_ACQUIRE);
+    struct bglib_frame frame;
+
+    /* no BGAPI command is this long; a partial frame would corrupt the stream */
+    if (!q || len1 + len2 > BGLIB_FRAME_MAX)
+        return;
+    frame.split = len1;
+    frame.len = len1 + len2;
+    memcpy(frame.data, data1, len1);
+    if (len2)
+        memcpy(frame.data + len1, data2, len2);
+    push_frame(q, &frame);
+}
+
+void bglib_set_tx_queue(struct bglib_txq *q)
+{
+    struct bglib_txq *old = __atomic_exchange_n(&tx_queue, q, __ATOMIC_ACQ_REL);
+
+    if (q && !old)
+    {
+        direct_output = bglib_output;
+        __atomic_store_n(&bglib_output, queue_output, __ATOMIC_RELEASE);
+    }
+    else if (!q && old)
+    {
+        __atomic_store_n(&bglib_output, direct_output, __ATOMIC_RELEASE);
+    }
+}
+
+struct bglib_txq *bglib_get_tx_queue(void)
+{
+    return __atomic_load_n(&tx_queue, __ATOMIC_ACQUIRE);
+}
+
+void bglib_frame_write(const struct bglib_frame *frame)
+{
+    void (*out)(uint8, uint8 *, uint16, uint8 *);
+
+    out = __atomic_load_n(&tx_queue, __ATOMIC_ACQUIRE) ? direct_output : bglib_output;
+    if (out)
+        out(frame->split, (uint8 *)frame->data, frame->len - frame->split, (uint8 *)frame->data + frame->split);
+}
+
+void bglib_frame_output(const struct bglib_frame *frame)
+{
+    struct bglib_txq *q = __atomic_load_n(&tx_queue, __ATOMIC_ACQUIRE);
+
+    if (q)
+        push_frame(q, frame);
+    else
+        bglib_frame_write(frame);
+}
@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "dispatch.h"
+#include "framer.h"
+
+#define BUF_SIZE    4096
+#define READS       32          /* power of two, reads whose bytes are still buffered */
+
+struct read_stamp
+{
+    uint64_t end;               /* stream position after the read */
+    uint64_t mono_ns;
+    uint64_t real_ns;
+};
+
+struct bglib_framer
+{
+    int fd;
+    uint8 adapter;
+    unsigned flags;
+    unsigned start;             /* buffered bytes are buf[start..end) */
+    unsigned end;
+    uint64_t pos;               /* stream position of buf[start] */
+    unsigned first_read;        /* reads[first_read..next_read) cover the buffer */
+    unsigned next_read;
+    struct read_stamp reads[READS];
+    struct bglib_framer_stats stats;
+    uint8 buf[BUF_SIZE];
+};
+
+struct bglib_framer *bglib_framer_create(int fd, uint8 adapter, unsigned flags)
+{
+    struct bglib_framer *fr = calloc(1, sizeof(*fr));
+
+    if (!fr)
+        return NULL;
+    fr->fd = fd;
+    fr->adapter = adapter;
+    fr->flags = flags;
+    return fr;
+}
+
+void bglib_framer_destroy(struct bglib_framer *fr)
+{
+    free(fr);
+}
+
+static unsigned space(struct bglib_framer *fr)
+{
+    if (fr->start && fr->end + BGLIB_FRAME_MAX > BUF_SIZE)
+    {
+        memmove(fr->buf, fr->buf + fr->start, fr->end - fr->start);
+        fr->end -= fr->start;
+        fr->start = 0;
+    }
+    return BUF_SIZE - fr->end;
+}
+
+static void stamp(struct bglib_framer *fr, unsigned n, uint64_t mono_ns, uint64_t real_ns)
+{
+    struct read_stamp *r;
+
+    fr->end += n;
+    fr->stats.reads++;
+    fr->stats.bytes += n;
+    /* a full ring means many tiny reads; the newest one absorbs the bytes */
+    if (fr->next_read - fr->first_read == READS)
+    {
+        fr->reads[(fr->next_read - 1) % READS].end = fr->pos + (fr->end - fr->start);
+        return;
+    }
+    r = &fr->reads[fr->next_read++ % READS];
+    r->end = fr->pos + (fr->end - fr->start);
+    r->mono_ns = mono_ns;
+    r->real_ns = real_ns;
+}
+
+int bglib_framer_read(struct bglib_framer *fr)
+{
+    unsigned room = space(fr);
+    ssize_t n;
+
+    n = read(fr->fd, fr->buf + fr->end, room);
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    if (n == 0)
+        return 0;
+    stamp(fr, (unsigned)n, bglib_monotonic_ns(), fr->flags & BGLIB_FRAMER_REALTIME ? bglib_realtime_ns() : 0);
+    return (int)n;
+}
+
+unsigned bglib_framer_feed(struct bglib_framer *fr, const uint8 *data, unsigned len,
+                           uint64_t mono_ns, uint64_t real_ns)
+{
+    unsigned room = space(fr);
+
+    if (len > room)
+        len = room;
+    if (!len)
+        return 0;
+    memcpy(fr->buf + fr->end, data, len);
+    stamp(fr, len, mono_ns, fr->flags & BGLIB_FRAMER_REALTIME ? real_ns : 0);
+    return len;
+}
+
+static void consume(struct bglib_framer *fr, unsigned n)
+{
+    fr->start += n;
+    fr->pos += n;
+    while (fr->first_read != fr->next_read && fr->reads[fr->first_read % READS].end <= fr->pos)
+        fr->first_read++;
+    if (fr->start == fr->end)
+        fr->start = fr->end = 0;
+}
+
+/* 0 if the header cannot start a frame, otherwise the frame length */
+static unsigned check_header(const struct ble_header *hdr)
+{
+    const struct ble_msg *msg;
+    uint16 len = bglib_payload_len(hdr);
+
+    if (hdr->type_hilen & 0x78)
+        return 0;
+    msg = bglib_lookup_msg(hdr);
+    if (!msg || len < msg->hdr.lolen || len + sizeof(*hdr) > BGLIB_FRAME_MAX)
+        return 0;
+    return len + sizeof(*hdr);
+}
+
+int bglib_framer_next(struct bglib_framer *fr, struct bglib_rx_frame *out)
+{
+    for (;;)
+    {
+        const struct read_stamp *r;
+        unsigned avail = fr->end - fr->start;
+        unsigned len;
+
+        if (avail < sizeof(struct ble_header))
+            return 0;
+        len = check_header((const struct ble_header *)(fr->buf + fr->start));
+        if (!len)
+        {
+            fr->stats.skipped++;
+            consume(fr, 1);
+            continue;
+        }
+        if (avail < len)
+            return 0;
+
+        r = &fr->reads[fr->first_read % READS];
+        out->mono_ns = r->mono_ns;
+        out->real_ns = r->real_ns;
+        out->time_ns = r->mono_ns;
+        out->adapter = fr->adapter;
+        out->frame.len = len;
+        out->frame.split = sizeof(struct ble_header);
+        memcpy(out->frame.data, fr->buf + fr->start, len);
+        consume(fr, len);
+        fr->stats.frames++;
+        return 1;
+    }
+}
+
+void bglib_framer_get_stats(const struct bglib_framer *fr, struct bglib_framer_stats *out)
+{
+    *out = fr->stats;
+}
@@ -0,0 +1,292 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "gap_ad.h"
+
+/* offset of data within ble_msg_gap_scan_response_evt_t: rssi, packet_type, sender, address_type, bond, len */
+#define SCAN_RESPONSE_DATA_OFFSET 11
+
+static uint16 le16(const uint8 *p)
+{
+    return p[0] | (uint16)p[1] << 8;
+}
+
+unsigned gap_ad_scan_data(const struct ble_msg_gap_scan_response_evt_t *msg, unsigned payload_len,
+                          const uint8 **data)
+{
+    unsigned len = msg->data.len;
+
+    *data = msg->data.data;
+    if (payload_len < SCAN_RESPONSE_DATA_OFFSET)
+        return 0;
+    if (len > payload_len - SCAN_RESPONSE_DATA_OFFSET)
+        len = payload_len - SCAN_RESPONSE_DATA_OFFSET;
+    return len;
+}
+
+int gap_ad_find(const uint8 *data, unsigned len, uint8 type, struct gap_ad *ad)
+{
+    struct gap_ad_iter it;
+
+    gap_ad_iter_init(&it, data, len);
+    while (gap_ad_iter_next(&it, ad) > 0)
+    {
+        if (ad->type == type)
+            return 1;
+    }
+    return 0;
+}
+
+int gap_ad_index_build(struct gap_ad_index *idx, const uint8 *data, unsigned len)
+{
+    struct gap_ad_iter it;
+    struct gap_ad ad;
+    int r;
+
+    memset(idx->present, 0, sizeof(idx->present));
+    idx->count = 0;
+    idx->malformed = 0;
+
+    gap_ad_iter_init(&it, data, len);
+    while (idx->count < GAP_AD_INDEX_MAX)
+    {
+        const uint8 *at = it.p;
+
+        r = gap_ad_iter_next(&it, &ad);
+        if (r <= 0)
+        {
+            idx->malformed = r < 0;
+            break;
+        }
+        idx->offset[idx->count++] = at - data;
+        idx->present[ad.type >> 5] |= (uint32_t)1 << (ad.type & 31);
+    }
+
+    return idx->malformed ? -1 : idx->count;
+}
+
+int gap_ad_index_find(const struct gap_ad_index *idx, const uint8 *data, uint8 type, struct gap_ad *ad)
+{
+    unsigned i;
+
+    if (!gap_ad_index_has(idx, type))
+        return 0;
+    for (i = 0; i < idx->count; i++)
+    {
+        const uint8 *p = data + idx->offset[i];
+
+        if (p[1] == type)
+        {
+            ad->type = type;
+            ad->len = p[0] - 1;
+            ad->data = p + 2;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int gap_ad_flags(const struct gap_ad *ad, uint8 *flags)
+{
+    if (ad->type != gap_ad_type_flags || ad->len < 1)
+        return 0;
+    *flags = ad->data[0];
+    return 1;
+}
+
+int gap_ad_tx_power(const struct gap_ad *ad, int8 *dbm)
+{
+    if (ad->type != gap_ad_type_txpower || ad->len < 1)
+        return 0;
+    *dbm = (int8)ad->data[0];
+    return 1;
+}
+
+int gap_ad_appearance(const struct gap_ad *ad, uint16 *appearance)
+{
+    if (ad->type != gap_ad_type_appearance || ad->len < 2)
+        return 0;
+    *appearance = le16(ad->data);
+    return 1;
+}
+
+int gap_ad_adv_interval(const struct gap_ad *ad, uint32_t *units)
+{
+    if (ad->type == gap_ad_type_adv_interval && ad->len >= 2)
+        *units = le16(ad->data);
+    else if (ad->type == gap_ad_type_adv_interval_long && ad->len >= 3)
+        *units = ad->data[0] | (uint32_t)ad->data[1] << 8 | (uint32_t)ad->data[2] << 16;
+    else
+        return 0;
+    return 1;
+}
+
+int gap_ad_manufacturer(const struct gap_ad *ad, uint16 *company,
+                        const uint8 **payload, uint8 *len)
+{
+    if (ad->type != gap_ad_type_manufacturer_data || ad->len < 2)
+        return 0;
+    *company = le16(ad->data);
+    *payload = ad->data + 2;
+    *len = ad->len - 2;
+    return 1;
+}
+
+int gap_ad_service_data(const struct gap_ad *ad, const uint8 **uuid, uint8 *uuid_len,
+                        const uint8 **payload, uint8 *len)
+{
+    uint8 n;
+
+    switch (ad->type)
+    {
+        case gap_ad_type_service_data_16bit:  n = 2;  break;
+        case gap_ad_type_service_data_32bit:  n = 4;  break;
+        case gap_ad_type_service_data_128bit: n = 16; break;
+        default: return 0;
+    }
+    if (ad->len < n)
+        return 0;
+    *uuid = ad->data;
+    *uuid_len = n;
+    *payload = ad->data + n;
+    *len = ad->len - n;
+    return 1;
+}
+
+int gap_ad_service_data16(const struct gap_ad *ad, uint16 *uuid,
+                          const uint8 **payload, uint8 *len)
+{
+    if (ad->type != gap_ad_type_service_data_16bit || ad->len < 2)
+        return 0;
+    *uuid = le16(ad->data);
+    *payload = ad->data + 2;
+    *len = ad->len - 2;
+    return 1;
+}
+
+int gap_ad_name(const struct gap_ad *ad, const char **name, uint8 *len)
+{
+    if (ad->type != gap_ad_type_localname_short && ad->type != gap_ad_type_localname_complete)
+        return 0;
+    *name = (const char *)ad->data;
+    *len = ad->len;
+    return 1;
+}
+
+unsigned gap_ad_uuid_count(const struct gap_ad *ad, uint8 *uuid_len)
+{
+    uint8 n;
+
+    switch (ad->type)
+    {
+        case gap_ad_type_services_16bit_more:
+        case gap_ad_type_services_16bit_all:
+        case gap_ad_type_solicit_16bit:
+            n = 2;
+            break;
+        case gap_ad_type_services_32bit_more:
+        case gap_ad_type_services_32bit_all:
+        case gap_ad_type_solicit_32bit:
+            n = 4;
+            break;
+        case gap_ad_type_services_128bit_more:
+        case gap_ad_type_services_128bit_all:
+        case gap_ad_type_solicit_128bit:
+            n = 16;
+            break;
+        default:
+            n = 0;
+            break;
+    }
+    if (uuid_len)
+        *uuid_len = n;
+    return n ? ad->len / n : 0;
+}
+
+int gap_ad_has_uuid16(const uint8 *data, unsigned len, uint16 uuid)
+{
+    struct gap_ad_iter it;
+    struct gap_ad ad;
+    unsigned i, n;
+    uint8 size;
+
+    gap_ad_iter_init(&it, data, len);
+    while (gap_ad_iter_next(&it, &ad) > 0)
+    {
+        n = gap_ad_uuid_count(&ad, &size);
+        if (!n || size != 2)
+            continue;
+        for (i = 0; i < n; i++)
+        {
+            if (le16(ad.data + 2 * i) == uuid)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+int gap_ad_has_uuid128(const uint8 *data, unsigned len, const uint8 uuid[16])
+{
+    struct gap_ad_iter it;
+    struct gap_ad ad;
+    unsigned i, n;
+    uint8 size;
+
+    gap_ad_iter_init(&it, data, len);
+    while (gap_ad_iter_next(&it, &ad) > 0)
+    {
+        n = gap_ad_uuid_count(&ad, &size);
+        if (!n || size != 16)
+            continue;
+        for (i = 0; i < n; i++)
+        {
+            if (!memcmp(ad.data + 16 * i, uuid, 16))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+const char *gap_ad_type_name(uint8 type)
+{
+    switch (type)
+    {
+        case gap_ad_type_flags:                   return "flags";
+        case gap_ad_type_services_16bit_more:     return "uuid16 (incomplete)";
+        case gap_ad_type_services_16bit_all:      return "uuid16";
+        case gap_ad_type_services_32bit_more:     return "uuid32 (incomplete)";
+        case gap_ad_type_services_32bit_all:      return "uuid32";
+        case gap_ad_type_services_128bit_more:    return "uuid128 (incomplete)";
+        case gap_ad_type_services_128bit_all:     return "uuid128";
+        case gap_ad_type_localname_short:         return "short name";
+        case gap_ad_type_localname_complete:      return "name";
+        case gap_ad_type_txpower:                 return "tx power";
+        case gap_ad_type_class_of_device:         return "class of device";
+        case gap_ad_type_conn_interval_range:     return "connection interval range";
+        case gap_ad_type_solicit_16bit:           return "solicitation uuid16";
+        case gap_ad_type_solicit_32bit:           return "solicitation uuid32";
+        case gap_ad_type_solicit_128bit:          return "solicitation uuid128";
+        case gap_ad_type_service_data_16bit:      return "service data uuid16";
+        case gap_ad_type_service_data_32bit:      return "service data uuid32";
+        case gap_ad_type_service_data_128bit:     return "service data uuid128";
+        case gap_ad_type_public_target:           return "public target address";
+        case gap_ad_type_random_target:           return "random target address";
+        case gap_ad_type_appearance:              return "appearance";
+        case gap_ad_type_adv_interval:            return "advertising interval";
+        case gap_ad_type_adv_interval_long:       return "advertising interval (long)";
+        case gap_ad_type_le_bd_addr:              return "le address";
+        case gap_ad_type_le_role:                 return "le role";
+        case gap_ad_type_uri:                     return "uri";
+        case gap_ad_type_indoor_positioning:      return "indoor positioning";
+        case gap_ad_type_transport_discovery:     return "transport discovery";
+        case gap_ad_type_le_features:             return "le supported features";
+        case gap_ad_type_pb_adv:                  return "pb-adv";
+        case gap_ad_type_mesh_message:            return "mesh message";
+        case gap_ad_type_mesh_beacon:             return "mesh beacon";
+        case gap_ad_type_resolvable_set_id:       return "resolvable set identifier";
+        case gap_ad_type_broadcast_name:          return "broadcast name";
+        case gap_ad_type_encrypted_data:          return "encrypted data";
+        case gap_ad_type_manufacturer_data:       return "manufacturer data";
+        default:                                  return "unknown";
+    }
+}
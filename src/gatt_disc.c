@@ -0,0 +1,638 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dispatch.h"
+#include "gatt_disc.h"
+#include "hash.h"
+
+#define MAGIC           0x43474742u     /* "BGGC" */
+#define VERSION         1
+#define DEFAULT_RECORDS 256
+#define DEFAULT_TIMEOUT 30000000000ull
+#define USED            (1ull << 63)
+#define TOMBSTONE       (~0ull)
+
+#define UUID_PRIMARY    0x2800
+#define UUID_SECONDARY  0x2801
+#define UUID_INCLUDE    0x2802
+#define UUID_CHAR       0x2803
+#define UUID_CCCD       0x2902
+
+struct cache_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t records;
+    uint32_t record_bytes;
+    uint64_t clock;                     /* last store stamp */
+    uint64_t reserved[5];
+};
+
+struct record
+{
+    uint64_t key;                       /* 0 empty, TOMBSTONE removed, else bglib_addr_key() | USED */
+    uint64_t check;                     /* over key, hash and the map */
+    uint64_t hash;
+    uint64_t stamp;
+    struct bglib_gatt_map map;
+};
+
+struct bglib_gatt_cache
+{
+    struct cache_header *hdr;
+    struct record *records;
+    void *base;
+    size_t bytes;
+};
+
+enum disc_state
+{
+    st_idle,
+    st_services,        /* read_by_group_type running */
+    st_attributes       /* find_information running */
+};
+
+struct entry
+{
+    uint8 state;
+    uint8 valid;                        /* map holds a reported result */
+    uint8 truncated;
+    uint8 decl_pending;                 /* last attribute was a characteristic declaration */
+    uint16 decl;                        /* its index */
+    uint16 services;                    /* service attributes, at the front while discovering */
+    uint16 cursor;                      /* service enclosing the last attribute */
+    uint64_t hash;
+    uint64_t start_ns;
+    struct bglib_gatt_map map;
+};
+
+struct adapter
+{
+    bglib_send_fn send;
+    void *user;
+    struct entry conns[BGLIB_CONN_HANDLES_MAX];
+};
+
+struct bglib_gatt_disc
+{
+    struct adapter adapters[BGLIB_CONN_ADAPTERS_MAX];
+    unsigned n;
+    struct bglib_gatt_cache *cache;
+    uint64_t timeout_ns;
+    bglib_gatt_disc_cb cb;
+    void *cb_user;
+    struct bglib_gatt_disc_stats stats;
+};
+
+static uint16 uuid16(const uint8 *uuid, uint8 len)
+{
+    return len == 2 ? uuid[0] | (uint16)uuid[1] << 8 : 0;
+}
+
+const struct bglib_gatt_attr *bglib_gatt_map_find(const struct bglib_gatt_map *map, uint16 service,
+                                                  const uint8 *uuid, uint8 uuid_len)
+{
+    unsigned i;
+
+    for (i = 0; i < map->count; i++)
+    {
+        const struct bglib_gatt_attr *a = &map->attrs[i];
+
+        if (a->kind == bglib_gatt_characteristic && (!service || a->service == service) &&
+            a->uuid_len == uuid_len && !memcmp(a->uuid, uuid, uuid_len))
+            return a;
+    }
+    return NULL;
+}
+
+uint16 bglib_gatt_map_cccd(const struct bglib_gatt_map *map, uint16 value_handle)
+{
+    unsigned i;
+
+    for (i = 0; i < map->count && map->attrs[i].handle <= value_handle; i++)
+        ;
+    /* descriptors follow the value up to the next declaration */
+    for (; i < map->count && map->attrs[i].kind == bglib_gatt_descriptor; i++)
+    {
+        if (uuid16(map->attrs[i].uuid, map->attrs[i].uuid_len) == UUID_CCCD)
+            return map->attrs[i].handle;
+    }
+    return 0;
+}
+
+/* cache */
+
+static size_t cache_bytes(unsigned records)
+{
+    return sizeof(struct cache_header) + (size_t)records * sizeof(struct record);
+}
+
+static unsigned map_bytes(const struct bglib_gatt_map *map)
+{
+    return offsetof(struct bglib_gatt_map, attrs) + map->count * sizeof(struct bglib_gatt_attr);
+}
+
+static uint64_t checksum(const struct record *r)
+{
+    return bglib_hash64(&r->map, map_bytes(&r->map), r->key ^ r->hash);
+}
+
+static int valid_header(const struct cache_header *hdr, size_t bytes)
+{
+    return hdr->magic == MAGIC && hdr->version == VERSION && hdr->records &&
+           hdr->record_bytes == sizeof(struct record) && cache_bytes(hdr->records) == bytes;
+}
+
+struct bglib_gatt_cache *bglib_gatt_cache_open(const char *path, unsigned records)
+{
+    struct bglib_gatt_cache *c;
+    struct stat st;
+    size_t bytes;
+    void *base;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    bytes = st.st_size;
+    if (bytes >= sizeof(struct cache_header))
+    {
+        base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base != MAP_FAILED && !valid_header(base, bytes))
+        {
+            munmap(base, bytes);
+            base = NULL;
+        }
+    }
+    else
+    {
+        base = NULL;
+    }
+
+    if (!base)
+    {
+        /* new or not a cache: start empty */
+        bytes = cache_bytes(records ? records : DEFAULT_RECORDS);
+        if (ftruncate(fd, 0) || ftruncate(fd, bytes))
+        {
+            close(fd);
+            return NULL;
+        }
+        base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base != MAP_FAILED)
+        {
+            struct cache_header *hdr = base;
+
+            hdr->version = VERSION;
+            hdr->records = records ? records : DEFAULT_RECORDS;
+            hdr->record_bytes = sizeof(struct record);
+            hdr->magic = MAGIC;
+        }
+    }
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    c = calloc(1, sizeof(*c));
+    if (!c)
+    {
+        munmap(base, bytes);
+        return NULL;
+    }
+    c->hdr = base;
+    c->records = (struct record *)(c->hdr + 1);
+    c->base = base;
+    c->bytes = bytes;
+    return c;
+}
+
+void bglib_gatt_cache_close(struct bglib_gatt_cache *c)
+{
+    if (!c)
+        return;
+    msync(c->base, c->bytes, MS_ASYNC);
+    munmap(c->base, c->bytes);
+    free(c);
+}
+
+int bglib_gatt_cache_sync(struct bglib_gatt_cache *c)
+{
+    return msync(c->base, c->bytes, MS_SYNC) ? -1 : 0;
+}
+
+/* linear probing; records are never emptied, only replaced or marked removed */
+static struct record *probe(const struct bglib_gatt_cache *c, uint64_t key, struct record **vacant)
+{
+    unsigned n = c->hdr->records;
+    unsigned slot = bglib_mix64(key) % n;
+    unsigned i;
+
+    if (vacant)
+        *vacant = NULL;
+    for (i = 0; i < n; i++, slot = slot + 1 == n ? 0 : slot + 1)
+    {
+        struct record *r = &c->records[slot];
+
+        if (r->key == key)
+            return r;
+        if (r->key == TOMBSTONE || !r->key)
+        {
+            if (vacant && !*vacant)
+                *vacant = r;
+            if (!r->key)
+                break;
+        }
+    }
+    return NULL;
+}
+
+int bglib_gatt_cache_lookup(const struct bglib_gatt_cache *c, const bd_addr *address, uint8 address_type,
+                            struct bglib_gatt_map *out, uint64_t *hash)
+{
+    const struct record *r = probe(c, bglib_addr_key(address, address_type) | USED, NULL);
+
+    if (!r || r->map.count > BGLIB_GATT_ATTRS_MAX || r->check != checksum(r))
+        return -1;
+    memcpy(out, &r->map, map_bytes(&r->map));
+    if (hash)
+        *hash = r->hash;
+    return 0;
+}
+
+int bglib_gatt_cache_store(struct bglib_gatt_cache *c, const struct bglib_gatt_map *map, uint64_t hash)
+{
+    uint64_t key = bglib_addr_key(&map->address, map->address_type) | USED;
+    struct record *r, *vacant;
+    unsigned i;
+
+    if (map->count > BGLIB_GATT_ATTRS_MAX)
+        return -1;
+    r = probe(c, key, &vacant);
+    if (!r)
+        r = vacant;
+    if (!r)
+    {
+        /* full: replace the oldest record */
+        r = &c->records[0];
+        for (i = 1; i < c->hdr->records; i++)
+        {
+            if (c->records[i].stamp < r->stamp)
+                r = &c->records[i];
+        }
+    }
+
+    /* a crash before check is written leaves a record that reads as a miss */
+    r->key = key;
+    r->hash = hash;
+    r->stamp = ++c->hdr->clock;
+    memcpy(&r->map, map, map_bytes(map));
+    r->check = checksum(r);
+    return 0;
+}
+
+void bglib_gatt_cache_remove(struct bglib_gatt_cache *c, const bd_addr *address, uint8 address_type)
+{
+    struct record *r = probe(c, bglib_addr_key(address, address_type) | USED, NULL);
+
+    if (r)
+        r->key = TOMBSTONE;
+}
+
+/* discovery */
+
+struct bglib_gatt_disc *bglib_gatt_disc_create(const struct bglib_conn_adapter *adapters, unsigned n,
+                                               struct bglib_gatt_cache *cache, uint64_t timeout_ns,
+                                               bglib_gatt_disc_cb cb, void *user)
+{
+    struct bglib_gatt_disc *d;
+    unsigned i;
+
+    if (!n || n > BGLIB_CONN_ADAPTERS_MAX)
+        return NULL;
+    d = calloc(1, sizeof(*d));
+    if (!d)
+        return NULL;
+    d->n = n;
+    for (i = 0; i < n; i++)
+    {
+        d->adapters[i].send = adapters[i].send;
+        d->adapters[i].user = adapters[i].user;
+    }
+    d->cache = cache;
+    d->timeout_ns = timeout_ns ? timeout_ns : DEFAULT_TIMEOUT;
+    d->cb = cb;
+    d->cb_user = user;
+    bglib_histogram_reset(&d->stats.discovery_us);
+    return d;
+}
+
+void bglib_gatt_disc_destroy(struct bglib_gatt_disc *d)
+{
+    free(d);
+}
+
+static struct entry *lookup(const struct bglib_gatt_disc *d, unsigned adapter, uint8 connection)
+{
+    if (adapter >= d->n || connection >= BGLIB_CONN_HANDLES_MAX)
+        return NULL;
+    return (struct entry *)&d->adapters[adapter].conns[connection];
+}
+
+static void fail(struct bglib_gatt_disc *d, unsigned adapter, uint8 connection, struct entry *e, uint16 result)
+{
+    e->state = st_idle;
+    e->valid = 0;
+    d->stats.failed++;
+    if (d->cb)
+        d->cb(d->cb_user, adapter, connection, NULL, bglib_gatt_failed, result);
+}
+
+int bglib_gatt_disc_start(struct bglib_gatt_disc *d, unsigned adapter, uint8 connection, const bd_addr *address,
+                          uint8 address_type, uint64_t hash, uint64_t now_ns)
+{
+    static const uint8 primary[2] = {UUID_PRIMARY & 0xff, UUID_PRIMARY >> 8};
+    struct entry *e = lookup(d, adapter, connection);
+    uint64_t stored;
+
+    if (!e || e->state != st_idle)
+        return -1;
+    d->stats.started++;
+    if (d->cache && !bglib_gatt_cache_lookup(d->cache, address, address_type, &e->map, &stored))
+    {
+        if (!hash || hash == stored)
+        {
+            d->stats.cache_hits++;
+            e->valid = 1;
+            if (d->cb)
+                d->cb(d->cb_user, adapter, connection, &e->map, bglib_gatt_cached, 0);
+            return 1;
+        }
+        d->stats.cache_stale++;
+    }
+
+    memset(&e->map, 0, offsetof(struct bglib_gatt_map, attrs));
+    memcpy(&e->map.address, address, sizeof(*address));
+    e->map.address_type = address_type;
+    e->state = st_services;
+    e->valid = 0;
+    e->truncated = 0;
+    e->decl_pending = 0;
+    e->services = 0;
+    e->cursor = 0;
+    e->hash = hash;
+    e->start_ns = now_ns;
+    bglib_frame_send(d->adapters[adapter].send, d->adapters[adapter].user, ble_cmd_attclient_read_by_group_type_idx,
+                     connection, 0x0001, 0xffff, (int)sizeof(primary), primary);
+    return 0;
+}
+
+static struct bglib_gatt_attr *append(struct entry *e, uint16 handle, uint8 kind, const uint8array *uuid)
+{
+    struct bglib_gatt_attr *a;
+
+    if (e->map.count == BGLIB_GATT_ATTRS_MAX || uuid->len > sizeof(a->uuid))
+    {
+        e->truncated = 1;
+        return NULL;
+    }
+    a = &e->map.attrs[e->map.count++];
+    memset(a, 0, sizeof(*a));
+    a->handle = handle;
+    a->kind = kind;
+    a->uuid_len = uuid->len;
+    memcpy(a->uuid, uuid->data, uuid->len);
+    return a;
+}
+
+static void on_service(struct entry *e, const struct ble_msg_attclient_group_found_evt_t *evt)
+{
+    struct bglib_gatt_attr *a = append(e, evt->start, bglib_gatt_service, &evt->uuid);
+
+    if (!a)
+        return;
+    a->end = evt->end;
+    a->service = evt->start;
+    e->services++;
+}
+
+static void on_attribute(struct entry *e, const struct ble_msg_attclient_find_information_found_evt_t *evt)
+{
+    const struct bglib_gatt_attr *svc = e->map.attrs;
+    uint16 type = uuid16(evt->uuid.data, evt->uuid.len);
+    struct bglib_gatt_attr *a;
+    uint8 kind;
+
+    /* attributes arrive in handle order, and so did the services */
+    while (e->cursor + 1 < e->services && svc[e->cursor + 1].handle <= evt->chrhandle)
+        e->cursor++;
+    if (type == UUID_PRIMARY && svc[e->cursor].handle == evt->chrhandle)
+        return;
+
+    if (e->decl_pending)
+    {
+        /* the value directly follows its declaration */
+        e->decl_pending = 0;
+        a = append(e, evt->chrhandle, bglib_gatt_value, &evt->uuid);
+        if (!a)
+            return;
+        a->service = svc[e->cursor].handle;
+        a = &e->map.attrs[e->decl];
+        a->end = evt->chrhandle;
+        a->uuid_len = evt->uuid.len;
+        memcpy(a->uuid, evt->uuid.data, evt->uuid.len);
+        return;
+    }
+
+    switch (type)
+    {
+        case UUID_SECONDARY:
+            kind = bglib_gatt_secondary;
+            break;
+        case UUID_INCLUDE:
+            kind = bglib_gatt_include;
+            break;
+        case UUID_CHAR:
+            kind = bglib_gatt_characteristic;
+            break;
+        default:
+            kind = bglib_gatt_descriptor;
+            break;
+    }
+    a = append(e, evt->chrhandle, kind, &evt->uuid);
+    if (!a)
+        return;
+    a->service = svc[e->cursor].handle;
+    if (kind == bglib_gatt_characteristic)
+    {
+        e->decl_pending = 1;
+        e->decl = e->map.count - 1;
+    }
+}
+
+static int cmp_handle(const void *a, const void *b)
+{
+    const struct bglib_gatt_attr *x = a, *y = b;
+
+    return (x->handle > y->handle) - (x->handle < y->handle);
+}
+
+static void on_completed(struct bglib_gatt_disc *d, unsigned adapter, uint8 connection, struct entry *e,
+                         uint16 result, uint64_t now)
+{
+    /* att_not_found only says the range had nothing more */
+    if (result && result != ble_err_att_att_not_found)
+    {
+        fail(d, adapter, connection, e, result);
+        return;
+    }
+    if (e->truncated)
+    {
+        fail(d, adapter, connection, e, BGLIB_GATT_REASON_TRUNCATED);
+        return;
+    }
+
+    if (e->state == st_services && e->services)
+    {
+        e->state = st_attributes;
+        bglib_frame_send(d->adapters[adapter].send, d->adapters[adapter].user, ble_cmd_attclient_find_information_idx,
+                         connection, e->map.attrs[0].handle, e->map.attrs[e->services - 1].end);
+        return;
+    }
+
+    qsort(e->map.attrs, e->map.count, sizeof(e->map.attrs[0]), cmp_handle);
+    e->state = st_idle;
+    e->valid = 1;
+    d->stats.discovered++;
+    bglib_histogram_record(&d->stats.discovery_us, (now - e->start_ns) / 1000);
+    if (d->cache)
+        bglib_gatt_cache_store(d->cache, &e->map, e->hash);
+    if (d->cb)
+        d->cb(d->cb_user, adapter, connection, &e->map, bglib_gatt_discovered, 0);
+}
+
+static void reset_adapter(struct bglib_gatt_disc *d, unsigned adapter, uint16 reason)
+{
+    unsigned h;
+
+    for (h = 0; h < BGLIB_CONN_HANDLES_MAX; h++)
+    {
+        struct entry *e = &d->adapters[adapter].conns[h];
+
+        if (e->state != st_idle)
+            fail(d, adapter, h, e, reason);
+        e->valid = 0;
+    }
+}
+
+int bglib_gatt_disc_on_message(struct bglib_gatt_disc *d, unsigned adapter, const struct ble_header *hdr,
+                               const uint8 *payload, uint64_t now_ns)
+{
+    const struct ble_msg *msg = bglib_lookup_msg(hdr);
+    unsigned len = bglib_payload_len(hdr);
+    struct entry *e;
+    unsigned idx;
+
+    if (!msg || adapter >= d->n || !len)
+        return 0;
+    idx = bglib_msg_index(msg);
+
+    switch (idx)
+    {
+        case ble_evt_system_boot_idx:
+            reset_adapter(d, adapter, BGLIB_GATT_REASON_RESET);
+            return 0;
+
+        case ble_evt_connection_disconnected_idx:
+            e = lookup(d, adapter, payload[0]);
+            if (!e)
+                return 0;
+            if (e->state != st_idle)
+                fail(d, adapter, payload[0], e,
+                     ((const struct ble_msg_connection_disconnected_evt_t *)payload)->reason);
+            e->valid = 0;
+            return 0;
+
+        case ble_rsp_attclient_read_by_group_type_idx:
+        case ble_rsp_attclient_find_information_idx:
+        case ble_evt_attclient_group_found_idx:
+        case ble_evt_attclient_find_information_found_idx:
+        case ble_evt_attclient_procedure_completed_idx:
+            break;
+
+        default:
+            return 0;
+    }
+
+    /* attclient messages all start with the connection handle */
+    e = lookup(d, adapter, payload[0]);
+    if (!e || e->state == st_idle)
+        return 0;
+    switch (idx)
+    {
+        case ble_rsp_attclient_read_by_group_type_idx:
+        case ble_rsp_attclient_find_information_idx:
+        {
+            uint16 result = ((const struct ble_msg_attclient_find_information_rsp_t *)payload)->result;
+
+            if (result)
+                fail(d, adapter, payload[0], e, result);
+            break;
+        }
+
+        case ble_evt_attclient_group_found_idx:
+            if (e->state == st_services)
+                on_service(e, (const struct ble_msg_attclient_group_found_evt_t *)payload);
+            break;
+
+        case ble_evt_attclient_find_information_found_idx:
+            if (e->state == st_attributes)
+                on_attribute(e, (const struct ble_msg_attclient_find_information_found_evt_t *)payload);
+            break;
+
+        case ble_evt_attclient_procedure_completed_idx:
+            on_completed(d, adapter, payload[0], e,
+                         ((const struct ble_msg_attclient_procedure_completed_evt_t *)payload)->result, now_ns);
+            break;
+    }
+    return 1;
+}
+
+void bglib_gatt_disc_poll(struct bglib_gatt_disc *d, uint64_t now_ns)
+{
+    unsigned i, h;
+
+    for (i = 0; i < d->n; i++)
+    {
+        for (h = 0; h < BGLIB_CONN_HANDLES_MAX; h++)
+        {
+            struct entry *e = &d->adapters[i].conns[h];
+
+            if (e->state != st_idle && now_ns - e->start_ns >= d->timeout_ns)
+                fail(d, i, h, e, BGLIB_GATT_REASON_TIMEOUT);
+        }
+    }
+}
+
+const struct bglib_gatt_map *bglib_gatt_disc_map(const struct bglib_gatt_disc *d, unsigned adapter,
+                                                 uint8 connection)
+{
+    const struct entry *e = lookup(d, adapter, connection);
+
+    return e && e->valid ? &e->map : NULL;
+}
+
+void bglib_gatt_disc_get_stats(const struct bglib_gatt_disc *d, struct bglib_gatt_disc_stats *out)
+{
+    *out = d->stats;
+}
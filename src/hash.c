@@ -0,0 +1,113 @@
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "hash.h"
+
+#define P1 0x9e3779b185ebca87ull
+#define P2 0xc2b2ae3d27d4eb4full
+
+static uint64_t load64(const uint8 *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t bglib_hash64(const void *data, unsigned len, uint64_t seed)
+{
+    const uint8 *p = data;
+    uint64_t h = seed ^ (len * P1);
+    uint64_t tail = 0;
+
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        h ^= bglib_mix64(load64(p) * P2);
+        h = (h << 27 | h >> 37) * P1 + P2;
+    }
+    if (len)
+    {
+        memcpy(&tail, p, len);
+        h ^= bglib_mix64(tail * P2);
+        h = (h << 27 | h >> 37) * P1 + P2;
+    }
+
+    return bglib_mix64(h);
+}
+
+/* xxh3-style stripe: each lane multiplies its halves after keying and adds its neighbour */
+static const uint64_t stripe_keys[4] =
+{
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull
+};
+
+static uint32_t load32(const uint8 *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t bglib_hash_ad(const void *data, unsigned len)
+{
+    const uint8 *p = data;
+    uint64_t d[4] = { 0, 0, 0, 0 };
+    uint64_t acc[4];
+
+    /* overlapping head and tail loads, no padding copy; len goes into the final mix */
+    if (len > 32)
+        return bglib_hash64(data, len, 0);
+    if (len >= 16)
+    {
+        d[0] = load64(p);
+        d[1] = load64(p + 8);
+        d[2] = load64(p + len - 16);
+        d[3] = load64(p + len - 8);
+    }
+    else if (len >= 8)
+    {
+        d[0] = load64(p);
+        d[1] = load64(p + len - 8);
+    }
+    else if (len >= 4)
+    {
+        d[0] = load32(p) | (uint64_t)load32(p + len - 4) << 32;
+    }
+    else if (len)
+    {
+        d[0] = p[0] | (uint64_t)p[len / 2] << 8 | (uint64_t)p[len - 1] << 16;
+    }
+
+#if defined(__SSE2__)
+    {
+        __m128i d0 = _mm_loadu_si128((const __m128i *)d);
+        __m128i d1 = _mm_loadu_si128((const __m128i *)(d + 2));
+        __m128i x0 = _mm_xor_si128(d0, _mm_loadu_si128((const __m128i *)stripe_keys));
+        __m128i x1 = _mm_xor_si128(d1, _mm_loadu_si128((const __m128i *)(stripe_keys + 2)));
+        __m128i a0 = _mm_add_epi64(_mm_mul_epu32(x0, _mm_srli_epi64(x0, 32)),
+                                   _mm_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+        __m128i a1 = _mm_add_epi64(_mm_mul_epu32(x1, _mm_srli_epi64(x1, 32)),
+                                   _mm_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+
+        _mm_storeu_si128((__m128i *)acc, a0);
+        _mm_storeu_si128((__m128i *)(acc + 2), a1);
+    }
+#else
+    {
+        unsigned i;
+
+        for (i = 0; i < 4; i++)
+        {
+            uint64_t x = d[i] ^ stripe_keys[i];
+
+            acc[i] = (x & 0xffffffff) * (x >> 32) + d[i ^ 1];
+        }
+    }
+#endif
+
+    return bglib_mix64((acc[0] ^ acc[1] * P1) + (acc[2] ^ acc[3] * P2) + len);
+}
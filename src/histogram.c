@@ -0,0 +1,77 @@
+#include <string.h>
+
+#include "histogram.h"
+
+static unsigned bucket_of(uint64_t value)
+{
+    return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+void bglib_histogram_reset(struct bglib_histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void bglib_histogram_record(struct bglib_histogram *h, uint64_t value)
+{
+    uint64_t cur;
+    unsigned b = bucket_of(value);
+
+    if (b >= BGLIB_HISTOGRAM_BUCKETS)
+        b = BGLIB_HISTOGRAM_BUCKETS - 1;
+
+    __atomic_fetch_add(&h->buckets[b], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+    cur = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while (value < cur &&
+           !__atomic_compare_exchange_n(&h->min, &cur, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    cur = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (value > cur &&
+           !__atomic_compare_exchange_n(&h->max, &cur, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void bglib_histogram_snapshot(const struct bglib_histogram *h, struct bglib_histogram *out)
+{
+    int i;
+
+    out->count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    out->sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+    out->min = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    out->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    for (i = 0; i < BGLIB_HISTOGRAM_BUCKETS; i++)
+        out->buckets[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+}
+
+uint64_t bglib_histogram_percentile(const struct bglib_histogram *h, double percentile)
+{
+    uint64_t total = 0;
+    uint64_t rank;
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < BGLIB_HISTOGRAM_BUCKETS; i++)
+        total += h->buckets[i];
+    if (!total)
+        return 0;
+
+    rank = (uint64_t)(total * percentile / 100.0);
+    if (rank >= total)
+        rank = total - 1;
+
+    for (i = 0; i < BGLIB_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen > rank)
+            break;
+    }
+    if (i == 0)
+        return 0;
+    if (i >= 63)
+        return h->max;
+    return ((uint64_t)1 << i) - 1 < h->max ? ((uint64_t)1 << i) - 1 : h->max;
+}
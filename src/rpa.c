@@ -0,0 +1,367 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RPA_AESNI 1
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#include "hash.h"
+#include "rpa.h"
+
+#define USED            ((uint64_t)1 << 63)
+#define NONE            0xffffffffu
+#define DEFAULT_CACHE   4096
+#define BATCH           8
+
+struct round_keys
+{
+    uint8 k[11][16];
+} __attribute__((aligned(16)));
+
+struct cache_entry
+{
+    uint64_t key;
+    uint32_t gen;
+    uint32_t id;        /* NONE: no IRK matches */
+};
+
+struct bglib_rpa_resolver
+{
+    struct round_keys *keys;
+    uint32_t *ids;
+    unsigned count;
+    unsigned alloc;
+
+    struct cache_entry *cache;
+    unsigned cache_mask;
+    uint32_t gen;
+
+    int aesni;
+    struct bglib_rpa_stats stats;
+};
+
+static const uint8 sbox[256] =
+{
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+/* T-tables of the portable path, built on first use */
+static uint32_t te[4][256];
+static pthread_once_t te_once = PTHREAD_ONCE_INIT;
+
+static uint8 xtime(uint8 x)
+{
+    return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+static uint32_t ror8(uint32_t x)
+{
+    return x >> 8 | x << 24;
+}
+
+static void build_tables(void)
+{
+    unsigned i;
+
+    for (i = 0; i < 256; i++)
+    {
+        uint8 s = sbox[i];
+        uint8 s2 = xtime(s);
+
+        te[0][i] = (uint32_t)s2 << 24 | (uint32_t)s << 16 | (uint32_t)s << 8 | (uint8)(s2 ^ s);
+        te[1][i] = ror8(te[0][i]);
+        te[2][i] = ror8(te[1][i]);
+        te[3][i] = ror8(te[2][i]);
+    }
+}
+
+static uint32_t get32(const uint8 *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* FIPS-197 key expansion; AES-NI consumes the same byte layout */
+static void expand_key(struct round_keys *rk, const uint8 key[16])
+{
+    uint8 *w = rk->k[0];
+    uint8 rcon = 1;
+    unsigned i;
+
+    memcpy(w, key, 16);
+    for (i = 16; i < 176; i += 4)
+    {
+        uint8 t[4];
+
+        memcpy(t, w + i - 4, 4);
+        if (i % 16 == 0)
+        {
+            uint8 t0 = t[0];
+
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[t0];
+            rcon = xtime(rcon);
+        }
+        w[i + 0] = w[i - 16 + 0] ^ t[0];
+        w[i + 1] = w[i - 16 + 1] ^ t[1];
+        w[i + 2] = w[i - 16 + 2] ^ t[2];
+        w[i + 3] = w[i - 16 + 3] ^ t[3];
+    }
+}
+
+/* e(k, 0^104 || prand) mod 2^24 with T-tables */
+static uint32_t ah_portable(const struct round_keys *rk, uint32_t prand)
+{
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    unsigned r;
+
+    s0 = get32(rk->k[0]);
+    s1 = get32(rk->k[0] + 4);
+    s2 = get32(rk->k[0] + 8);
+    s3 = get32(rk->k[0] + 12) ^ prand;
+
+    for (r = 1; r < 10; r++)
+    {
+        const uint8 *k = rk->k[r];
+
+        t0 = te[0][s0 >> 24] ^ te[1][(s1 >> 16) & 0xff] ^ te[2][(s2 >> 8) & 0xff] ^ te[3][s3 & 0xff] ^ get32(k);
+        t1 = te[0][s1 >> 24] ^ te[1][(s2 >> 16) & 0xff] ^ te[2][(s3 >> 8) & 0xff] ^ te[3][s0 & 0xff] ^ get32(k + 4);
+        t2 = te[0][s2 >> 24] ^ te[1][(s3 >> 16) & 0xff] ^ te[2][(s0 >> 8) & 0xff] ^ te[3][s1 & 0xff] ^ get32(k + 8);
+        t3 = te[0][s3 >> 24] ^ te[1][(s0 >> 16) & 0xff] ^ te[2][(s1 >> 8) & 0xff] ^ te[3][s2 & 0xff] ^ get32(k + 12);
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    /* last round, only the three low bytes of the last column are needed */
+    return ((uint32_t)sbox[(s0 >> 16) & 0xff] << 16 | (uint32_t)sbox[(s1 >> 8) & 0xff] << 8 | sbox[s2 & 0xff]) ^
+           (get32(rk->k[10] + 12) & 0xffffff);
+}
+
+#ifdef RPA_AESNI
+__attribute__((target("aes,sse2")))
+static unsigned match_aesni(const struct round_keys *keys, unsigned n, uint32_t prand, uint32_t hash)
+{
+    uint8 in[16] = { 0 };
+    __m128i block;
+    unsigned i, j, r;
+
+    in[13] = prand >> 16;
+    in[14] = prand >> 8;
+    in[15] = prand;
+    block = _mm_loadu_si128((const __m128i *)in);
+
+    /* eight independent blocks in flight hide the aesenc latency */
+    for (i = 0; i + BATCH <= n; i += BATCH)
+    {
+        __m128i b[BATCH];
+
+        for (j = 0; j < BATCH; j++)
+            b[j] = _mm_xor_si128(block, _mm_load_si128((const __m128i *)keys[i + j].k[0]));
+        for (r = 1; r < 10; r++)
+        {
+            for (j = 0; j < BATCH; j++)
+                b[j] = _mm_aesenc_si128(b[j], _mm_load_si128((const __m128i *)keys[i + j].k[r]));
+        }
+        for (j = 0; j < BATCH; j++)
+        {
+            b[j] = _mm_aesenclast_si128(b[j], _mm_load_si128((const __m128i *)keys[i + j].k[10]));
+            if ((__builtin_bswap32(_mm_cvtsi128_si32(_mm_srli_si128(b[j], 12))) & 0xffffff) == hash)
+                return i + j;
+        }
+    }
+
+    for (; i < n; i++)
+    {
+        __m128i b = _mm_xor_si128(block, _mm_load_si128((const __m128i *)keys[i].k[0]));
+
+        for (r = 1; r < 10; r++)
+            b = _mm_aesenc_si128(b, _mm_load_si128((const __m128i *)keys[i].k[r]));
+        b = _mm_aesenclast_si128(b, _mm_load_si128((const __m128i *)keys[i].k[10]));
+        if ((__builtin_bswap32(_mm_cvtsi128_si32(_mm_srli_si128(b, 12))) & 0xffffff) == hash)
+            return i;
+    }
+    return NONE;
+}
+#endif
+
+static unsigned match_portable(const struct round_keys *keys, unsigned n, uint32_t prand, uint32_t hash)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (ah_portable(&keys[i], prand) == hash)
+            return i;
+    }
+    return NONE;
+}
+
+uint32_t bglib_rpa_ah(const uint8 irk[16], uint32_t prand)
+{
+    struct round_keys rk;
+
+    pthread_once(&te_once, build_tables);
+    expand_key(&rk, irk);
+    return ah_portable(&rk, prand & 0xffffff);
+}
+
+struct bglib_rpa_resolver *bglib_rpa_create(unsigned cache_size)
+{
+    struct bglib_rpa_resolver *r = calloc(1, sizeof(*r));
+    unsigned size = 1;
+
+    if (!r)
+        return NULL;
+    pthread_once(&te_once, build_tables);
+
+    if (!cache_size)
+        cache_size = DEFAULT_CACHE;
+    while (size < cache_size)
+        size <<= 1;
+    r->cache = calloc(size, sizeof(*r->cache));
+    if (!r->cache)
+    {
+        free(r);
+        return NULL;
+    }
+    r->cache_mask = size - 1;
+    r->gen = 1;
+#ifdef RPA_AESNI
+    r->aesni = __builtin_cpu_supports("aes");
+#endif
+    return r;
+}
+
+void bglib_rpa_destroy(struct bglib_rpa_resolver *r)
+{
+    if (!r)
+        return;
+    free(r->keys);
+    free(r->ids);
+    free(r->cache);
+    free(r);
+}
+
+int bglib_rpa_add_irk(struct bglib_rpa_resolver *r, const uint8 irk[16], uint32_t id)
+{
+    if (r->count == r->alloc)
+    {
+        unsigned alloc = r->alloc ? 2 * r->alloc : 64;
+        struct round_keys *keys = aligned_alloc(16, alloc * sizeof(*keys));
+        uint32_t *ids = realloc(r->ids, alloc * sizeof(*ids));
+
+        if (ids)
+            r->ids = ids;
+        if (!keys || !ids)
+        {
+            free(keys);
+            return -1;
+        }
+        if (r->count)
+            memcpy(keys, r->keys, r->count * sizeof(*keys));
+        free(r->keys);
+        r->keys = keys;
+        r->alloc = alloc;
+    }
+
+    expand_key(&r->keys[r->count], irk);
+    r->ids[r->count++] = id;
+    r->gen++;
+    return 0;
+}
+
+int bglib_rpa_remove_irk(struct bglib_rpa_resolver *r, uint32_t id)
+{
+    unsigned i;
+
+    for (i = 0; i < r->count; i++)
+    {
+        if (r->ids[i] == id)
+        {
+            r->count--;
+            r->keys[i] = r->keys[r->count];
+            r->ids[i] = r->ids[r->count];
+            r->gen++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int bglib_rpa_resolve(struct bglib_rpa_resolver *r, const bd_addr *addr, uint32_t *id)
+{
+    uint64_t key = bglib_addr_key(addr, 0) | USED;
+    struct cache_entry *c = &r->cache[bglib_mix64(key) & r->cache_mask];
+    uint32_t prand = (uint32_t)(key >> 24) & 0xffffff;
+    uint32_t hash = (uint32_t)key & 0xffffff;
+    unsigned i;
+
+    r->stats.lookups++;
+    if (c->key == key && c->gen == r->gen)
+    {
+        r->stats.cache_hits++;
+        if (c->id == NONE)
+            return 0;
+        *id = c->id;
+        return 1;
+    }
+
+#ifdef RPA_AESNI
+    if (r->aesni)
+        i = match_aesni(r->keys, r->count, prand, hash);
+    else
+#endif
+        i = match_portable(r->keys, r->count, prand, hash);
+    r->stats.aes_blocks += i == NONE ? r->count : i + 1;
+
+    c->key = key;
+    c->gen = r->gen;
+    c->id = i == NONE ? NONE : r->ids[i];
+    if (i == NONE)
+        return 0;
+    r->stats.resolved++;
+    *id = c->id;
+    return 1;
+}
+
+void bglib_rpa_set_portable(struct bglib_rpa_resolver *r, int portable)
+{
+#ifdef RPA_AESNI
+    r->aesni = !portable && __builtin_cpu_supports("aes");
+#else
+    (void)r;
+    (void)portable;
+#endif
+}
+
+const char *bglib_rpa_backend(const struct bglib_rpa_resolver *r)
+{
+    return r->aesni ? "aes-ni" : "portable";
+}
+
+void bglib_rpa_get_stats(const struct bglib_rpa_resolver *r, struct bglib_rpa_stats *out)
+{
+    *out = r->stats;
+    out->irks = r->count;
+}
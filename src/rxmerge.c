@@ -0,0 +1,260 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rxmerge.h"
+
+#define BLOCK           16      /* timer events per envelope point */
+#define TICK_NS         (1e9 / 32768)
+
+struct lane
+{
+    struct bglib_rx_frame *q;
+    unsigned head;
+    unsigned tail;
+    uint64_t last_ns;           /* time_ns of the newest queued frame */
+    int active;
+
+    /* soft timer estimate */
+    int timer;
+    uint8 handle;
+    uint64_t send_ns;
+    double period_ns;
+    uint64_t k;
+    int64_t blk_min;
+    uint64_t blk_k;
+    unsigned blk_n;
+    int64_t r0;                 /* envelope: minimum of the first block ... */
+    uint64_t k0;
+    int have0;
+    double slope;               /* ... and its rise per event from later blocks */
+    struct bglib_rxmerge_clock clock;
+};
+
+struct bglib_rxmerge
+{
+    unsigned n;
+    unsigned mask;
+    uint64_t window_ns;
+    uint64_t last_ns;           /* time_ns of the newest emitted frame */
+    struct bglib_rxmerge_stats stats;
+    struct lane lanes[BGLIB_RXMERGE_ADAPTERS_MAX];
+};
+
+struct bglib_rxmerge *bglib_rxmerge_create(unsigned adapters, unsigned capacity, uint64_t window_ns)
+{
+    struct bglib_rxmerge *m;
+    unsigned size = 16;
+    unsigned i;
+
+    if (!adapters || adapters > BGLIB_RXMERGE_ADAPTERS_MAX)
+        return NULL;
+    m = calloc(1, sizeof(*m));
+    if (!m)
+        return NULL;
+    while (size < capacity)
+        size <<= 1;
+    m->n = adapters;
+    m->mask = size - 1;
+    m->window_ns = window_ns ? window_ns : 5000000;
+    for (i = 0; i < adapters; i++)
+    {
+        m->lanes[i].q = malloc(size * sizeof(struct bglib_rx_frame));
+        if (!m->lanes[i].q)
+        {
+            bglib_rxmerge_destroy(m);
+            return NULL;
+        }
+    }
+    return m;
+}
+
+void bglib_rxmerge_destroy(struct bglib_rxmerge *m)
+{
+    unsigned i;
+
+    if (!m)
+        return;
+    for (i = 0; i < m->n; i++)
+        free(m->lanes[i].q);
+    free(m);
+}
+
+static int is_timer_event(const struct lane *l, const struct bglib_rx_frame *rx)
+{
+    const struct ble_header *hdr = bglib_rx_header(rx);
+
+    return l->timer && (hdr->type_hilen & 0x80) == ble_msg_type_evt && hdr->cls == ble_cls_hardware &&
+           hdr->command == ble_evt_hardware_soft_timer_id && rx->frame.len > sizeof(*hdr) &&
+           bglib_rx_payload(rx)[0] == l->handle;
+}
+
+static void timer_event(struct lane *l, uint64_t mono_ns)
+{
+    struct bglib_rxmerge_clock *c = &l->clock;
+    int64_t r;
+    double line;
+    double base;
+
+    l->k++;
+    r = (int64_t)(mono_ns - l->send_ns) - (int64_t)(l->k * l->period_ns);
+    if (!l->blk_n || r < l->blk_min)
+    {
+        l->blk_min = r;
+        l->blk_k = l->k;
+    }
+    if (++l->blk_n == BLOCK)
+    {
+        if (!l->have0)
+        {
+            l->r0 = l->blk_min;
+            l->k0 = l->blk_k;
+            l->have0 = 1;
+        }
+        else if (l->blk_k > l->k0)
+        {
+            l->slope = (double)(l->blk_min - l->r0) / (double)(l->blk_k - l->k0);
+        }
+        l->blk_n = 0;
+    }
+
+    if (l->have0)
+    {
+        base = l->r0 - l->slope * (double)l->k0;
+        line = l->r0 + l->slope * ((double)l->k - (double)l->k0);
+    }
+    else
+    {
+        base = line = (double)l->blk_min;
+    }
+    c->samples++;
+    c->latency_ns = base > 0 ? (int64_t)(base / 2) : 0;
+    c->offset_ns = (int64_t)l->send_ns + c->latency_ns;
+    c->drift_ppm = l->slope / l->period_ns * 1e6;
+    if (r > line)
+        c->jitter_ns += ((int64_t)(r - line) - (int64_t)c->jitter_ns) / 16;
+}
+
+int bglib_rxmerge_push(struct bglib_rxmerge *m, const struct bglib_rx_frame *rx)
+{
+    struct lane *l;
+    struct bglib_rx_frame *slot;
+    uint64_t t;
+
+    if (rx->adapter >= m->n)
+        return -1;
+    l = &m->lanes[rx->adapter];
+    if (l->tail - l->head > m->mask)
+    {
+        m->stats.full++;
+        return -1;
+    }
+    if (is_timer_event(l, rx))
+        timer_event(l, rx->mono_ns);
+
+    /* keep each queue sorted when the estimate moves */
+    t = rx->mono_ns - (uint64_t)l->clock.latency_ns;
+    if (t < l->last_ns)
+        t = l->last_ns;
+    l->last_ns = t;
+    l->active = 1;
+
+    slot = &l->q[l->tail++ & m->mask];
+    memcpy(slot, rx, offsetof(struct bglib_rx_frame, frame.data) + rx->frame.len);
+    slot->time_ns = t;
+    m->stats.pushed++;
+    return 0;
+}
+
+static int take(struct bglib_rxmerge *m, int wait, uint64_t now_ns, struct bglib_rx_frame *out)
+{
+    struct lane *best = NULL;
+    const struct bglib_rx_frame *head;
+    int all = 1;
+    unsigned i;
+
+    for (i = 0; i < m->n; i++)
+    {
+        struct lane *l = &m->lanes[i];
+
+        if (l->head == l->tail)
+        {
+            all &= !l->active;
+            continue;
+        }
+        if (!best || l->q[l->head & m->mask].time_ns < best->q[best->head & m->mask].time_ns)
+            best = l;
+    }
+    if (!best)
+        return 0;
+    head = &best->q[best->head & m->mask];
+    if (wait && !all && head->time_ns + m->window_ns > now_ns)
+        return 0;
+
+    memcpy(out, head, offsetof(struct bglib_rx_frame, frame.data) + head->frame.len);
+    best->head++;
+    m->stats.emitted++;
+    if (out->time_ns < m->last_ns)
+    {
+        m->stats.late++;
+        if (m->last_ns - out->time_ns > m->stats.max_reorder_ns)
+            m->stats.max_reorder_ns = m->last_ns - out->time_ns;
+    }
+    else
+    {
+        m->last_ns = out->time_ns;
+    }
+    return 1;
+}
+
+int bglib_rxmerge_pop(struct bglib_rxmerge *m, uint64_t now_ns, struct bglib_rx_frame *out)
+{
+    return take(m, 1, now_ns, out);
+}
+
+int bglib_rxmerge_flush(struct bglib_rxmerge *m, struct bglib_rx_frame *out)
+{
+    return take(m, 0, 0, out);
+}
+
+void bglib_rxmerge_timer_started(struct bglib_rxmerge *m, unsigned adapter, uint8 handle,
+                                 uint64_t send_ns, uint32_t ticks)
+{
+    struct lane *l;
+
+    if (adapter >= m->n || !ticks)
+        return;
+    l = &m->lanes[adapter];
+    l->timer = 1;
+    l->handle = handle;
+    l->send_ns = send_ns;
+    l->period_ns = ticks * TICK_NS;
+    l->k = 0;
+    l->blk_n = 0;
+    l->have0 = 0;
+    l->slope = 0;
+    memset(&l->clock, 0, sizeof(l->clock));
+}
+
+void bglib_rxmerge_set_latency(struct bglib_rxmerge *m, unsigned adapter, int64_t latency_ns)
+{
+    if (adapter >= m->n)
+        return;
+    m->lanes[adapter].timer = 0;
+    m->lanes[adapter].clock.latency_ns = latency_ns;
+}
+
+void bglib_rxmerge_get_clock(const struct bglib_rxmerge *m, unsigned adapter, struct bglib_rxmerge_clock *out)
+{
+    if (adapter >= m->n)
+    {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    *out = m->lanes[adapter].clock;
+}
+
+void bglib_rxmerge_get_stats(const struct bglib_rxmerge *m, struct bglib_rxmerge_stats *out)
+{
+    *out = m->stats;
+}
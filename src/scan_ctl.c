@@ -0,0 +1,400 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dispatch.h"
+#include "scan_ctl.h"
+
+#define DEFAULT_BAUD      115200
+#define DEFAULT_TARGET    0.6f
+#define DEFAULT_FILL_HIGH 0.5f
+#define DEFAULT_INTERVAL  160
+#define DEFAULT_PERIOD    1000000000ull
+#define DEFAULT_HOLD      10000000000ull
+#define DEFAULT_RETRY     1000000000ull
+#define UP_MARGIN         0.85f     /* step up only if the estimate leaves this much of the target */
+
+enum ctl_state
+{
+    st_idle,
+    st_end_sent,
+    st_params_sent,
+    st_filter_sent,
+    st_discover_sent,
+    st_scanning,
+    st_retry
+};
+
+struct bglib_scan_ctl
+{
+    bglib_send_fn send;
+    void *user;
+    struct bglib_scan_ctl_level levels[BGLIB_SCAN_CTL_LEVELS_MAX];
+    unsigned nlevels;
+    unsigned level;
+    unsigned applied;           /* level being or last sent to the adapter */
+    uint8 state;
+    uint8 mode;
+    uint16 interval;
+    int running;
+
+    float bytes_per_s;          /* line capacity */
+    float target;
+    float fill_high;
+    uint64_t period_ns;
+    uint64_t hold_ns;
+    uint64_t retry_ns;
+
+    uint64_t period_start;
+    uint64_t period_bytes;
+    uint64_t period_events;
+    uint64_t last_drops;
+    int have_drops;
+    uint64_t stepped_down;
+    uint64_t level_since;
+    uint64_t retry_at;
+
+    bglib_scan_ctl_cb cb;
+    void *cb_user;
+    struct bglib_scan_ctl_stats stats;
+};
+
+/* passive, then halving the window, then duplicate filtering in the controller */
+static unsigned default_ladder(struct bglib_scan_ctl_level *levels, uint16 interval)
+{
+    static const struct
+    {
+        uint8 shift;
+        uint8 active;
+        uint8 duplicates;
+    } ladder[] = {{0, 1, 0}, {0, 0, 0}, {1, 0, 0}, {2, 0, 0}, {2, 0, 1}, {3, 0, 1}};
+    unsigned i;
+
+    for (i = 0; i < sizeof(ladder) / sizeof(ladder[0]); i++)
+    {
+        levels[i].window = interval >> ladder[i].shift;
+        if (levels[i].window < 4)
+            levels[i].window = 4;
+        levels[i].active = ladder[i].active;
+        levels[i].scan_policy = gap_scan_policy_all;
+        levels[i].duplicates = ladder[i].duplicates;
+        levels[i].load = 0;
+    }
+    return i;
+}
+
+/*
+ * Rough traffic of a level: proportional to the duty cycle, scan responses
+ * add about half again per advertiser, duplicate filtering and a whitelist
+ * leave a fraction of the reports.
+ */
+static float derived_load(const struct bglib_scan_ctl_level *l, uint16 interval)
+{
+    float load = (float)l->window / interval;
+
+    if (l->active)
+        load *= 1.5f;
+    if (l->duplicates)
+        load *= 0.3f;
+    if (l->scan_policy == gap_scan_policy_whitelist)
+        load *= 0.1f;
+    return load;
+}
+
+struct bglib_scan_ctl *bglib_scan_ctl_create(const struct bglib_scan_ctl_config *cfg, bglib_scan_ctl_cb cb,
+                                             void *user)
+{
+    struct bglib_scan_ctl_config defaults;
+    struct bglib_scan_ctl *ctl;
+    float top;
+    unsigned i;
+
+    if (!cfg)
+    {
+        memset(&defaults, 0, sizeof(defaults));
+        defaults.mode = gap_discover_observation;
+        cfg = &defaults;
+    }
+    if (cfg->levels && (!cfg->nlevels || cfg->nlevels > BGLIB_SCAN_CTL_LEVELS_MAX))
+        return NULL;
+
+    ctl = calloc(1, sizeof(*ctl));
+    if (!ctl)
+        return NULL;
+    ctl->send = cfg->send;
+    ctl->user = cfg->user;
+    ctl->interval = cfg->interval ? cfg->interval : DEFAULT_INTERVAL;
+    ctl->mode = cfg->mode;
+    ctl->bytes_per_s = (cfg->baud ? cfg->baud : DEFAULT_BAUD) / 10.0f;
+    ctl->target = cfg->target > 0 ? cfg->target : DEFAULT_TARGET;
+    ctl->fill_high = cfg->fill_high > 0 ? cfg->fill_high : DEFAULT_FILL_HIGH;
+    ctl->period_ns = cfg->period_ns ? cfg->period_ns : DEFAULT_PERIOD;
+    ctl->hold_ns = cfg->hold_ns ? cfg->hold_ns : DEFAULT_HOLD;
+    ctl->retry_ns = cfg->retry_ns ? cfg->retry_ns : DEFAULT_RETRY;
+    ctl->cb = cb;
+    ctl->cb_user = user;
+
+    if (cfg->levels)
+    {
+        memcpy(ctl->levels, cfg->levels, cfg->nlevels * sizeof(*cfg->levels));
+        ctl->nlevels = cfg->nlevels;
+    }
+    else
+    {
+        ctl->nlevels = default_ladder(ctl->levels, ctl->interval);
+    }
+
+    /* clamp first: level 0 is the reference for the derived loads */
+    for (i = 0; i < ctl->nlevels; i++)
+    {
+        if (!ctl->levels[i].window || ctl->levels[i].window > ctl->interval)
+            ctl->levels[i].window = ctl->interval;
+    }
+    top = derived_load(&ctl->levels[0], ctl->interval);
+    for (i = 0; i < ctl->nlevels; i++)
+    {
+        if (ctl->levels[i].load <= 0)
+            ctl->levels[i].load = derived_load(&ctl->levels[i], ctl->interval) / top;
+    }
+    ctl->level = cfg->start_level < ctl->nlevels ? cfg->start_level : ctl->nlevels - 1;
+    ctl->applied = ctl->level;
+    return ctl;
+}
+
+void bglib_scan_ctl_destroy(struct bglib_scan_ctl *ctl)
+{
+    free(ctl);
+}
+
+static void prepare(struct bglib_scan_ctl *ctl)
+{
+    ctl->applied = ctl->level;
+    ctl->stats.applied = 0;
+    ctl->state = st_end_sent;
+    bglib_frame_send(ctl->send, ctl->user, ble_cmd_gap_end_procedure_idx);
+}
+
+static void report(struct bglib_scan_ctl *ctl, unsigned to, enum bglib_scan_ctl_reason reason, float fill,
+                   uint64_t drops, uint64_t now)
+{
+    struct bglib_scan_ctl_decision d;
+
+    d.time_ns = now;
+    d.from = ctl->level;
+    d.to = to;
+    d.reason = reason;
+    d.utilisation = ctl->stats.utilisation;
+    d.fill = fill;
+    d.events_per_s = ctl->stats.events_per_s;
+    d.drops = drops;
+
+    if (to != ctl->level)
+    {
+        ctl->stats.level_ns[ctl->level] += now - ctl->level_since;
+        ctl->level_since = now;
+        ctl->level = to;
+    }
+    if (ctl->cb)
+        ctl->cb(ctl->cb_user, &d);
+}
+
+static void restart_period(struct bglib_scan_ctl *ctl, uint64_t now)
+{
+    ctl->period_start = now;
+    ctl->period_bytes = 0;
+    ctl->period_events = 0;
+}
+
+void bglib_scan_ctl_start(struct bglib_scan_ctl *ctl, uint64_t now_ns)
+{
+    ctl->running = 1;
+    ctl->level_since = now_ns;
+    ctl->stepped_down = now_ns;
+    restart_period(ctl, now_ns);
+    prepare(ctl);
+}
+
+void bglib_scan_ctl_stop(struct bglib_scan_ctl *ctl, uint64_t now_ns)
+{
+    ctl->stats.level_ns[ctl->level] += now_ns - ctl->level_since;
+    ctl->level_since = now_ns;
+    ctl->running = 0;
+    ctl->state = st_idle;
+    ctl->stats.applied = 0;
+    bglib_frame_send(ctl->send, ctl->user, ble_cmd_gap_end_procedure_idx);
+}
+
+static void command_failed(struct bglib_scan_ctl *ctl, uint64_t now)
+{
+    ctl->stats.errors++;
+    ctl->stats.applied = 0;
+    ctl->state = st_retry;
+    ctl->retry_at = now + ctl->retry_ns;
+}
+
+int bglib_scan_ctl_on_message(struct bglib_scan_ctl *ctl, const struct ble_header *hdr, const uint8 *payload,
+                              uint64_t now_ns)
+{
+    const struct ble_msg *msg = bglib_lookup_msg(hdr);
+    const struct bglib_scan_ctl_level *l = &ctl->levels[ctl->applied];
+    uint16 result;
+
+    ctl->stats.rx_bytes += sizeof(*hdr) + bglib_payload_len(hdr);
+    ctl->period_bytes += sizeof(*hdr) + bglib_payload_len(hdr);
+    if (!msg)
+        return 0;
+    result = bglib_payload_len(hdr) >= 2 ? payload[0] | (uint16)payload[1] << 8 : 0;
+
+    switch (bglib_msg_index(msg))
+    {
+        case ble_evt_gap_scan_response_idx:
+            ctl->stats.scan_responses++;
+            ctl->period_events++;
+            return 0;
+
+        case ble_evt_system_boot_idx:
+            if (ctl->running)
+            {
+                report(ctl, ctl->level, bglib_scan_ctl_restart, 0, 0, now_ns);
+                prepare(ctl);
+            }
+            return 0;
+
+        case ble_rsp_gap_end_procedure_idx:
+            if (ctl->state != st_end_sent)
+                return 0;
+            /* fails harmlessly when nothing was running */
+            ctl->state = st_params_sent;
+            bglib_frame_send(ctl->send, ctl->user, ble_cmd_gap_set_scan_parameters_idx, ctl->interval, l->window,
+                             l->active);
+            return 1;
+
+        case ble_rsp_gap_set_scan_parameters_idx:
+            if (ctl->state != st_params_sent)
+                return 0;
+            if (result)
+            {
+                command_failed(ctl, now_ns);
+                return 1;
+            }
+            ctl->state = st_filter_sent;
+            bglib_frame_send(ctl->send, ctl->user, ble_cmd_gap_set_filtering_idx, l->scan_policy, gap_adv_policy_all,
+                             l->duplicates);
+            return 1;
+
+        case ble_rsp_gap_set_filtering_idx:
+            if (ctl->state != st_filter_sent)
+                return 0;
+            if (result)
+            {
+                command_failed(ctl, now_ns);
+                return 1;
+            }
+            ctl->state = st_discover_sent;
+            bglib_frame_send(ctl->send, ctl->user, ble_cmd_gap_discover_idx, ctl->mode);
+            return 1;
+
+        case ble_rsp_gap_discover_idx:
+            if (ctl->state != st_discover_sent)
+                return 0;
+            if (result)
+            {
+                command_failed(ctl, now_ns);
+                return 1;
+            }
+            ctl->state = st_scanning;
+            /* decided again while the commands were in flight */
+            if (ctl->applied != ctl->level)
+            {
+                prepare(ctl);
+                return 1;
+            }
+            ctl->stats.applied = 1;
+            restart_period(ctl, now_ns);
+            return 1;
+    }
+    return 0;
+}
+
+static float predict(const struct bglib_scan_ctl *ctl, float utilisation, unsigned to)
+{
+    return utilisation * ctl->levels[to].load / ctl->levels[ctl->level].load;
+}
+
+static void evaluate(struct bglib_scan_ctl *ctl, float fill, uint64_t drops, uint64_t now)
+{
+    float seconds = (now - ctl->period_start) / 1e9f;
+    float utilisation = ctl->period_bytes / (seconds * ctl->bytes_per_s);
+    unsigned to = ctl->level;
+
+    ctl->stats.utilisation = utilisation;
+    ctl->stats.events_per_s = ctl->period_events / seconds;
+    restart_period(ctl, now);
+
+    if (utilisation > ctl->target || fill > ctl->fill_high || drops)
+    {
+        enum bglib_scan_ctl_reason reason = utilisation > ctl->target ? bglib_scan_ctl_utilisation :
+                                            drops ? bglib_scan_ctl_drops : bglib_scan_ctl_fill;
+
+        ctl->stepped_down = now;
+        if (to + 1 >= ctl->nlevels)
+            return;
+        /* jump to the first level estimated to fit, one step for ring or loss pressure */
+        to++;
+        while (reason == bglib_scan_ctl_utilisation && to + 1 < ctl->nlevels &&
+               predict(ctl, utilisation, to) > ctl->target)
+            to++;
+        ctl->stats.steps_down++;
+        report(ctl, to, reason, fill, drops, now);
+        prepare(ctl);
+    }
+    else if (to > 0 && now - ctl->stepped_down >= ctl->hold_ns && fill <= ctl->fill_high / 2 &&
+             predict(ctl, utilisation, to - 1) <= ctl->target * UP_MARGIN)
+    {
+        ctl->stats.steps_up++;
+        report(ctl, to - 1, bglib_scan_ctl_headroom, fill, drops, now);
+        prepare(ctl);
+    }
+}
+
+void bglib_scan_ctl_poll(struct bglib_scan_ctl *ctl, const struct bglib_scan_ctl_load *load, uint64_t now_ns)
+{
+    int due = ctl->state == st_scanning && now_ns - ctl->period_start >= ctl->period_ns;
+    uint64_t drops = 0;
+    float fill = 0;
+
+    if (!ctl->running)
+        return;
+    /* losses while settings change belong to the previous level and are not counted */
+    if (load && (due || ctl->state != st_scanning))
+    {
+        if (load->rx_size)
+            fill = (float)load->rx_fill / load->rx_size;
+        if (ctl->have_drops && load->drops > ctl->last_drops)
+            drops = load->drops - ctl->last_drops;
+        ctl->last_drops = load->drops;
+        ctl->have_drops = 1;
+    }
+
+    if (ctl->state == st_retry && now_ns >= ctl->retry_at)
+    {
+        report(ctl, ctl->level, bglib_scan_ctl_restart, 0, 0, now_ns);
+        prepare(ctl);
+    }
+    else if (due)
+    {
+        evaluate(ctl, fill, drops, now_ns);
+    }
+}
+
+void bglib_scan_ctl_level(const struct bglib_scan_ctl *ctl, struct bglib_scan_ctl_level *out)
+{
+    *out = ctl->levels[ctl->level];
+}
+
+void bglib_scan_ctl_get_stats(const struct bglib_scan_ctl *ctl, uint64_t now_ns, struct bglib_scan_ctl_stats *out)
+{
+    *out = ctl->stats;
+    out->level = ctl->level;
+    if (ctl->running)
+        out->level_ns[ctl->level] += now_ns - ctl->level_since;
+}
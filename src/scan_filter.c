@@ -0,0 +1,444 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dispatch.h"
+#include "gap_ad.h"
+#include "hash.h"
+#include "scan_filter.h"
+
+#define NONE          0xffffffffu
+#define ADDR_MASK     (((uint64_t)1 << 48) - 1)
+
+#define NEED_COMPANY  0x01
+#define NEED_UUID16   0x02
+#define NEED_UUID128  0x04
+#define NEED_NAME     0x08
+
+#define MAX_UUID16    16
+#define MAX_UUID128   2
+#define NAME_KEY_MAX  4
+
+enum anchor
+{
+    anchor_none,
+    anchor_addr,
+    anchor_company,
+    anchor_uuid128,
+    anchor_uuid16,
+    anchor_name
+};
+
+struct rule
+{
+    uint64_t addr_mask;
+    uint64_t addr_value;
+    uint32_t type_mask;
+    int16 rssi_min;
+    uint16 company;
+    uint16 uuid16;
+    uint8 need;
+    uint8 action;
+    uint32_t next;
+    uint8 name_len;
+    char name[30];
+    uint8 uuid128[16];
+};
+
+struct bucket
+{
+    uint64_t key;
+    uint32_t head;
+};
+
+struct bglib_scan_filter
+{
+    struct rule *rules;
+    uint64_t *hits;
+    unsigned nrules;
+
+    struct bucket *buckets;
+    unsigned mask;
+    uint32_t wildcard;          /* rules without an anchor */
+
+    uint8 addr_lens[49];        /* distinct address prefix lengths in use */
+    unsigned naddr_lens;
+    uint8 name_keys;            /* bit k-1 set if some rule is keyed on k name bytes */
+
+    uint8 default_action;
+    struct bglib_scan_filter_stats stats;
+};
+
+/* everything the rules look at, extracted in one pass over the AD data */
+struct features
+{
+    uint64_t addr;
+    uint8 type;
+    int8 rssi;
+    uint8 has_company;
+    uint16 company;
+    uint8 n16;
+    uint8 n128;
+    uint8 name_len;
+    const char *name;
+    uint16 uuid16[MAX_UUID16];
+    const uint8 *uuid128[MAX_UUID128];
+};
+
+static uint64_t make_key(enum anchor kind, uint64_t value)
+{
+    return (uint64_t)kind << 56 | (value & (((uint64_t)1 << 56) - 1));
+}
+
+static uint64_t addr_key(uint64_t addr, unsigned bits)
+{
+    uint64_t mask = bits ? ADDR_MASK & ~((((uint64_t)1 << (48 - bits)) - 1)) : 0;
+
+    return make_key(anchor_addr, (uint64_t)bits << 48 | (addr & mask));
+}
+
+static uint64_t name_key(const char *name, unsigned k)
+{
+    uint64_t v = 0;
+    unsigned i;
+
+    for (i = 0; i < k; i++)
+        v |= (uint64_t)(uint8)name[i] << (8 * i);
+    return make_key(anchor_name, (uint64_t)k << 48 | v);
+}
+
+static uint64_t uuid128_key(const uint8 *uuid)
+{
+    return make_key(anchor_uuid128, bglib_hash64(uuid, 16, 0));
+}
+
+static struct bucket *find_bucket(const struct bglib_scan_filter *f, uint64_t key)
+{
+    unsigned i = bglib_mix64(key) & f->mask;
+
+    while (f->buckets[i].key && f->buckets[i].key != key)
+        i = (i + 1) & f->mask;
+    return &f->buckets[i];
+}
+
+static uint64_t anchor_of(const struct bglib_scan_rule *r)
+{
+    if ((r->match & BGLIB_SCAN_MATCH_ADDR) && r->addr_bits >= 8)
+        return addr_key(bglib_addr_key(&r->addr, 0), r->addr_bits > 48 ? 48 : r->addr_bits);
+    if (r->match & BGLIB_SCAN_MATCH_COMPANY)
+        return make_key(anchor_company, r->company);
+    if (r->match & BGLIB_SCAN_MATCH_UUID128)
+        return uuid128_key(r->uuid128);
+    if (r->match & BGLIB_SCAN_MATCH_UUID16)
+        return make_key(anchor_uuid16, r->uuid16);
+    if ((r->match & BGLIB_SCAN_MATCH_NAME) && r->name_len)
+        return name_key(r->name, r->name_len < NAME_KEY_MAX ? r->name_len : NAME_KEY_MAX);
+    return 0;
+}
+
+static void compile_rule(struct rule *c, const struct bglib_scan_rule *r)
+{
+    unsigned bits = r->addr_bits > 48 ? 48 : r->addr_bits;
+
+    memset(c, 0, sizeof(*c));
+    if (r->match & BGLIB_SCAN_MATCH_ADDR)
+    {
+        c->addr_mask = bits ? ADDR_MASK & ~((((uint64_t)1 << (48 - bits)) - 1)) : 0;
+        c->addr_value = bglib_addr_key(&r->addr, 0) & c->addr_mask;
+    }
+    c->type_mask = (r->match & BGLIB_SCAN_MATCH_TYPE) ? (uint32_t)1 << (r->address_type & 31) : 0xffffffffu;
+    c->rssi_min = (r->match & BGLIB_SCAN_MATCH_RSSI) ? r->rssi_min : -32768;
+    if (r->match & BGLIB_SCAN_MATCH_COMPANY)
+    {
+        c->need |= NEED_COMPANY;
+        c->company = r->company;
+    }
+    if (r->match & BGLIB_SCAN_MATCH_UUID16)
+    {
+        c->need |= NEED_UUID16;
+        c->uuid16 = r->uuid16;
+    }
+    if (r->match & BGLIB_SCAN_MATCH_UUID128)
+    {
+        c->need |= NEED_UUID128;
+        memcpy(c->uuid128, r->uuid128, 16);
+    }
+    if (r->match & BGLIB_SCAN_MATCH_NAME)
+    {
+        c->need |= NEED_NAME;
+        c->name_len = r->name_len > sizeof(c->name) ? sizeof(c->name) : r->name_len;
+        memcpy(c->name, r->name, c->name_len);
+    }
+    c->action = r->action == bglib_scan_drop;
+    c->next = NONE;
+}
+
+struct bglib_scan_filter *bglib_scan_filter_compile(const struct bglib_scan_rule *rules, unsigned n,
+                                                    enum bglib_scan_action default_action)
+{
+    struct bglib_scan_filter *f = calloc(1, sizeof(*f));
+    unsigned size = 16;
+    uint32_t *tail;
+    unsigned i, j;
+
+    if (!f)
+        return NULL;
+    while (size < 2 * n)
+        size <<= 1;
+    f->mask = size - 1;
+    f->nrules = n;
+    f->wildcard = NONE;
+    f->default_action = default_action == bglib_scan_drop;
+
+    f->rules = malloc((n ? n : 1) * sizeof(*f->rules));
+    f->hits = calloc(n ? n : 1, sizeof(*f->hits));
+    f->buckets = calloc(size, sizeof(*f->buckets));
+    tail = malloc((size + 1) * sizeof(*tail));
+    if (!f->rules || !f->hits || !f->buckets || !tail)
+    {
+        free(tail);
+        bglib_scan_filter_destroy(f);
+        return NULL;
+    }
+
+    /* chains keep the rule order; tail[size] is the wildcard chain */
+    tail[size] = NONE;
+    for (i = 0; i < n; i++)
+    {
+        uint64_t key = anchor_of(&rules[i]);
+        uint32_t *head;
+        unsigned slot;
+
+        compile_rule(&f->rules[i], &rules[i]);
+        if (!key)
+        {
+            head = &f->wildcard;
+            slot = size;
+        }
+        else
+        {
+            struct bucket *b = find_bucket(f, key);
+
+            if (!b->key)
+            {
+                b->key = key;
+                b->head = NONE;
+            }
+            head = &b->head;
+            slot = b - f->buckets;
+
+            if ((key >> 56) == anchor_addr)
+            {
+                unsigned bits = (key >> 48) & 0xff;
+
+                for (j = 0; j < f->naddr_lens && f->addr_lens[j] != bits; j++)
+                    ;
+                if (j == f->naddr_lens)
+                    f->addr_lens[f->naddr_lens++] = bits;
+            }
+            else if ((key >> 56) == anchor_name)
+                f->name_keys |= 1 << (((key >> 48) & 0xff) - 1);
+        }
+
+        if (*head == NONE)
+            *head = i;
+        else
+            f->rules[tail[slot]].next = i;
+        tail[slot] = i;
+    }
+
+    free(tail);
+    return f;
+}
+
+void bglib_scan_filter_destroy(struct bglib_scan_filter *f)
+{
+    if (!f)
+        return;
+    free(f->rules);
+    free(f->hits);
+    free(f->buckets);
+    free(f);
+}
+
+static void extract(struct features *ft, const struct ble_msg_gap_scan_response_evt_t *msg,
+                    unsigned payload_len)
+{
+    struct gap_ad_iter it;
+    struct gap_ad ad;
+    const uint8 *data;
+    unsigned len = gap_ad_scan_data(msg, payload_len, &data);
+    unsigned i, k, n;
+    uint8 size;
+
+    ft->addr = bglib_addr_key(&msg->sender, 0);
+    ft->type = msg->address_type;
+    ft->rssi = msg->rssi;
+    ft->has_company = 0;
+    ft->company = 0;
+    ft->n16 = 0;
+    ft->n128 = 0;
+    ft->name_len = 0;
+    ft->name = NULL;
+
+    gap_ad_iter_init(&it, data, len);
+    while (gap_ad_iter_next(&it, &ad) > 0)
+    {
+        switch (ad.type)
+        {
+            case gap_ad_type_manufacturer_data:
+                if (!ft->has_company && ad.len >= 2)
+                {
+                    ft->has_company = 1;
+                    ft->company = ad.data[0] | (uint16)ad.data[1] << 8;
+                }
+                break;
+            case gap_ad_type_localname_short:
+            case gap_ad_type_localname_complete:
+                ft->name = (const char *)ad.data;
+                ft->name_len = ad.len;
+                break;
+            case gap_ad_type_service_data_16bit:
+                ad.len = ad.len < 2 ? 0 : 2;
+                /* fall through */
+            case gap_ad_type_services_16bit_more:
+            case gap_ad_type_services_16bit_all:
+                for (i = 0; i + 2 <= ad.len && ft->n16 < MAX_UUID16; i += 2)
+                {
+                    uint16 u = ad.data[i] | (uint16)ad.data[i + 1] << 8;
+
+                    for (k = 0; k < ft->n16 && ft->uuid16[k] != u; k++)
+                        ;
+                    if (k == ft->n16)
+                        ft->uuid16[ft->n16++] = u;
+                }
+                break;
+            case gap_ad_type_service_data_128bit:
+            case gap_ad_type_services_128bit_more:
+            case gap_ad_type_services_128bit_all:
+                n = gap_ad_uuid_count(&ad, &size);
+                if (ad.type == gap_ad_type_service_data_128bit)
+                    n = ad.len >= 16;
+                for (i = 0; i < n && ft->n128 < MAX_UUID128; i++)
+                    ft->uuid128[ft->n128++] = ad.data + 16 * i;
+                break;
+        }
+    }
+}
+
+static int verify(const struct rule *r, const struct features *ft)
+{
+    unsigned i;
+    int ok;
+
+    /* fixed-size predicates without branches */
+    ok = ((ft->addr & r->addr_mask) == r->addr_value) &
+         ((r->type_mask >> (ft->type & 31)) & 1) &
+         (ft->rssi >= r->rssi_min) &
+         (((r->need & NEED_COMPANY) == 0) | (ft->has_company & (ft->company == r->company)));
+    if (!ok || !(r->need & (NEED_UUID16 | NEED_UUID128 | NEED_NAME)))
+        return ok;
+
+    if (r->need & NEED_UUID16)
+    {
+        for (i = 0; i < ft->n16 && ft->uuid16[i] != r->uuid16; i++)
+            ;
+        if (i == ft->n16)
+            return 0;
+    }
+    if (r->need & NEED_UUID128)
+    {
+        for (i = 0; i < ft->n128 && memcmp(ft->uuid128[i], r->uuid128, 16); i++)
+            ;
+        if (i == ft->n128)
+            return 0;
+    }
+    if (r->need & NEED_NAME)
+    {
+        if (!ft->name || ft->name_len < r->name_len || memcmp(ft->name, r->name, r->name_len))
+            return 0;
+    }
+    return 1;
+}
+
+static unsigned run_chain(struct bglib_scan_filter *f, uint32_t i, const struct features *ft, unsigned *verified)
+{
+    unsigned votes = 0;
+
+    for (; i != NONE; i = f->rules[i].next)
+    {
+        ++*verified;
+        if (verify(&f->rules[i], ft))
+        {
+            __atomic_fetch_add(&f->hits[i], 1, __ATOMIC_RELAXED);
+            votes |= 1 << f->rules[i].action;
+        }
+    }
+    return votes;
+}
+
+static unsigned run_key(struct bglib_scan_filter *f, uint64_t key, const struct features *ft, unsigned *verified)
+{
+    const struct bucket *b = find_bucket(f, key);
+
+    return b->key ? run_chain(f, b->head, ft, verified) : 0;
+}
+
+int bglib_scan_filter_eval(struct bglib_scan_filter *f, const struct ble_msg_gap_scan_response_evt_t *msg,
+                           unsigned payload_len)
+{
+    struct features ft;
+    unsigned votes, verified = 0;
+    unsigned i, pass;
+
+    extract(&ft, msg, payload_len);
+
+    votes = run_chain(f, f->wildcard, &ft, &verified);
+    for (i = 0; i < f->naddr_lens; i++)
+        votes |= run_key(f, addr_key(ft.addr, f->addr_lens[i]), &ft, &verified);
+    if (ft.has_company)
+        votes |= run_key(f, make_key(anchor_company, ft.company), &ft, &verified);
+    for (i = 0; i < ft.n128; i++)
+        votes |= run_key(f, uuid128_key(ft.uuid128[i]), &ft, &verified);
+    for (i = 0; i < ft.n16; i++)
+        votes |= run_key(f, make_key(anchor_uuid16, ft.uuid16[i]), &ft, &verified);
+    for (i = 1; i <= NAME_KEY_MAX && i <= ft.name_len; i++)
+    {
+        if (f->name_keys & (1 << (i - 1)))
+            votes |= run_key(f, name_key(ft.name, i), &ft, &verified);
+    }
+
+    /* a matching DROP rule wins, then PASS, then the default */
+    if (votes & (1 << bglib_scan_drop))
+        pass = 0;
+    else if (votes)
+        pass = 1;
+    else
+        pass = f->default_action == bglib_scan_pass;
+
+    __atomic_fetch_add(&f->stats.evaluated, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(pass ? &f->stats.passed : &f->stats.dropped, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&f->stats.verified, verified, __ATOMIC_RELAXED);
+    return pass;
+}
+
+uint64_t bglib_scan_filter_hits(const struct bglib_scan_filter *f, unsigned rule)
+{
+    return rule < f->nrules ? __atomic_load_n(&f->hits[rule], __ATOMIC_RELAXED) : 0;
+}
+
+void bglib_scan_filter_get_stats(const struct bglib_scan_filter *f, struct bglib_scan_filter_stats *out)
+{
+    out->evaluated = __atomic_load_n(&f->stats.evaluated, __ATOMIC_RELAXED);
+    out->passed = __atomic_load_n(&f->stats.passed, __ATOMIC_RELAXED);
+    out->dropped = __atomic_load_n(&f->stats.dropped, __ATOMIC_RELAXED);
+    out->verified = __atomic_load_n(&f->stats.verified, __ATOMIC_RELAXED);
+}
+
+int bglib_scan_filter_dispatch(void *f, const struct ble_msg *msg, const struct ble_header *hdr,
+                               const uint8 *payload)
+{
+    if (bglib_msg_index(msg) != ble_evt_gap_scan_response_idx)
+        return 1;
+    return bglib_scan_filter_eval(f, (const struct ble_msg_gap_scan_response_evt_t *)payload,
+                                  bglib_payload_len(hdr));
+}
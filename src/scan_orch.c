@@ -0,0 +1,455 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dispatch.h"
+#include "gap_ad.h"
+#include "hash.h"
+#include "scan_orch.h"
+
+#define USED            ((uint64_t)1 << 63)
+#define UNIT_NS         625000ull
+#define DEFAULT_PENDING 1024
+#define DEFAULT_DEDUPE  20000000ull
+#define DEFAULT_RETRY   1000000000ull
+
+enum adapter_state
+{
+    st_idle,
+    st_end_sent,        /* gap_end_procedure in flight */
+    st_params_sent,     /* gap_set_scan_parameters in flight */
+    st_armed,           /* waiting for the phase to start discovery */
+    st_discover_sent,
+    st_scanning,
+    st_retry            /* waiting retry_ns before preparing again */
+};
+
+struct adapter
+{
+    bglib_send_fn send;
+    void *user;
+    uint8 state;
+    uint8 active;
+    uint64_t offset_ns;
+    uint64_t start_at;
+    uint64_t scanning_since;
+    uint64_t scanned_ns;
+};
+
+struct pending
+{
+    uint64_t key;
+    uint64_t hash;
+    uint32_t seq;
+    struct bglib_scan_report report;
+};
+
+struct fifo_entry
+{
+    uint64_t key;
+    uint32_t seq;
+};
+
+struct bglib_scan_orch
+{
+    struct adapter adapters[BGLIB_SCAN_ADAPTERS_MAX];
+    unsigned n;
+    uint16 interval;
+    uint16 window;
+    uint8 mode;
+    uint64_t cycle_ns;          /* three intervals: the channel sequence repeats */
+    uint64_t retry_ns;
+    uint64_t epoch;
+    uint64_t started;
+    int running;
+
+    struct pending *slots;
+    unsigned mask;
+    unsigned capacity;
+    unsigned count;
+    uint32_t seq;
+    struct fifo_entry *fifo;
+    unsigned fifo_mask;
+    unsigned head;
+    unsigned tail;
+    uint64_t dedupe_ns;
+
+    bglib_scan_report_cb cb;
+    void *cb_user;
+
+    uint64_t restarts;
+    uint64_t errors;
+    uint64_t receptions;
+    uint64_t reports;
+};
+
+struct bglib_scan_orch *bglib_scan_orch_create(const struct bglib_scan_adapter *adapters, unsigned n,
+                                               const struct bglib_scan_plan *plan,
+                                               bglib_scan_report_cb cb, void *user)
+{
+    struct bglib_scan_orch *orch;
+    struct bglib_scan_plan defaults;
+    uint64_t interval_ns, window_ns;
+    unsigned slots = 16;
+    unsigned i;
+
+    if (!n || n > BGLIB_SCAN_ADAPTERS_MAX)
+        return NULL;
+    if (!plan)
+    {
+        memset(&defaults, 0, sizeof(defaults));
+        defaults.mode = gap_discover_observation;
+        defaults.active_mask = 1;
+        plan = &defaults;
+    }
+
+    orch = calloc(1, sizeof(*orch));
+    if (!orch)
+        return NULL;
+    orch->n = n;
+    orch->interval = plan->interval ? plan->interval : 160;
+    orch->window = plan->window && plan->window <= orch->interval ? plan->window : orch->interval;
+    orch->mode = plan->mode;
+    orch->retry_ns = plan->retry_ns ? plan->retry_ns : DEFAULT_RETRY;
+    orch->dedupe_ns = plan->dedupe_ns ? plan->dedupe_ns : DEFAULT_DEDUPE;
+    orch->capacity = plan->pending ? plan->pending : DEFAULT_PENDING;
+    orch->cb = cb;
+    orch->cb_user = user;
+
+    interval_ns = orch->interval * UNIT_NS;
+    window_ns = orch->window * UNIT_NS;
+    orch->cycle_ns = 3 * interval_ns;
+    for (i = 0; i < n; i++)
+    {
+        orch->adapters[i].send = adapters[i].send;
+        orch->adapters[i].user = adapters[i].user;
+        orch->adapters[i].active = (plan->active_mask >> i) & 1;
+        /* channels first, then windows within the interval */
+        orch->adapters[i].offset_ns = ((i % 3) * interval_ns + (i / 3) * window_ns) % orch->cycle_ns;
+    }
+
+    while (slots - slots / 4 < orch->capacity)
+        slots <<= 1;
+    orch->mask = slots - 1;
+    orch->fifo_mask = 2 * slots - 1;
+    orch->slots = calloc(slots, sizeof(*orch->slots));
+    orch->fifo = malloc(2 * slots * sizeof(*orch->fifo));
+    if (!orch->slots || !orch->fifo)
+    {
+        bglib_scan_orch_destroy(orch);
+        return NULL;
+    }
+    return orch;
+}
+
+void bglib_scan_orch_destroy(struct bglib_scan_orch *orch)
+{
+    if (!orch)
+        return;
+    free(orch->slots);
+    free(orch->fifo);
+    free(orch);
+}
+
+static void stop_scanning(struct adapter *a, uint64_t now)
+{
+    if (a->state == st_scanning)
+        a->scanned_ns += now - a->scanning_since;
+}
+
+static void prepare(struct adapter *a)
+{
+    a->state = st_end_sent;
+    bglib_frame_send(a->send, a->user, ble_cmd_gap_end_procedure_idx);
+}
+
+/* next start time of the adapter's phase that is not in the past */
+static uint64_t aligned_start(const struct bglib_scan_orch *orch, const struct adapter *a, uint64_t now)
+{
+    uint64_t t = orch->epoch + a->offset_ns;
+
+    if (t < now)
+        t += (now - t + orch->cycle_ns - 1) / orch->cycle_ns * orch->cycle_ns;
+    return t;
+}
+
+void bglib_scan_orch_start(struct bglib_scan_orch *orch, uint64_t now_ns)
+{
+    unsigned i;
+
+    orch->epoch = now_ns;
+    orch->started = now_ns;
+    orch->running = 1;
+    for (i = 0; i < orch->n; i++)
+    {
+        struct adapter *a = &orch->adapters[i];
+
+        a->scanned_ns = 0;
+        a->start_at = aligned_start(orch, a, now_ns);
+        prepare(a);
+    }
+}
+
+static unsigned home(const struct bglib_scan_orch *orch, uint64_t key)
+{
+    return bglib_mix64(key) & orch->mask;
+}
+
+static unsigned probe(const struct bglib_scan_orch *orch, uint64_t key)
+{
+    unsigned i = home(orch, key);
+
+    while (orch->slots[i].key && orch->slots[i].key != key)
+        i = (i + 1) & orch->mask;
+    return i;
+}
+
+static void delete_slot(struct bglib_scan_orch *orch, unsigned i)
+{
+    unsigned j = i;
+    unsigned k;
+
+    orch->count--;
+    for (;;)
+    {
+        j = (j + 1) & orch->mask;
+        if (!orch->slots[j].key)
+            break;
+        k = home(orch, orch->slots[j].key);
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        orch->slots[i] = orch->slots[j];
+        i = j;
+    }
+    orch->slots[i].key = 0;
+}
+
+static unsigned emit_slot(struct bglib_scan_orch *orch, unsigned i)
+{
+    struct bglib_scan_report report = orch->slots[i].report;
+
+    delete_slot(orch, i);
+    orch->reports++;
+    if (orch->cb)
+        orch->cb(orch->cb_user, &report);
+    return 1;
+}
+
+/* returns 1 if the FIFO head was a live report */
+static int pop_head(struct bglib_scan_orch *orch)
+{
+    struct fifo_entry *e = &orch->fifo[orch->head++ & orch->fifo_mask];
+    unsigned i = probe(orch, e->key);
+
+    if (!orch->slots[i].key || orch->slots[i].seq != e->seq)
+        return 0;
+    return emit_slot(orch, i);
+}
+
+void bglib_scan_orch_stop(struct bglib_scan_orch *orch, uint64_t now_ns)
+{
+    unsigned i;
+
+    orch->running = 0;
+    for (i = 0; i < orch->n; i++)
+    {
+        stop_scanning(&orch->adapters[i], now_ns);
+        orch->adapters[i].state = st_idle;
+        bglib_frame_send(orch->adapters[i].send, orch->adapters[i].user, ble_cmd_gap_end_procedure_idx);
+    }
+    while (orch->head != orch->tail)
+        pop_head(orch);
+}
+
+void bglib_scan_orch_poll(struct bglib_scan_orch *orch, uint64_t now_ns)
+{
+    unsigned i;
+
+    for (i = 0; orch->running && i < orch->n; i++)
+    {
+        struct adapter *a = &orch->adapters[i];
+
+        if (a->state == st_armed && now_ns >= a->start_at)
+        {
+            a->state = st_discover_sent;
+            bglib_frame_send(a->send, a->user, ble_cmd_gap_discover_idx, orch->mode);
+        }
+        else if (a->state == st_retry && now_ns >= a->start_at)
+        {
+            a->start_at = aligned_start(orch, a, now_ns);
+            prepare(a);
+        }
+    }
+
+    while (orch->head != orch->tail)
+    {
+        struct fifo_entry *e = &orch->fifo[orch->head & orch->fifo_mask];
+        unsigned k = probe(orch, e->key);
+
+        if (orch->slots[k].key && orch->slots[k].seq == e->seq &&
+            orch->slots[k].report.first_ns + orch->dedupe_ns > now_ns)
+            break;
+        pop_head(orch);
+    }
+}
+
+static void on_scan_response(struct bglib_scan_orch *orch, unsigned adapter,
+                             const struct ble_msg_gap_scan_response_evt_t *msg, unsigned payload_len,
+                             uint64_t now)
+{
+    uint64_t key = (bglib_addr_key(&msg->sender, msg->address_type) | (uint64_t)(msg->packet_type & 0x7f) << 56) | USED;
+    struct bglib_scan_report *r;
+    const uint8 *data;
+    unsigned len = gap_ad_scan_data(msg, payload_len, &data);
+    uint64_t hash;
+    unsigned i;
+
+    if (len > sizeof(r->data))
+        len = sizeof(r->data);
+    hash = bglib_hash64(data, len, 0);
+    orch->receptions++;
+
+    i = probe(orch, key);
+    if (orch->slots[i].key && orch->slots[i].hash != hash)
+    {
+        /* new payload: the previous report is complete */
+        emit_slot(orch, i);
+        i = probe(orch, key);
+    }
+
+    if (!orch->slots[i].key)
+    {
+        while (orch->count == orch->capacity || orch->tail - orch->head > orch->fifo_mask)
+            pop_head(orch);
+        i = probe(orch, key);
+
+        orch->slots[i].key = key;
+        orch->slots[i].hash = hash;
+        orch->slots[i].seq = ++orch->seq;
+        orch->count++;
+        orch->fifo[orch->tail & orch->fifo_mask].key = key;
+        orch->fifo[orch->tail & orch->fifo_mask].seq = orch->slots[i].seq;
+        orch->tail++;
+
+        r = &orch->slots[i].report;
+        memset(r, 0, sizeof(*r));
+        memset(r->rssi, BGLIB_SCAN_NOT_HEARD, sizeof(r->rssi));
+        r->sender = msg->sender;
+        r->address_type = msg->address_type;
+        r->packet_type = msg->packet_type;
+        r->bond = msg->bond;
+        r->best_rssi = msg->rssi;
+        r->best_adapter = adapter;
+        r->data_len = len;
+        memcpy(r->data, data, len);
+        r->first_ns = now;
+    }
+
+    r = &orch->slots[i].report;
+    r->adapters |= 1 << adapter;
+    if (r->rssi[adapter] == BGLIB_SCAN_NOT_HEARD || msg->rssi > r->rssi[adapter])
+        r->rssi[adapter] = msg->rssi;
+    if (msg->rssi > r->best_rssi)
+    {
+        r->best_rssi = msg->rssi;
+        r->best_adapter = adapter;
+    }
+}
+
+static void command_failed(struct bglib_scan_orch *orch, struct adapter *a, uint64_t now)
+{
+    orch->errors++;
+    stop_scanning(a, now);
+    a->state = st_retry;
+    a->start_at = now + orch->retry_ns;
+}
+
+int bglib_scan_orch_on_message(struct bglib_scan_orch *orch, unsigned adapter, const struct ble_header *hdr,
+                               const uint8 *payload, uint64_t now_ns)
+{
+    const struct ble_msg *msg = bglib_lookup_msg(hdr);
+    struct adapter *a;
+    uint16 result;
+
+    if (!msg || adapter >= orch->n)
+        return 0;
+    a = &orch->adapters[adapter];
+    result = bglib_payload_len(hdr) >= 2 ? payload[0] | (uint16)payload[1] << 8 : 0;
+
+    switch (bglib_msg_index(msg))
+    {
+        case ble_evt_gap_scan_response_idx:
+            on_scan_response(orch, adapter, (const struct ble_msg_gap_scan_response_evt_t *)payload,
+                             bglib_payload_len(hdr), now_ns);
+            return 1;
+
+        case ble_evt_system_boot_idx:
+            if (!orch->running)
+                return 0;
+            orch->restarts++;
+            stop_scanning(a, now_ns);
+            a->start_at = aligned_start(orch, a, now_ns);
+            prepare(a);
+            return 0;
+
+        case ble_rsp_gap_end_procedure_idx:
+            if (a->state != st_end_sent)
+                return 0;
+            /* fails harmlessly when nothing was running */
+            a->state = st_params_sent;
+            bglib_frame_send(a->send, a->user, ble_cmd_gap_set_scan_parameters_idx, orch->interval, orch->window,
+                             a->active);
+            return 1;
+
+        case ble_rsp_gap_set_scan_parameters_idx:
+            if (a->state != st_params_sent)
+                return 0;
+            if (result)
+                command_failed(orch, a, now_ns);
+            else
+                a->state = st_armed;
+            return 1;
+
+        case ble_rsp_gap_discover_idx:
+            if (a->state != st_discover_sent)
+                return 0;
+            if (result)
+                command_failed(orch, a, now_ns);
+            else
+            {
+                a->state = st_scanning;
+                a->scanning_since = now_ns;
+            }
+            return 1;
+    }
+    return 0;
+}
+
+void bglib_scan_orch_get_coverage(const struct bglib_scan_orch *orch, uint64_t now_ns,
+                                  struct bglib_scan_coverage *out)
+{
+    double elapsed = now_ns > orch->started ? (double)(now_ns - orch->started) : 0;
+    double ratio = (double)orch->window / orch->interval;
+    unsigned i;
+
+    memset(out, 0, sizeof(*out));
+    out->adapters = orch->n;
+    for (i = 0; i < orch->n; i++)
+    {
+        const struct adapter *a = &orch->adapters[i];
+        uint64_t scanned = a->scanned_ns;
+
+        if (a->state == st_scanning)
+        {
+            out->scanning++;
+            scanned += now_ns - a->scanning_since;
+        }
+        out->duty[i] = elapsed > 0 ? ratio * scanned / elapsed : 0;
+        out->coverage += out->duty[i];
+    }
+    if (out->coverage > 1)
+        out->coverage = 1;
+    out->restarts = orch->restarts;
+    out->errors = orch->errors;
+    out->receptions = orch->receptions;
+    out->reports = orch->reports;
+}
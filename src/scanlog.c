@@ -0,0 +1,630 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gap_ad.h"
+#include "hash.h"
+#include "scanlog.h"
+
+#define FILE_MAGIC      0x4c534742u     /* "BGSL" */
+#define BLOCK_MAGIC     0x4b4c4247u     /* "BGLK" */
+#define INDEX_MAGIC     0x58534742u     /* "BGSX" */
+#define VERSION         1
+#define DEFAULT_ROWS    4096
+#define DATA_MAX        254
+#define REPEAT          255             /* length column: same payload as the sender's previous row */
+#define NONE            0xffffffffu
+#define USED            ((uint64_t)1 << 63)
+
+struct file_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_rows;
+    uint32_t reserved;
+};
+
+/* columns follow in this order; rssi, packet type, bond and length are rows bytes each */
+struct block_header
+{
+    uint32_t magic;
+    uint32_t size;              /* whole block, multiple of 8 */
+    uint32_t rows;
+    uint32_t dict;              /* 8-byte address keys following the header */
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t base_ns;           /* first timestamp, the time column starts with delta 0 */
+    uint32_t time_off;
+    uint32_t addr_off;
+    uint32_t bytes_off;
+    uint32_t blob_off;
+    uint32_t blob_len;
+    uint32_t reserved;
+};
+
+struct index_entry
+{
+    uint64_t offset;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint32_t rows;
+    uint32_t reserved;
+};
+
+struct trailer
+{
+    uint64_t index_off;
+    uint32_t blocks;
+    uint32_t magic;
+};
+
+struct row
+{
+    uint64_t time_ns;
+    uint32_t addr;
+    int8 rssi;
+    uint8 packet_type;
+    uint8 bond;
+    uint8 len;
+};
+
+struct dict_slot
+{
+    uint64_t key;               /* address key | USED, 0 if free */
+    uint32_t idx;
+};
+
+struct bglib_scanlog_writer
+{
+    FILE *f;
+    int error;
+    uint64_t offset;
+    unsigned block_rows;
+
+    struct row *rows;
+    unsigned nrows;
+    uint8 *blob;
+    unsigned blob_len;
+    unsigned blob_cap;
+
+    uint64_t *dict;
+    uint32_t *last_off;         /* per dictionary entry: its latest payload in blob */
+    uint32_t *last_len;
+    unsigned ndict;
+    struct dict_slot *slots;
+    unsigned slot_mask;
+
+    struct index_entry *index;
+    unsigned nindex;
+    unsigned index_cap;
+    struct bglib_scanlog_writer_stats stats;
+};
+
+struct bglib_scanlog
+{
+    const uint8 *base;
+    size_t size;
+    const struct index_entry *index;
+    struct index_entry *recovered;  /* index rebuilt from the block headers */
+    unsigned blocks;
+};
+
+static uint8 *put_varint(uint8 *p, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (uint8)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8)v;
+    return p;
+}
+
+static const uint8 *get_varint(const uint8 *p, const uint8 *end, uint64_t *v)
+{
+    unsigned shift = 0;
+
+    *v = 0;
+    while (p < end && shift < 64)
+    {
+        *v |= (uint64_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+        shift += 7;
+    }
+    return NULL;
+}
+
+static void writer_free(struct bglib_scanlog_writer *w)
+{
+    free(w->rows);
+    free(w->blob);
+    free(w->dict);
+    free(w->last_off);
+    free(w->last_len);
+    free(w->slots);
+    free(w->index);
+    free(w);
+}
+
+struct bglib_scanlog_writer *bglib_scanlog_writer_create(const char *path, unsigned block_rows)
+{
+    struct bglib_scanlog_writer *w = calloc(1, sizeof(*w));
+    struct file_header fh;
+    unsigned slots = 16;
+
+    if (!w)
+        return NULL;
+    w->block_rows = block_rows ? block_rows : DEFAULT_ROWS;
+    while (slots < 2 * w->block_rows)
+        slots <<= 1;
+    w->slot_mask = slots - 1;
+    w->blob_cap = w->block_rows * 31;
+    w->rows = malloc(w->block_rows * sizeof(*w->rows));
+    w->blob = malloc(w->blob_cap);
+    w->dict = malloc(w->block_rows * sizeof(*w->dict));
+    w->last_off = malloc(w->block_rows * sizeof(*w->last_off));
+    w->last_len = malloc(w->block_rows * sizeof(*w->last_len));
+    w->slots = calloc(slots, sizeof(*w->slots));
+    if (!w->rows || !w->blob || !w->dict || !w->last_off || !w->last_len || !w->slots)
+    {
+        writer_free(w);
+        return NULL;
+    }
+
+    w->f = fopen(path, "wb");
+    if (!w->f)
+    {
+        writer_free(w);
+        return NULL;
+    }
+    memset(&fh, 0, sizeof(fh));
+    fh.magic = FILE_MAGIC;
+    fh.version = VERSION;
+    fh.block_rows = w->block_rows;
+    if (fwrite(&fh, sizeof(fh), 1, w->f) != 1)
+        w->error = 1;
+    w->offset = sizeof(fh);
+    w->stats.bytes = sizeof(fh);
+    return w;
+}
+
+static int write_block(struct bglib_scanlog_writer *w);
+
+static unsigned dict_index(struct bglib_scanlog_writer *w, uint64_t key)
+{
+    unsigned i = bglib_mix64(key) & w->slot_mask;
+
+    while (w->slots[i].key && w->slots[i].key != key)
+        i = (i + 1) & w->slot_mask;
+    if (!w->slots[i].key)
+    {
+        w->slots[i].key = key;
+        w->slots[i].idx = w->ndict;
+        w->dict[w->ndict] = key & ~USED;
+        w->last_len[w->ndict] = NONE;
+        w->ndict++;
+    }
+    return w->slots[i].idx;
+}
+
+int bglib_scanlog_write(struct bglib_scanlog_writer *w, const struct ble_msg_gap_scan_response_evt_t *msg,
+                        unsigned payload_len, uint64_t time_ns)
+{
+    struct row *r = &w->rows[w->nrows];
+    const uint8 *data;
+    unsigned len = gap_ad_scan_data(msg, payload_len, &data);
+    unsigned idx = dict_index(w, bglib_addr_key(&msg->sender, msg->address_type) | USED);
+
+    if (len > DATA_MAX)
+        len = DATA_MAX;
+    r->time_ns = time_ns;
+    r->addr = idx;
+    r->rssi = msg->rssi;
+    r->packet_type = msg->packet_type;
+    r->bond = msg->bond;
+
+    if (len && w->last_len[idx] == len && !memcmp(w->blob + w->last_off[idx], data, len))
+    {
+        r->len = REPEAT;
+        w->stats.repeats++;
+    }
+    else
+    {
+        if (w->blob_len + len > w->blob_cap)
+        {
+            unsigned cap = w->blob_cap * 2 + len;
+            uint8 *blob = realloc(w->blob, cap);
+
+            if (!blob)
+                return -1;
+            w->blob = blob;
+            w->blob_cap = cap;
+        }
+        memcpy(w->blob + w->blob_len, data, len);
+        w->last_off[idx] = w->blob_len;
+        w->last_len[idx] = len;
+        w->blob_len += len;
+        r->len = len;
+    }
+
+    w->stats.rows++;
+    w->stats.raw_bytes += payload_len + sizeof(uint64_t);
+    if (++w->nrows == w->block_rows)
+        return write_block(w);
+    return w->error ? -1 : 0;
+}
+
+static int add_index(struct bglib_scanlog_writer *w, const struct index_entry *e)
+{
+    if (w->nindex == w->index_cap)
+    {
+        unsigned cap = w->index_cap ? 2 * w->index_cap : 64;
+        struct index_entry *index = realloc(w->index, cap * sizeof(*index));
+
+        if (!index)
+            return -1;
+        w->index = index;
+        w->index_cap = cap;
+    }
+    w->index[w->nindex++] = *e;
+    return 0;
+}
+
+static int write_block(struct bglib_scanlog_writer *w)
+{
+    struct block_header bh;
+    struct index_entry e;
+    uint8 *buf;
+    uint8 *p;
+    uint64_t prev;
+    size_t size;
+    unsigned i;
+
+    if (!w->nrows)
+        return w->error ? -1 : 0;
+
+    size = sizeof(bh) + w->ndict * sizeof(uint64_t) + w->nrows * (10 + 5 + 4) + w->blob_len + 8;
+    buf = malloc(size);
+    if (!buf)
+        return -1;
+
+    memset(&bh, 0, sizeof(bh));
+    bh.magic = BLOCK_MAGIC;
+    bh.rows = w->nrows;
+    bh.dict = w->ndict;
+    bh.base_ns = prev = bh.min_ns = bh.max_ns = w->rows[0].time_ns;
+
+    p = buf + sizeof(bh);
+    memcpy(p, w->dict, w->ndict * sizeof(uint64_t));
+    p += w->ndict * sizeof(uint64_t);
+
+    bh.time_off = p - buf;
+    for (i = 0; i < w->nrows; i++)
+    {
+        int64_t d = (int64_t)(w->rows[i].time_ns - prev);
+
+        p = put_varint(p, (uint64_t)d << 1 ^ (uint64_t)(d >> 63));
+        prev = w->rows[i].time_ns;
+        if (prev < bh.min_ns)
+            bh.min_ns = prev;
+        if (prev > bh.max_ns)
+            bh.max_ns = prev;
+    }
+    bh.addr_off = p - buf;
+    for (i = 0; i < w->nrows; i++)
+        p = put_varint(p, w->rows[i].addr);
+
+    bh.bytes_off = p - buf;
+    for (i = 0; i < w->nrows; i++)
+        p[i] = w->rows[i].rssi;
+    p += w->nrows;
+    for (i = 0; i < w->nrows; i++)
+        p[i] = w->rows[i].packet_type;
+    p += w->nrows;
+    for (i = 0; i < w->nrows; i++)
+        p[i] = w->rows[i].bond;
+    p += w->nrows;
+    for (i = 0; i < w->nrows; i++)
+        p[i] = w->rows[i].len;
+    p += w->nrows;
+
+    bh.blob_off = p - buf;
+    bh.blob_len = w->blob_len;
+    memcpy(p, w->blob, w->blob_len);
+    p += w->blob_len;
+    while ((p - buf) & 7)
+        *p++ = 0;
+    bh.size = p - buf;
+    memcpy(buf, &bh, sizeof(bh));
+
+    if (fwrite(buf, 1, bh.size, w->f) != bh.size)
+        w->error = 1;
+    free(buf);
+
+    e.offset = w->offset;
+    e.min_ns = bh.min_ns;
+    e.max_ns = bh.max_ns;
+    e.rows = bh.rows;
+    e.reserved = 0;
+    if (add_index(w, &e))
+        w->error = 1;
+    w->offset += bh.size;
+    w->stats.bytes += bh.size;
+    w->stats.blocks++;
+
+    w->nrows = 0;
+    w->ndict = 0;
+    w->blob_len = 0;
+    memset(w->slots, 0, (w->slot_mask + 1) * sizeof(*w->slots));
+    return w->error ? -1 : 0;
+}
+
+int bglib_scanlog_writer_flush(struct bglib_scanlog_writer *w)
+{
+    /* readers mapping the file see complete blocks only */
+    if (write_block(w) || fflush(w->f))
+        w->error = 1;
+    return w->error ? -1 : 0;
+}
+
+int bglib_scanlog_writer_close(struct bglib_scanlog_writer *w)
+{
+    struct trailer t;
+    int ok;
+
+    write_block(w);
+    t.index_off = w->offset;
+    t.blocks = w->nindex;
+    t.magic = INDEX_MAGIC;
+    if (w->nindex && fwrite(w->index, sizeof(*w->index), w->nindex, w->f) != w->nindex)
+        w->error = 1;
+    if (fwrite(&t, sizeof(t), 1, w->f) != 1)
+        w->error = 1;
+    if (fclose(w->f))
+        w->error = 1;
+    ok = !w->error;
+    writer_free(w);
+    return ok ? 0 : -1;
+}
+
+void bglib_scanlog_writer_get_stats(const struct bglib_scanlog_writer *w,
+                                    struct bglib_scanlog_writer_stats *out)
+{
+    *out = w->stats;
+}
+
+/* index of a file whose writer was not closed: follow the block headers */
+static int recover(struct bglib_scanlog *log)
+{
+    size_t off = sizeof(struct file_header);
+    unsigned cap = 0;
+
+    while (off + sizeof(struct block_header) <= log->size)
+    {
+        struct block_header bh;
+        struct index_entry *e;
+
+        memcpy(&bh, log->base + off, sizeof(bh));
+        if (bh.magic != BLOCK_MAGIC || bh.size < sizeof(bh) || bh.size > log->size - off)
+            break;
+        if (log->blocks == cap)
+        {
+            cap = cap ? 2 * cap : 64;
+            e = realloc(log->recovered, cap * sizeof(*e));
+            if (!e)
+                return -1;
+            log->recovered = e;
+        }
+        e = &log->recovered[log->blocks++];
+        e->offset = off;
+        e->min_ns = bh.min_ns;
+        e->max_ns = bh.max_ns;
+        e->rows = bh.rows;
+        e->reserved = 0;
+        off += bh.size;
+    }
+    log->index = log->recovered;
+    return 0;
+}
+
+struct bglib_scanlog *bglib_scanlog_open(const char *path)
+{
+    struct bglib_scanlog *log;
+    struct file_header fh;
+    struct trailer t;
+    struct stat st;
+    void *base;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(fh))
+    {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    memcpy(&fh, base, sizeof(fh));
+    log = calloc(1, sizeof(*log));
+    if (!log || fh.magic != FILE_MAGIC || fh.version != VERSION)
+    {
+        free(log);
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    log->base = base;
+    log->size = st.st_size;
+
+    if (log->size >= sizeof(fh) + sizeof(t))
+    {
+        memcpy(&t, log->base + log->size - sizeof(t), sizeof(t));
+        if (t.magic == INDEX_MAGIC && t.index_off >= sizeof(fh) && !(t.index_off & 7) &&
+            t.index_off + (uint64_t)t.blocks * sizeof(struct index_entry) == log->size - sizeof(t))
+        {
+            log->index = (const struct index_entry *)(log->base + t.index_off);
+            log->blocks = t.blocks;
+            return log;
+        }
+    }
+    if (recover(log))
+    {
+        bglib_scanlog_close(log);
+        return NULL;
+    }
+    return log;
+}
+
+void bglib_scanlog_close(struct bglib_scanlog *log)
+{
+    if (!log)
+        return;
+    munmap((void *)log->base, log->size);
+    free(log->recovered);
+    free(log);
+}
+
+unsigned bglib_scanlog_blocks(const struct bglib_scanlog *log)
+{
+    return log->blocks;
+}
+
+int bglib_scanlog_block_info(const struct bglib_scanlog *log, unsigned i, struct bglib_scanlog_block *out)
+{
+    if (i >= log->blocks)
+        return -1;
+    out->min_ns = log->index[i].min_ns;
+    out->max_ns = log->index[i].max_ns;
+    out->rows = log->index[i].rows;
+    return 0;
+}
+
+/* latest payload of a dictionary entry while decoding a block */
+struct last_payload
+{
+    const uint8 *data;
+    uint8 len;
+};
+
+/* returns rows delivered, -1 if corrupt; *stop is set when cb asked to stop */
+static int64_t scan_block(const struct bglib_scanlog *log, uint64_t offset, uint64_t from_ns, uint64_t to_ns,
+                          bglib_scanlog_cb cb, void *user, int *stop)
+{
+    const uint8 *b = log->base + offset;
+    const uint8 *tp;
+    const uint8 *ap;
+    const uint8 *cols;
+    struct block_header bh;
+    struct bglib_scan_record rec;
+    struct last_payload *last;
+    uint64_t t;
+    uint32_t blob_pos = 0;
+    int64_t n = 0;
+    unsigned i;
+
+    if (offset > log->size || log->size - offset < sizeof(bh))
+        return -1;
+    memcpy(&bh, b, sizeof(bh));
+    if (bh.magic != BLOCK_MAGIC || bh.size > log->size - offset ||
+        bh.time_off < sizeof(bh) + (uint64_t)bh.dict * sizeof(uint64_t) || bh.addr_off < bh.time_off ||
+        bh.bytes_off < bh.addr_off || bh.blob_off < bh.bytes_off + 4ull * bh.rows ||
+        bh.blob_off + (uint64_t)bh.blob_len > bh.size)
+        return -1;
+
+    last = calloc(bh.dict ? bh.dict : 1, sizeof(*last));
+    if (!last)
+        return -1;
+    tp = b + bh.time_off;
+    ap = b + bh.addr_off;
+    cols = b + bh.bytes_off;
+    t = bh.base_ns;
+
+    for (i = 0; i < bh.rows; i++)
+    {
+        uint64_t delta;
+        uint64_t idx;
+        uint64_t key;
+        uint8 len = cols[3 * bh.rows + i];
+        unsigned j;
+
+        tp = get_varint(tp, b + bh.addr_off, &delta);
+        if (tp)
+            ap = get_varint(ap, b + bh.bytes_off, &idx);
+        if (!tp || !ap || idx >= bh.dict)
+        {
+            n = -1;
+            break;
+        }
+        t += (int64_t)(delta >> 1) ^ -(int64_t)(delta & 1);
+
+        /* the blob position advances with every row, in range or not */
+        if (len != REPEAT)
+        {
+            if (blob_pos + len > bh.blob_len)
+            {
+                n = -1;
+                break;
+            }
+            last[idx].data = b + bh.blob_off + blob_pos;
+            last[idx].len = len;
+            blob_pos += len;
+        }
+        else if (!last[idx].data)
+        {
+            n = -1;
+            break;
+        }
+        if (t < from_ns || t >= to_ns)
+            continue;
+
+        memcpy(&key, b + sizeof(bh) + idx * sizeof(uint64_t), sizeof(key));
+        for (j = 0; j < 6; j++)
+            rec.sender.addr[j] = key >> (8 * j);
+        rec.address_type = key >> 48;
+        rec.time_ns = t;
+        rec.rssi = (int8)cols[i];
+        rec.packet_type = cols[bh.rows + i];
+        rec.bond = cols[2 * bh.rows + i];
+        rec.data = last[idx].data;
+        rec.data_len = last[idx].len;
+        n++;
+        if (cb(user, &rec))
+        {
+            *stop = 1;
+            break;
+        }
+    }
+    free(last);
+    return n;
+}
+
+int64_t bglib_scanlog_query(const struct bglib_scanlog *log, uint64_t from_ns, uint64_t to_ns,
+                            bglib_scanlog_cb cb, void *user)
+{
+    int64_t total = 0;
+    int stop = 0;
+    unsigned i;
+
+    for (i = 0; i < log->blocks && !stop; i++)
+    {
+        const struct index_entry *e = &log->index[i];
+        int64_t n;
+
+        if (e->max_ns < from_ns || e->min_ns >= to_ns)
+            continue;
+        n = scan_block(log, e->offset, from_ns, to_ns, cb, user, &stop);
+        if (n < 0)
+            return -1;
+        total += n;
+    }
+    return total;
+}
@@ -0,0 +1,248 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clock.h"
+#include "dispatch.h"
+#include "hash.h"
+#include "scanq.h"
+
+#define USED ((uint64_t)1 << 63)
+
+/* sender of a queued event, CONFLATE only */
+struct slot
+{
+    uint64_t key;               /* bglib_addr_key() | USED, 0 if free */
+    uint32_t pos;               /* queue position of the event */
+};
+
+struct bglib_scanq
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    enum bglib_scanq_policy policy;
+    unsigned mask;
+    uint32_t head;
+    uint32_t tail;
+    struct bglib_scan_event *events;
+    uint64_t *keys;             /* sender of each queue position */
+    struct slot *slots;
+    unsigned slot_mask;
+    struct bglib_scanq_stats stats;
+};
+
+struct bglib_scanq *bglib_scanq_create(unsigned capacity, enum bglib_scanq_policy policy)
+{
+    struct bglib_scanq *q = calloc(1, sizeof(*q));
+    pthread_condattr_t attr;
+    unsigned size = 16;
+
+    if (!q)
+        return NULL;
+    while (size < capacity)
+        size <<= 1;
+    q->policy = policy;
+    q->mask = size - 1;
+    q->slot_mask = 2 * size - 1;
+    q->events = malloc(size * sizeof(*q->events));
+    q->keys = malloc(size * sizeof(*q->keys));
+    q->slots = calloc(2 * size, sizeof(*q->slots));
+    if (!q->events || !q->keys || !q->slots)
+    {
+        free(q->events);
+        free(q->keys);
+        free(q->slots);
+        free(q);
+        return NULL;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->ready, &attr);
+    pthread_condattr_destroy(&attr);
+    return q;
+}
+
+void bglib_scanq_destroy(struct bglib_scanq *q)
+{
+    if (!q)
+        return;
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->ready);
+    free(q->events);
+    free(q->keys);
+    free(q->slots);
+    free(q);
+}
+
+static unsigned home(const struct bglib_scanq *q, uint64_t key)
+{
+    return bglib_mix64(key) & q->slot_mask;
+}
+
+static unsigned probe(const struct bglib_scanq *q, uint64_t key)
+{
+    unsigned i = home(q, key);
+
+    while (q->slots[i].key && q->slots[i].key != key)
+        i = (i + 1) & q->slot_mask;
+    return i;
+}
+
+/* backward-shift deletion, as in the device table */
+static void unmap(struct bglib_scanq *q, uint64_t key)
+{
+    unsigned i = probe(q, key);
+    unsigned j = i;
+    unsigned k;
+
+    if (!q->slots[i].key)
+        return;
+    for (;;)
+    {
+        j = (j + 1) & q->slot_mask;
+        if (!q->slots[j].key)
+            break;
+        k = home(q, q->slots[j].key);
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        q->slots[i] = q->slots[j];
+        i = j;
+    }
+    q->slots[i].key = 0;
+}
+
+static void store(struct bglib_scan_event *ev, const struct ble_msg_gap_scan_response_evt_t *msg,
+                  unsigned payload_len, uint64_t now_ns)
+{
+    if (payload_len > BGLIB_SCANQ_PAYLOAD_MAX)
+        payload_len = BGLIB_SCANQ_PAYLOAD_MAX;
+    ev->time_ns = now_ns;
+    ev->payload_len = payload_len;
+    memcpy(ev->payload, msg, payload_len);
+}
+
+int bglib_scanq_push(struct bglib_scanq *q, const struct ble_msg_gap_scan_response_evt_t *msg,
+                     unsigned payload_len, uint64_t now_ns)
+{
+    uint64_t key = bglib_addr_key(&msg->sender, msg->address_type) | USED;
+    struct bglib_scan_event *ev;
+    unsigned depth;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->policy == BGLIB_SCANQ_CONFLATE)
+    {
+        unsigned i = probe(q, key);
+
+        if (q->slots[i].key)
+        {
+            ev = &q->events[q->slots[i].pos & q->mask];
+            store(ev, msg, payload_len, now_ns);
+            ev->receptions++;
+            q->stats.conflated++;
+            pthread_mutex_unlock(&q->lock);
+            return 1;
+        }
+    }
+
+    if (q->tail - q->head > q->mask)
+    {
+        if (q->policy == BGLIB_SCANQ_DROP_NEWEST)
+        {
+            q->stats.dropped_newest++;
+            pthread_mutex_unlock(&q->lock);
+            return -1;
+        }
+        if (q->policy == BGLIB_SCANQ_CONFLATE)
+            unmap(q, q->keys[q->head & q->mask]);
+        q->head++;
+        q->stats.dropped_oldest++;
+    }
+
+    ev = &q->events[q->tail & q->mask];
+    store(ev, msg, payload_len, now_ns);
+    ev->receptions = 1;
+    q->keys[q->tail & q->mask] = key;
+    if (q->policy == BGLIB_SCANQ_CONFLATE)
+    {
+        unsigned i = probe(q, key);
+
+        q->slots[i].key = key;
+        q->slots[i].pos = q->tail;
+    }
+    q->tail++;
+    q->stats.pushed++;
+    depth = q->tail - q->head;
+    if (depth > q->stats.max_depth)
+        q->stats.max_depth = depth;
+    if (depth == 1)
+        pthread_cond_signal(&q->ready);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+/* called with the lock held */
+static int take(struct bglib_scanq *q, struct bglib_scan_event *out)
+{
+    const struct bglib_scan_event *ev;
+
+    if (q->head == q->tail)
+        return 0;
+    ev = &q->events[q->head & q->mask];
+    memcpy(out, ev, offsetof(struct bglib_scan_event, payload) + ev->payload_len);
+    if (q->policy == BGLIB_SCANQ_CONFLATE)
+        unmap(q, q->keys[q->head & q->mask]);
+    q->head++;
+    q->stats.popped++;
+    return 1;
+}
+
+int bglib_scanq_pop(struct bglib_scanq *q, struct bglib_scan_event *out)
+{
+    int r;
+
+    pthread_mutex_lock(&q->lock);
+    r = take(q, out);
+    pthread_mutex_unlock(&q->lock);
+    return r;
+}
+
+int bglib_scanq_wait(struct bglib_scanq *q, struct bglib_scan_event *out, uint64_t timeout_ns)
+{
+    uint64_t deadline = bglib_monotonic_ns() + timeout_ns;
+    struct timespec ts;
+    int r;
+
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    pthread_mutex_lock(&q->lock);
+    while (!(r = take(q, out)))
+    {
+        if (pthread_cond_timedwait(&q->ready, &q->lock, &ts))
+        {
+            r = take(q, out);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return r;
+}
+
+void bglib_scanq_get_stats(const struct bglib_scanq *q, struct bglib_scanq_stats *out)
+{
+    pthread_mutex_lock((pthread_mutex_t *)&q->lock);
+    *out = q->stats;
+    out->depth = q->tail - q->head;
+    pthread_mutex_unlock((pthread_mutex_t *)&q->lock);
+}
+
+int bglib_scanq_dispatch(void *q, const struct ble_msg *msg, const struct ble_header *hdr, const uint8 *payload)
+{
+    if (bglib_msg_index(msg) != ble_evt_gap_scan_response_idx)
+        return 1;
+    bglib_scanq_push(q, (const struct ble_msg_gap_scan_response_evt_t *)payload, bglib_payload_len(hdr),
+                     bglib_monotonic_ns());
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "txqueue.h"
+
+#define CACHE_LINE 64
+
+struct txq_cell
+{
+    uint64_t seq;
+    struct bglib_frame frame;
+};
+
+struct bglib_txq
+{
+    uint64_t tail __attribute__((aligned(CACHE_LINE)));  /* producers */
+    uint64_t full;
+    uint64_t head __attribute__((aligned(CACHE_LINE)));  /* consumer */
+    uint64_t popped;
+    uint64_t mask __attribute__((aligned(CACHE_LINE)));
+    struct txq_cell *cells;
+};
+
+struct bglib_txq *bglib_txq_create(unsigned capacity)
+{
+    struct bglib_txq *q;
+    uint64_t size = 2;
+    uint64_t i;
+
+    while (size < capacity)
+        size <<= 1;
+
+    if (posix_memalign((void **)&q, CACHE_LINE, sizeof(*q)))
+        return NULL;
+    memset(q, 0, sizeof(*q));
+
+    q->cells = calloc(size, sizeof(*q->cells));
+    if (!q->cells)
+    {
+        free(q);
+        return NULL;
+    }
+    q->mask = size - 1;
+    for (i = 0; i < size; i++)
+        q->cells[i].seq = i;
+
+    return q;
+}
+
+void bglib_txq_destroy(struct bglib_txq *q)
+{
+    if (!q)
+        return;
+    free(q->cells);
+    free(q);
+}
+
+int bglib_txq_push(struct bglib_txq *q, const struct bglib_frame *frame)
+{
+    struct txq_cell *cell;
+    uint64_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        int64_t dif;
+
+        cell = &q->cells[pos & q->mask];
+        dif = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0)
+        {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (dif < 0)
+        {
+            __atomic_fetch_add(&q->full, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        else
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+
+    cell->frame.len = frame->len;
+    cell->frame.split = frame->split;
+    memcpy(cell->frame.data, frame->data, frame->len);
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static struct txq_cell *txq_front(struct bglib_txq *q)
+{
+    struct txq_cell *cell = &q->cells[q->head & q->mask];
+
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != q->head + 1)
+        return NULL;
+    return cell;
+}
+
+static void txq_release(struct bglib_txq *q, struct txq_cell *cell)
+{
+    __atomic_store_n(&cell->seq, q->head + q->mask + 1, __ATOMIC_RELEASE);
+    q->head++;
+    __atomic_store_n(&q->popped, q->popped + 1, __ATOMIC_RELAXED);
+}
+
+int bglib_txq_pop(struct bglib_txq *q, struct bglib_frame *frame)
+{
+    struct txq_cell *cell = txq_front(q);
+
+    if (!cell)
+        return 0;
+
+    frame->len = cell->frame.len;
+    frame->split = cell->frame.split;
+    memcpy(frame->data, cell->frame.data, cell->frame.len);
+    txq_release(q, cell);
+
+    return 1;
+}
+
+unsigned bglib_txq_drain(struct bglib_txq *q, bglib_send_fn send, void *user)
+{
+    struct txq_cell *cell;
+    unsigned n = 0;
+
+    /* frames are written straight from their cells, no copy on this side */
+    while ((cell = txq_front(q)))
+    {
+        if (send)
+            send(user, &cell->frame);
+        else
+            bglib_frame_write(&cell->frame);
+        txq_release(q, cell);
+        n++;
+    }
+
+    return n;
+}
+
+void bglib_txq_get_stats(const struct bglib_txq *q, struct bglib_txq_stats *out)
+{
+    out->popped = __atomic_load_n(&q->popped, __ATOMIC_RELAXED);
+    out->full = __atomic_load_n(&q->full, __ATOMIC_RELAXED);
+    out->pushed = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+}